@@ -30,6 +30,8 @@ struct _GPasteClientPrivate
 {
     GDBusProxy    *proxy;
     GDBusNodeInfo *g_paste_daemon_dbus_info;
+    guint64        generation;
+    guint          changed_source;
 
     gulong         g_signal;
 };
@@ -37,6 +39,7 @@ struct _GPasteClientPrivate
 enum
 {
     CHANGED,
+    ITEM_ADDED,
     NAME_LOST,
     REEXECUTE_SELF,
     SHOW_HISTORY,
@@ -178,6 +181,49 @@ g_paste_client_get_element (GPasteClient *self,
                           uint32, index)
 }
 
+/**
+ * g_paste_client_get_thumbnail:
+ * @self: a #GPasteClient instance
+ * @index: the index of the image we want a preview of
+ * @error: a #GError
+ *
+ * Get the PNG thumbnail of an image item from the #GPasteDaemon
+ * It is empty if the item isn't an image
+ *
+ * Returns: (transfer full): the thumbnail, free it with g_bytes_unref
+ */
+G_PASTE_VISIBLE GBytes *
+g_paste_client_get_thumbnail (GPasteClient *self,
+                              guint32       index,
+                              GError      **error)
+{
+    g_return_val_if_fail (G_PASTE_IS_CLIENT (self), NULL);
+
+    GVariant *parameter = g_variant_new_uint32 (index);
+    GVariant *result = g_dbus_proxy_call_sync (self->priv->proxy,
+                                               GET_THUMBNAIL,
+                                               g_variant_new_tuple (&parameter, 1),
+                                               G_DBUS_CALL_FLAGS_NONE,
+                                               -1,
+                                               NULL, /* cancellable */
+                                               error);
+
+    if (!result)
+        return NULL;
+
+    GVariant *variant = g_variant_get_child_value (result, 0);
+    gsize length;
+    gconstpointer data = g_variant_get_fixed_array (variant, &length, sizeof (guchar));
+
+    g_variant_unref (result);
+
+    /* The bytes keep the reply alive instead of copying it */
+    return g_bytes_new_with_free_func (data,
+                                       length,
+                                       (GDestroyNotify) g_variant_unref,
+                                       variant);
+}
+
 /**
  * g_paste_client_get_history:
  * @self: a #GPasteClient instance
@@ -194,6 +240,23 @@ g_paste_client_get_history (GPasteClient *self,
     DBUS_CALL_NO_PARAM (GET_HISTORY, gchar**, strv, NULL)
 }
 
+/**
+ * g_paste_client_get_raw_history:
+ * @self: a #GPasteClient instance
+ * @error: a #GError
+ *
+ * Get the whole values of the history from the #GPasteDaemon,
+ * instead of their previews
+ *
+ * Returns: (transfer full): a newly allocated array of string
+ */
+G_PASTE_VISIBLE gchar **
+g_paste_client_get_raw_history (GPasteClient *self,
+                                GError      **error)
+{
+    DBUS_CALL_NO_PARAM (GET_RAW_HISTORY, gchar**, strv, NULL)
+}
+
 /**
  * g_paste_client_add:
  * @self: a #GPasteClient instance
@@ -293,6 +356,42 @@ g_paste_client_empty (GPasteClient *self,
     DBUS_CALL_NO_PARAM_NO_RETURN (EMPTY)
 }
 
+/**
+ * g_paste_client_collect_garbage:
+ * @self: a #GPasteClient instance
+ * @error: a #GError
+ *
+ * Make the #GPasteDaemon delete the images no history uses anymore
+ * and enforce its disk quota
+ *
+ * Returns: the number of bytes reclaimed
+ */
+G_PASTE_VISIBLE guint64
+g_paste_client_collect_garbage (GPasteClient *self,
+                                GError      **error)
+{
+    g_return_val_if_fail (G_PASTE_IS_CLIENT (self), 0);
+
+    /* Walking a big image store can take a while */
+    GVariant *result = g_dbus_proxy_call_sync (self->priv->proxy,
+                                               COLLECT_GARBAGE,
+                                               g_variant_new_tuple (NULL, 0),
+                                               G_DBUS_CALL_FLAGS_NONE,
+                                               G_MAXINT,
+                                               NULL, /* cancellable */
+                                               error);
+
+    if (!result)
+        return 0;
+
+    guint64 reclaimed;
+
+    g_variant_get (result, "(t)", &reclaimed);
+    g_variant_unref (result);
+
+    return reclaimed;
+}
+
 /**
  * g_paste_client_track:
  * @self: a #GPasteClient instance
@@ -345,6 +444,23 @@ g_paste_client_reexecute (GPasteClient *self,
     DBUS_CALL_NO_PARAM_NO_RETURN (REEXECUTE)
 }
 
+/**
+ * g_paste_client_watch:
+ * @self: a #GPasteClient instance
+ * @error: a #GError
+ *
+ * Ask the #GPasteDaemon to emit item-added for each new item,
+ * until this client leaves the bus
+ *
+ * Returns:
+ */
+G_PASTE_VISIBLE void
+g_paste_client_watch (GPasteClient *self,
+                      GError      **error)
+{
+    DBUS_CALL_NO_PARAM_NO_RETURN (WATCH)
+}
+
 /**
  * g_paste_client_backup_history:
  * @self: a #GPasteClient instance
@@ -429,6 +545,65 @@ g_paste_client_is_active (GPasteClient *self)
     DBUS_GET_PROPERTY (PROP_ACTIVE, gboolean, boolean, FALSE)
 }
 
+/**
+ * g_paste_client_get_generation:
+ * @self: a #GPasteClient instance
+ *
+ * Get the generation of the history the last "changed" signal was about
+ *
+ * Returns: the generation, 0 until the first change
+ */
+G_PASTE_VISIBLE guint64
+g_paste_client_get_generation (GPasteClient *self)
+{
+    g_return_val_if_fail (G_PASTE_IS_CLIENT (self), 0);
+
+    return self->priv->generation;
+}
+
+static gboolean
+g_paste_client_emit_changed (gpointer user_data)
+{
+    GPasteClient *self = user_data;
+
+    self->priv->changed_source = 0;
+    g_signal_emit (self,
+                   signals[CHANGED],
+                   0); /* detail */
+
+    return FALSE;
+}
+
+/* When we lag behind, all the pending notifications end up in a single one */
+static void
+g_paste_client_changed (GPasteClient *self,
+                        GVariant     *parameters)
+{
+    GPasteClientPrivate *priv = self->priv;
+
+    if (g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(t)")))
+        g_variant_get (parameters, "(t)", &priv->generation);
+    if (!priv->changed_source)
+        priv->changed_source = g_idle_add (g_paste_client_emit_changed, self);
+}
+
+static void
+g_paste_client_item_added (GPasteClient *self,
+                           GVariant     *parameters)
+{
+    const gchar *kind, *value;
+
+    if (!g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(ss)")))
+        return;
+
+    g_variant_get (parameters, "(&s&s)", &kind, &value);
+    g_signal_emit (self,
+                   signals[ITEM_ADDED],
+                   0, /* detail */
+                   kind,
+                   value);
+}
+
 static void
 g_paste_client_handle_signal (GPasteClient *self,
                               gchar        *sender_name G_GNUC_UNUSED,
@@ -436,7 +611,10 @@ g_paste_client_handle_signal (GPasteClient *self,
                               GVariant     *parameters,
                               gpointer      user_data G_GNUC_UNUSED)
 {
-    HANDLE_SIGNAL (CHANGED)
+    if (g_strcmp0 (signal_name, SIG_CHANGED) == 0)
+        g_paste_client_changed (self, parameters);
+    else if (g_strcmp0 (signal_name, SIG_ITEM_ADDED) == 0)
+        g_paste_client_item_added (self, parameters);
     else HANDLE_SIGNAL (NAME_LOST)
     else HANDLE_SIGNAL (REEXECUTE_SELF)
     else HANDLE_SIGNAL (SHOW_HISTORY)
@@ -450,13 +628,20 @@ g_paste_client_dispose (GObject *object)
     GDBusProxy *proxy = priv->proxy;
     GDBusNodeInfo *g_paste_daemon_dbus_info = priv->g_paste_daemon_dbus_info;
 
-    if (g_paste_daemon_dbus_info)
+    if (priv->changed_source)
     {
-        if (proxy)
-        {
+        g_source_remove (priv->changed_source);
+        priv->changed_source = 0;
+    }
+    if (proxy)
+    {
+        if (priv->g_signal)
             g_signal_handler_disconnect (proxy, priv->g_signal);
-            g_object_unref (proxy);
-        }
+        g_object_unref (proxy);
+        priv->proxy = NULL;
+    }
+    if (g_paste_daemon_dbus_info)
+    {
         g_dbus_node_info_unref (g_paste_daemon_dbus_info);
         priv->g_paste_daemon_dbus_info = NULL;
     }
@@ -485,32 +670,62 @@ g_paste_client_class_init (GPasteClientClass *klass)
     signals[REEXECUTE_SELF] = NEW_SIGNAL ("reexecute-self")
     signals[SHOW_HISTORY]   = NEW_SIGNAL ("show-history")
     signals[TRACKING]       = NEW_SIGNAL_WITH_DATA ("tracking", G_TYPE_BOOLEAN)
+    signals[ITEM_ADDED]     = g_signal_new ("item-added",
+                                            G_PASTE_TYPE_CLIENT,
+                                            G_SIGNAL_RUN_LAST,
+                                            0, /* class offset */
+                                            NULL, /* accumulator */
+                                            NULL, /* accumulator data */
+                                            NULL, /* generic marshaller */
+                                            G_TYPE_NONE,
+                                            2, /* number of params */
+                                            G_TYPE_STRING, /* kind */
+                                            G_TYPE_STRING); /* value */
 }
 
 static void
 g_paste_client_init (GPasteClient *self)
 {
-    GPasteClientPrivate *priv = self->priv = G_PASTE_CLIENT_GET_PRIVATE (self);
+    self->priv = G_PASTE_CLIENT_GET_PRIVATE (self);
+}
 
-    priv->g_paste_daemon_dbus_info = g_dbus_node_info_new_for_xml (G_PASTE_IFACE_INFO,
-                                                                   NULL); /* Error */
+static GPasteClient *
+g_paste_client_new_full (gboolean light)
+{
+    GPasteClient *self = g_object_new (G_PASTE_TYPE_CLIENT, NULL);
+    GPasteClientPrivate *priv = self->priv;
+
+    /* Only signals and properties need the interface description */
+    if (!light)
+        priv->g_paste_daemon_dbus_info = g_dbus_node_info_new_for_xml (G_PASTE_IFACE_INFO,
+                                                                       NULL); /* Error */
 
     GDBusProxy *proxy = priv->proxy = g_dbus_proxy_new_for_bus_sync (G_BUS_TYPE_SESSION,
-                                                                     G_DBUS_PROXY_FLAGS_NONE,
-                                                                     priv->g_paste_daemon_dbus_info->interfaces[0],
+                                                                     (light) ? G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES |
+                                                                               G_DBUS_PROXY_FLAGS_DO_NOT_CONNECT_SIGNALS :
+                                                                               G_DBUS_PROXY_FLAGS_NONE,
+                                                                     (light) ? NULL : priv->g_paste_daemon_dbus_info->interfaces[0],
                                                                      G_PASTE_BUS_NAME,
                                                                      G_PASTE_OBJECT_PATH,
                                                                      G_PASTE_INTERFACE_NAME,
                                                                      NULL, /* cancellable */
                                                                      NULL); /* error */
 
-    if (proxy)
+    if (!proxy)
+    {
+        g_object_unref (self);
+        return NULL;
+    }
+
+    if (!light)
     {
         priv->g_signal = g_signal_connect_swapped (G_OBJECT (proxy),
                                                    "g-signal",
                                                    G_CALLBACK (g_paste_client_handle_signal),
                                                    self); /* user_data */
     }
+
+    return self;
 }
 
 /**
@@ -524,13 +739,21 @@ g_paste_client_init (GPasteClient *self)
 G_PASTE_VISIBLE GPasteClient *
 g_paste_client_new (void)
 {
-    GPasteClient *self = g_object_new (G_PASTE_TYPE_CLIENT, NULL);
-
-    if (!self->priv->proxy)
-    {
-        g_object_unref (self);
-        return NULL;
-    }
+    return g_paste_client_new_full (FALSE);
+}
 
-    return self;
+/**
+ * g_paste_client_new_light:
+ *
+ * Create a new instance of #GPasteClient only meant to call methods
+ * It doesn't listen to the signals nor know about the properties,
+ * but doesn't pay for setting that up either
+ *
+ * Returns: a newly allocated #GPasteClient
+ *          free it with g_object_unref
+ */
+G_PASTE_VISIBLE GPasteClient *
+g_paste_client_new_light (void)
+{
+    return g_paste_client_new_full (TRUE);
 }
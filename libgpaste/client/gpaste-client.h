@@ -46,8 +46,13 @@ GType g_paste_client_get_type (void);
 gchar   *g_paste_client_get_element                (GPasteClient *self,
                                                     guint32       index,
                                                     GError      **error);
+GBytes  *g_paste_client_get_thumbnail              (GPasteClient *self,
+                                                    guint32       index,
+                                                    GError      **error);
 gchar  **g_paste_client_get_history                (GPasteClient *self,
                                                     GError      **error);
+gchar  **g_paste_client_get_raw_history            (GPasteClient *self,
+                                                    GError      **error);
 void     g_paste_client_add                        (GPasteClient *self,
                                                     const gchar  *text,
                                                     GError      **error);
@@ -62,6 +67,8 @@ void     g_paste_client_delete                     (GPasteClient *self,
                                                     GError      **error);
 void     g_paste_client_empty                      (GPasteClient *self,
                                                     GError      **error);
+guint64  g_paste_client_collect_garbage            (GPasteClient *self,
+                                                    GError      **error);
 void     g_paste_client_track                      (GPasteClient *self,
                                                     gboolean      state,
                                                     GError      **error);
@@ -70,6 +77,8 @@ void     g_paste_client_on_extension_state_changed (GPasteClient *self,
                                                     GError      **error);
 void     g_paste_client_reexecute                  (GPasteClient *self,
                                                     GError      **error);
+void     g_paste_client_watch                      (GPasteClient *self,
+                                                    GError      **error);
 void     g_paste_client_backup_history             (GPasteClient *self,
                                                     const gchar  *name,
                                                     GError      **error);
@@ -82,8 +91,10 @@ void     g_paste_client_delete_history             (GPasteClient *self,
 gchar  **g_paste_client_list_histories             (GPasteClient *self,
                                                     GError      **error);
 gboolean g_paste_client_is_active                  (GPasteClient *self);
+guint64  g_paste_client_get_generation             (GPasteClient *self);
 
-GPasteClient *g_paste_client_new (void);
+GPasteClient *g_paste_client_new       (void);
+GPasteClient *g_paste_client_new_light (void);
 
 G_END_DECLS
 
@@ -21,11 +21,13 @@ libgpaste_common_public_headers = \
 	libgpaste/common/gdbus-defines.h  \
 	libgpaste/common/gpaste-clipboard-common.h \
 	libgpaste/common/gpaste-settings-keys.h \
+	libgpaste/common/gpaste-text-kernel.h \
 	$(NULL)
 
 libgpaste_common_libgpaste_common_la_SOURCES = \
 	$(libgpaste_common_public_headers) \
 	libgpaste/common/gpaste-clipboard-common.c \
+	libgpaste/common/gpaste-text-kernel.c \
 	$(NULL)
 
 libgpaste_common_libgpaste_common_la_CFLAGS = \
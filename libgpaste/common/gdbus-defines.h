@@ -27,19 +27,24 @@
 #define ADD                        "Add"
 #define ADD_FILE                   "AddFile"
 #define BACKUP_HISTORY             "BackupHistory"
+#define COLLECT_GARBAGE            "CollectGarbage"
 #define DELETE                     "Delete"
 #define DELETE_HISTORY             "DeleteHistory"
 #define EMPTY                      "Empty"
 #define GET_ELEMENT                "GetElement"
 #define GET_HISTORY                "GetHistory"
+#define GET_RAW_HISTORY            "GetRawHistory"
+#define GET_THUMBNAIL              "GetThumbnail"
 #define LIST_HISTORIES             "ListHistories"
 #define ON_EXTENSION_STATE_CHANGED "OnExtensionStateChanged"
 #define REEXECUTE                  "Reexecute"
 #define SELECT                     "Select"
 #define SWITCH_HISTORY             "SwitchHistory"
 #define TRACK                      "Track"
+#define WATCH                      "Watch"
 
 #define SIG_CHANGED        "Changed"
+#define SIG_ITEM_ADDED     "ItemAdded"
 #define SIG_NAME_LOST      "NameLost"
 #define SIG_REEXECUTE_SELF "ReexecuteSelf"
 #define SIG_SHOW_HISTORY   "ShowHistory"
@@ -53,6 +58,9 @@
         "       <method name='" GET_HISTORY "'>"                            \
         "           <arg type='as' direction='out' />"                      \
         "       </method>"                                                  \
+        "       <method name='" GET_RAW_HISTORY "'>"                        \
+        "           <arg type='as' direction='out' />"                      \
+        "       </method>"                                                  \
         "       <method name='" BACKUP_HISTORY "'>"                         \
         "           <arg type='s' direction='in' />"                        \
         "       </method>"                                                  \
@@ -75,6 +83,10 @@
         "           <arg type='u' direction='in' />"                        \
         "           <arg type='s' direction='out' />"                       \
         "       </method>"                                                  \
+        "       <method name='" GET_THUMBNAIL "'>"                          \
+        "           <arg type='u' direction='in' />"                        \
+        "           <arg type='ay' direction='out' />"                      \
+        "       </method>"                                                  \
         "       <method name='" SELECT "'>"                                 \
         "           <arg type='u' direction='in' />"                        \
         "       </method>"                                                  \
@@ -82,18 +94,28 @@
         "           <arg type='u' direction='in' />"                        \
         "       </method>"                                                  \
         "       <method name='" EMPTY "' />"                                \
+        "       <method name='" COLLECT_GARBAGE "'>"                        \
+        "           <arg type='t' direction='out' />"                       \
+        "       </method>"                                                  \
         "       <method name='" TRACK "'>"                                  \
         "           <arg type='b' direction='in' />"                        \
         "       </method>"                                                  \
         "       <method name='" ON_EXTENSION_STATE_CHANGED "'>"             \
         "           <arg type='b' direction='in' />"                        \
         "       </method>"                                                  \
+        "       <method name='" WATCH "' />"                                \
         "       <method name='" REEXECUTE "' />"                            \
         "       <signal name='" SIG_REEXECUTE_SELF "' />"                   \
         "       <signal name='" SIG_TRACKING "'>"                           \
         "           <arg type='b' direction='out' />"                       \
         "       </signal>"                                                  \
-        "       <signal name='" SIG_CHANGED "' />"                          \
+        "       <signal name='" SIG_CHANGED "'>"                            \
+        "           <arg type='t' direction='out' />"                       \
+        "       </signal>"                                                  \
+        "       <signal name='" SIG_ITEM_ADDED "'>"                         \
+        "           <arg type='s' direction='out' />"                       \
+        "           <arg type='s' direction='out' />"                       \
+        "       </signal>"                                                  \
         "       <signal name='" SIG_NAME_LOST "' />"                        \
         "       <signal name='" SIG_SHOW_HISTORY "' />"                     \
         "       <property name='" PROP_ACTIVE "' type='b' access='read' />" \
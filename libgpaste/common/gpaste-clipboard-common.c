@@ -21,6 +21,129 @@
 #include "gpaste-image-item.h"
 #include "gpaste-uris-item.h"
 
+typedef GBytes *(*GPasteClipboardPayloadBuilder) (GPasteItem *item);
+
+/* Cached on the item for as long as it owns a selection, see g_paste_clipboard_clear_clipboard_data */
+static GBytes *
+g_paste_clipboard_get_payload (GPasteItem                   *item,
+                               GdkAtom                       target,
+                               GPasteClipboardPayloadBuilder build)
+{
+    GHashTable *cache = g_object_get_qdata (G_OBJECT (item), g_paste_clipboard_payload_quark);
+
+    if (!cache)
+    {
+        cache = g_hash_table_new_full (NULL, /* GdkAtoms are unique pointers */
+                                       NULL,
+                                       NULL,
+                                       (GDestroyNotify) g_bytes_unref);
+        g_object_set_qdata_full (G_OBJECT (item), g_paste_clipboard_payload_quark, cache, (GDestroyNotify) g_hash_table_unref);
+    }
+
+    GBytes *payload = g_hash_table_lookup (cache, target);
+
+    if (!payload)
+    {
+        payload = build (item);
+        if (payload)
+            g_hash_table_insert (cache, target, payload);
+    }
+
+    return payload;
+}
+
+static GBytes *
+g_paste_clipboard_build_uri_list (GPasteItem *item)
+{
+    GString *uri_list = g_string_new (NULL);
+
+    for (const gchar * const *uris = g_paste_uris_item_get_uris (G_PASTE_URIS_ITEM (item)); *uris; ++uris)
+        g_string_append (g_string_append (uri_list, *uris), "\r\n");
+
+    gsize length = uri_list->len;
+
+    return g_bytes_new_take (g_string_free (uri_list, FALSE), length);
+}
+
+static GBytes *
+g_paste_clipboard_build_copy_files (GPasteItem *item)
+{
+    GString *copy_string = g_string_new ("copy");
+
+    for (const gchar * const *uris = g_paste_uris_item_get_uris (G_PASTE_URIS_ITEM (item)); *uris; ++uris)
+        g_string_append (g_string_append_c (copy_string, '\n'), *uris);
+
+    /* nautilus expects the trailing NUL to be part of the data */
+    gsize length = copy_string->len + 1;
+
+    return g_bytes_new_take (g_string_free (copy_string, FALSE), length);
+}
+
+static GBytes *
+g_paste_clipboard_build_png (GPasteItem *item)
+{
+    /* The image is already stored as PNG, map it and hand those bytes over as-is */
+    GMappedFile *stored = g_mapped_file_new (g_paste_item_get_value (item),
+                                             FALSE, /* writable */
+                                             NULL); /* Error */
+
+    if (stored)
+    {
+        gsize length = g_mapped_file_get_length (stored);
+
+        if (length)
+        {
+            return g_bytes_new_with_free_func (g_mapped_file_get_contents (stored),
+                                               length,
+                                               (GDestroyNotify) g_mapped_file_unref,
+                                               stored);
+        }
+        g_mapped_file_unref (stored);
+    }
+
+    /* Fallback in case the file went away */
+    GdkPixbuf *image = g_paste_image_item_get_image (G_PASTE_IMAGE_ITEM (item));
+    gchar *buffer;
+    gsize size;
+
+    if (!image || !gdk_pixbuf_save_to_buffer (image,
+                                              &buffer,
+                                              &size,
+                                              "png",
+                                              NULL, /* Error */
+                                              NULL)) /* Params */
+        return NULL;
+
+    return g_bytes_new_take (buffer, size);
+}
+
+static void
+g_paste_clipboard_set_payload (GtkSelectionData *selection_data,
+                               GdkAtom           target,
+                               GBytes           *payload)
+{
+    gsize size;
+    const guchar *data = g_bytes_get_data (payload, &size);
+
+    gtk_selection_data_set (selection_data, target, 8, data, size);
+}
+
+static void
+g_paste_clipboard_set_text_payload (GtkSelectionData *selection_data,
+                                    GBytes           *text)
+{
+    GdkAtom target = gtk_selection_data_get_target (selection_data);
+    gsize size;
+    const gchar *data = g_bytes_get_data (text, &size);
+
+    /* Our buffer already is what UTF-8 requestors want, no conversion needed */
+    if (target == gdk_atom_intern_static_string ("UTF8_STRING") ||
+        target == gdk_atom_intern_static_string ("text/plain;charset=utf-8"))
+            gtk_selection_data_set (selection_data, target, 8, (const guchar *) data, size - 1);
+    else
+        gtk_selection_data_set_text (selection_data, data, size - 1);
+}
+
 G_PASTE_VISIBLE void
 g_paste_clipboard_get_clipboard_data (GtkClipboard     *clipboard G_GNUC_UNUSED,
                                       GtkSelectionData *selection_data,
@@ -30,46 +153,39 @@ g_paste_clipboard_get_clipboard_data (GtkClipboard     *clipboard G_GNUC_UNUSED,
     g_return_if_fail (G_PASTE_IS_ITEM (user_data_or_owner));
 
     GPasteItem *item = G_PASTE_ITEM (user_data_or_owner);
-
-    GdkAtom targets[1] = { gtk_selection_data_get_target (selection_data) };
+    GdkAtom target = gtk_selection_data_get_target (selection_data);
+    GdkAtom targets[1] = { target };
 
     /* The content is requested as text */
     if (gtk_targets_include_text (targets, 1))
-        gtk_selection_data_set_text (selection_data, g_paste_item_get_value (item), -1);
+        g_paste_clipboard_set_text_payload (selection_data, g_paste_item_get_value_bytes (item));
     else if (G_PASTE_IS_IMAGE_ITEM (item))
     {
-        if (gtk_targets_include_image (targets, 1, TRUE))
-            gtk_selection_data_set_pixbuf (selection_data, g_paste_image_item_get_image (G_PASTE_IMAGE_ITEM (item)));
+        if (target == g_paste_clipboard_png_target)
+        {
+            GBytes *png = g_paste_clipboard_get_payload (item, target, g_paste_clipboard_build_png);
+
+            if (png)
+                g_paste_clipboard_set_payload (selection_data, target, png);
+        }
+        else if (gtk_targets_include_image (targets, 1, TRUE))
+        {
+            GdkPixbuf *image = g_paste_image_item_get_image (G_PASTE_IMAGE_ITEM (item));
+
+            if (image)
+                gtk_selection_data_set_pixbuf (selection_data, image);
+        }
     }
     /* The content is requested as uris */
     else
     {
         g_return_if_fail (G_PASTE_IS_URIS_ITEM (item));
 
-        const gchar * const *uris = g_paste_uris_item_get_uris (G_PASTE_URIS_ITEM (item));
-
         if (gtk_targets_include_uri (targets, 1))
-            gtk_selection_data_set_uris (selection_data, (gchar **) uris);
+            g_paste_clipboard_set_payload (selection_data, target, g_paste_clipboard_get_payload (item, target, g_paste_clipboard_build_uri_list));
         /* The content is requested as special gnome-copied-files by nautilus */
         else
-        {
-            GString *copy_string = g_string_new ("copy");
-            guint length = g_strv_length ((gchar **) uris);
-
-            for (guint i = 0; i < length; ++i)
-                g_string_append (g_string_append (copy_string,
-                                                  "\n"),
-                                 uris[i]);
-
-            gchar *str = copy_string->str;
-            length = copy_string->len + 1;
-            guchar *copy_files_data = g_new (guchar, length);
-            for (guint i = 0; i < length; ++i)
-                copy_files_data[i] = (guchar) str[i];
-            gtk_selection_data_set (selection_data, g_paste_clipboard_copy_files_target, 8, copy_files_data, length);
-            g_free (copy_files_data);
-            g_string_free (copy_string, TRUE);
-        }
+            g_paste_clipboard_set_payload (selection_data, target, g_paste_clipboard_get_payload (item, target, g_paste_clipboard_build_copy_files));
     }
 }
 
@@ -77,5 +193,52 @@ G_PASTE_VISIBLE void
 g_paste_clipboard_clear_clipboard_data (GtkClipboard *clipboard G_GNUC_UNUSED,
                                         gpointer      user_data_or_owner)
 {
+    /* Don't pin a mapped image or a re-encoded PNG for every item ever selected */
+    if (G_PASTE_IS_ITEM (user_data_or_owner))
+        g_object_set_qdata (G_OBJECT (user_data_or_owner), g_paste_clipboard_payload_quark, NULL);
     g_object_unref (user_data_or_owner);
 }
+
+G_PASTE_VISIBLE void
+g_paste_clipboard_get_text_data (GtkClipboard     *clipboard G_GNUC_UNUSED,
+                                 GtkSelectionData *selection_data,
+                                 guint             info G_GNUC_UNUSED,
+                                 gpointer          user_data_or_owner)
+{
+    g_paste_clipboard_set_text_payload (selection_data, user_data_or_owner);
+}
+
+G_PASTE_VISIBLE void
+g_paste_clipboard_get_png_data (GtkClipboard     *clipboard G_GNUC_UNUSED,
+                                GtkSelectionData *selection_data,
+                                guint             info G_GNUC_UNUSED,
+                                gpointer          user_data_or_owner)
+{
+    g_return_if_fail (GDK_IS_PIXBUF (user_data_or_owner));
+
+    /* The PNG the image was decoded from, served as-is */
+    GBytes *png = g_object_get_qdata (G_OBJECT (user_data_or_owner), g_paste_clipboard_png_quark);
+
+    if (png && gtk_selection_data_get_target (selection_data) == g_paste_clipboard_png_target)
+        g_paste_clipboard_set_payload (selection_data, g_paste_clipboard_png_target, png);
+    else
+        gtk_selection_data_set_pixbuf (selection_data, user_data_or_owner);
+}
+
+G_PASTE_VISIBLE void
+g_paste_clipboard_get_image_data (GtkClipboard     *clipboard G_GNUC_UNUSED,
+                                  GtkSelectionData *selection_data,
+                                  guint             info G_GNUC_UNUSED,
+                                  gpointer          user_data_or_owner)
+{
+    g_return_if_fail (GDK_IS_PIXBUF (user_data_or_owner));
+
+    gtk_selection_data_set_pixbuf (selection_data, user_data_or_owner);
+}
+
+G_PASTE_VISIBLE void
+g_paste_clipboard_clear_bytes_data (GtkClipboard *clipboard G_GNUC_UNUSED,
+                                    gpointer      user_data_or_owner)
+{
+    g_bytes_unref (user_data_or_owner);
+}
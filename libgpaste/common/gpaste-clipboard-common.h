@@ -25,6 +25,9 @@
 G_BEGIN_DECLS
 
 #define g_paste_clipboard_copy_files_target gdk_atom_intern_static_string ("x-special/gnome-copied-files")
+#define g_paste_clipboard_png_target        gdk_atom_intern_static_string ("image/png")
+#define g_paste_clipboard_png_quark         g_quark_from_static_string ("g-paste-clipboard-png")
+#define g_paste_clipboard_payload_quark     g_quark_from_static_string ("g-paste-clipboard-payload-cache")
 
 
 void g_paste_clipboard_get_clipboard_data (GtkClipboard     *clipboard,
@@ -33,6 +36,20 @@ void g_paste_clipboard_get_clipboard_data (GtkClipboard     *clipboard,
                                            gpointer          user_data_or_owner);
 void g_paste_clipboard_clear_clipboard_data (GtkClipboard *clipboard,
                                              gpointer      user_data_or_owner);
+void g_paste_clipboard_get_text_data (GtkClipboard     *clipboard,
+                                      GtkSelectionData *selection_data,
+                                      guint             info,
+                                      gpointer          user_data_or_owner);
+void g_paste_clipboard_get_png_data (GtkClipboard     *clipboard,
+                                     GtkSelectionData *selection_data,
+                                     guint             info,
+                                     gpointer          user_data_or_owner);
+void g_paste_clipboard_get_image_data (GtkClipboard     *clipboard,
+                                       GtkSelectionData *selection_data,
+                                       guint             info,
+                                       gpointer          user_data_or_owner);
+void g_paste_clipboard_clear_bytes_data (GtkClipboard *clipboard,
+                                         gpointer      user_data_or_owner);
 
 G_END_DECLS
 
@@ -20,9 +20,17 @@
 #ifndef __GPASTE_SETTINGS_KEYS_H__
 #define __GPASTE_SETTINGS_KEYS_H__
 
+#define CLIPBOARD_STORE_DELAY_KEY      "clipboard-store-delay"
+#define COMPRESSION_THRESHOLD_KEY      "compression-threshold"
+#define DBUS_THREAD_KEY                "dbus-thread"
+#define DELTA_STORAGE_KEY              "delta-storage"
 #define ELEMENT_SIZE_KEY               "element-size"
 #define FIFO_KEY                       "fifo"
 #define HISTORY_NAME_KEY               "history-name"
+#define IMAGES_CACHE_SIZE_KEY          "images-cache-size"
+#define IMAGES_COMPRESSION_LEVEL_KEY   "images-compression-level"
+#define IMAGES_DISK_QUOTA_KEY          "images-disk-quota"
+#define IMAGES_SIMILARITY_KEY          "images-similarity"
 #define IMAGES_SUPPORT_KEY             "images-support"
 #define MAX_DISPLAYED_HISTORY_SIZE_KEY "max-displayed-history-size"
 #define MAX_HISTORY_SIZE_KEY           "max-history-size"
@@ -0,0 +1,586 @@
+/*
+ *      This file is part of GPaste.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      GPaste is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      GPaste is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with GPaste.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gpaste-text-kernel.h"
+
+#include <string.h>
+
+#if defined (__GNUC__) && defined (__SSE2__) && (defined (__x86_64__) || defined (__i386__))
+#  define G_PASTE_TEXT_KERNEL_SSE2 1
+#  include <immintrin.h>
+#endif
+
+#ifdef G_PASTE_TEXT_KERNEL_SSE2
+
+/* AVX2 is not part of the baseline, only use it when the cpu supports it */
+static gboolean
+g_paste_text_kernel_has_avx2 (void)
+{
+    static gsize avx2 = 0;
+
+    if (g_once_init_enter (&avx2))
+    {
+        __builtin_cpu_init ();
+        g_once_init_leave (&avx2, __builtin_cpu_supports ("avx2") ? 2 : 1);
+    }
+
+    return avx2 == 2;
+}
+
+__attribute__ ((target ("avx2"))) static gsize
+g_paste_text_kernel_ascii_prefix_avx2 (const guchar *text,
+                                       gsize         length)
+{
+    const __m256i zero = _mm256_setzero_si256 ();
+    gsize i = 0;
+
+    for (; i + 32 <= length; i += 32)
+    {
+        __m256i chunk = _mm256_loadu_si256 ((const __m256i *) (text + i));
+        guint32 mask = (guint32) _mm256_movemask_epi8 (chunk) |
+                       (guint32) _mm256_movemask_epi8 (_mm256_cmpeq_epi8 (chunk, zero));
+
+        if (mask)
+            return i + __builtin_ctz (mask);
+    }
+
+    return i;
+}
+
+__attribute__ ((target ("avx2"))) static gsize
+g_paste_text_kernel_next_special_avx2 (const guchar *text,
+                                       gsize         length)
+{
+    const __m256i amp = _mm256_set1_epi8 ('&');
+    const __m256i gt = _mm256_set1_epi8 ('>');
+    gsize i = 0;
+
+    for (; i + 32 <= length; i += 32)
+    {
+        __m256i chunk = _mm256_loadu_si256 ((const __m256i *) (text + i));
+        guint32 mask = (guint32) _mm256_movemask_epi8 (_mm256_or_si256 (_mm256_cmpeq_epi8 (chunk, amp),
+                                                                        _mm256_cmpeq_epi8 (chunk, gt)));
+
+        if (mask)
+            return i + __builtin_ctz (mask);
+    }
+
+    return i;
+}
+
+static gsize
+g_paste_text_kernel_ascii_prefix_sse2 (const guchar *text,
+                                       gsize         length)
+{
+    const __m128i zero = _mm_setzero_si128 ();
+    gsize i = 0;
+
+    for (; i + 16 <= length; i += 16)
+    {
+        __m128i chunk = _mm_loadu_si128 ((const __m128i *) (text + i));
+        guint32 mask = (guint32) _mm_movemask_epi8 (_mm_or_si128 (chunk, _mm_cmpeq_epi8 (chunk, zero)));
+
+        if (mask)
+            return i + __builtin_ctz (mask);
+    }
+
+    return i;
+}
+
+static gsize
+g_paste_text_kernel_next_special_sse2 (const guchar *text,
+                                       gsize         length)
+{
+    const __m128i amp = _mm_set1_epi8 ('&');
+    const __m128i gt = _mm_set1_epi8 ('>');
+    gsize i = 0;
+
+    for (; i + 16 <= length; i += 16)
+    {
+        __m128i chunk = _mm_loadu_si128 ((const __m128i *) (text + i));
+        guint32 mask = (guint32) _mm_movemask_epi8 (_mm_or_si128 (_mm_cmpeq_epi8 (chunk, amp),
+                                                                  _mm_cmpeq_epi8 (chunk, gt)));
+
+        if (mask)
+            return i + __builtin_ctz (mask);
+    }
+
+    return i;
+}
+
+#endif /* G_PASTE_TEXT_KERNEL_SSE2 */
+
+/* Number of leading bytes being plain ASCII (and not NUL) */
+static gsize
+g_paste_text_kernel_ascii_prefix (const guchar *text,
+                                  gsize         length)
+{
+    gsize probe = MIN (length, 16);
+    gsize i = 0;
+
+    /* Runs between two non-ASCII characters are usually short, they're not worth setting the vectors up */
+    while (i < probe && text[i] && text[i] < 0x80)
+        ++i;
+    if (i < probe)
+        return i;
+
+#ifdef G_PASTE_TEXT_KERNEL_SSE2
+    if (length - i >= 32 && g_paste_text_kernel_has_avx2 ())
+        i += g_paste_text_kernel_ascii_prefix_avx2 (text + i, length - i);
+    i += g_paste_text_kernel_ascii_prefix_sse2 (text + i, length - i);
+#endif
+
+    while (i < length && text[i] && text[i] < 0x80)
+        ++i;
+
+    return i;
+}
+
+/* Offset of the next '&' or '>', length if there is none */
+static gsize
+g_paste_text_kernel_next_special (const guchar *text,
+                                  gsize         length)
+{
+    gsize i = 0;
+
+#ifdef G_PASTE_TEXT_KERNEL_SSE2
+    if (length >= 32 && g_paste_text_kernel_has_avx2 ())
+        i = g_paste_text_kernel_next_special_avx2 (text, length);
+    i += g_paste_text_kernel_next_special_sse2 (text + i, length - i);
+#endif
+
+    while (i < length && text[i] != '&' && text[i] != '>')
+        ++i;
+
+    return i;
+}
+
+/**
+ * g_paste_text_kernel_trim_bounds: (skip)
+ * @text: the text to trim
+ * @length: the length of @text
+ * @start: (out): the offset of the first non-space byte
+ * @end: (out): the offset after the last non-space byte
+ *
+ * Compute the bounds g_strstrip would keep, without touching the text
+ */
+G_PASTE_VISIBLE void
+g_paste_text_kernel_trim_bounds (const gchar *text,
+                                 gsize        length,
+                                 gsize       *start,
+                                 gsize       *end)
+{
+    gsize s = 0, e = length;
+
+    /* Only the edges are walked, so a scalar loop is all we need here */
+    while (s < e && g_ascii_isspace (text[s]))
+        ++s;
+    while (e > s && g_ascii_isspace (text[e - 1]))
+        --e;
+
+    *start = s;
+    *end = e;
+}
+
+/**
+ * g_paste_text_kernel_validate_utf8: (skip)
+ * @text: the text to validate
+ * @length: the length of @text
+ *
+ * Same semantics as g_utf8_validate with an explicit length,
+ * but ASCII runs are skipped a vector at a time
+ *
+ * Returns: whether @text is valid UTF-8 without any embedded NUL
+ */
+G_PASTE_VISIBLE gboolean
+g_paste_text_kernel_validate_utf8 (const gchar *text,
+                                   gsize        length)
+{
+    const guchar *str = (const guchar *) text;
+    gsize i = 0;
+
+    while (i < length)
+    {
+        i += g_paste_text_kernel_ascii_prefix (str + i, length - i);
+        if (i >= length)
+            break;
+
+        guchar c = str[i];
+        gsize needed;
+        guchar min = 0x80, max = 0xBF;
+
+        if (c < 0xC2)
+            return FALSE; /* NUL, stray continuation byte or overlong */
+        else if (c < 0xE0)
+            needed = 1;
+        else if (c < 0xF0)
+        {
+            needed = 2;
+            if (c == 0xE0)
+                min = 0xA0;
+            else if (c == 0xED)
+                max = 0x9F; /* surrogates */
+        }
+        else if (c < 0xF5)
+        {
+            needed = 3;
+            if (c == 0xF0)
+                min = 0x90;
+            else if (c == 0xF4)
+                max = 0x8F; /* > U+10FFFF */
+        }
+        else
+            return FALSE;
+
+        if (length - i <= needed)
+            return FALSE;
+        if (str[i + 1] < min || str[i + 1] > max)
+            return FALSE;
+        for (gsize j = 2; j <= needed; ++j)
+        {
+            if ((str[i + j] & 0xC0) != 0x80)
+                return FALSE;
+        }
+
+        i += needed + 1;
+    }
+
+    return TRUE;
+}
+
+/**
+ * g_paste_text_kernel_escape: (skip)
+ * @text: the text to escape
+ * @length: the length of @text
+ * @escaped_length: (out) (allow-none): the length of the result
+ *
+ * Escape '&' and '>' in one pass so that @text can live in a CDATA section
+ *
+ * Returns: a newly allocated NUL terminated string
+ */
+G_PASTE_VISIBLE gchar *
+g_paste_text_kernel_escape (const gchar *text,
+                            gsize        length,
+                            gsize       *escaped_length)
+{
+    const guchar *str = (const guchar *) text;
+    gsize extra = 0;
+
+    for (gsize i = g_paste_text_kernel_next_special (str, length); i < length;
+         i += 1 + g_paste_text_kernel_next_special (str + i + 1, length - i - 1))
+            extra += (str[i] == '&') ? 4 : 3;
+
+    gchar *escaped = g_new (gchar, length + extra + 1);
+    gchar *out = escaped;
+    gsize i = 0;
+
+    while (i < length)
+    {
+        gsize run = g_paste_text_kernel_next_special (str + i, length - i);
+
+        memcpy (out, text + i, run);
+        out += run;
+        i += run;
+
+        if (i < length)
+        {
+            if (str[i] == '&')
+            {
+                memcpy (out, "&amp;", 5);
+                out += 5;
+            }
+            else
+            {
+                memcpy (out, "&gt;", 4);
+                out += 4;
+            }
+            ++i;
+        }
+    }
+    *out = '\0';
+
+    if (escaped_length)
+        *escaped_length = length + extra;
+
+    return escaped;
+}
+
+/**
+ * g_paste_text_kernel_unescape: (skip)
+ * @text: the text to unescape
+ * @length: the length of @text
+ * @unescaped_length: (out) (allow-none): the length of the result
+ *
+ * Revert g_paste_text_kernel_escape in one pass
+ *
+ * Returns: a newly allocated NUL terminated string
+ */
+G_PASTE_VISIBLE gchar *
+g_paste_text_kernel_unescape (const gchar *text,
+                              gsize        length,
+                              gsize       *unescaped_length)
+{
+    gchar *unescaped = g_new (gchar, length + 1);
+    gchar *out = unescaped;
+    const gchar *in = text;
+    const gchar *end = text + length;
+
+    while (in < end)
+    {
+        /* memchr is already vectorized by the libc */
+        const gchar *amp = memchr (in, '&', end - in);
+        gsize run = (amp ? amp : end) - in;
+
+        memcpy (out, in, run);
+        out += run;
+        in += run;
+
+        if (!amp)
+            break;
+
+        if (end - in >= 5 && !memcmp (in, "&amp;", 5))
+        {
+            *out++ = '&';
+            in += 5;
+        }
+        else if (end - in >= 4 && !memcmp (in, "&gt;", 4))
+        {
+            *out++ = '>';
+            in += 4;
+        }
+        else
+            *out++ = *in++;
+    }
+    *out = '\0';
+
+    if (unescaped_length)
+        *unescaped_length = out - unescaped;
+
+    return unescaped;
+}
+
+#define PRIME64_1 G_GUINT64_CONSTANT (0x9E3779B185EBCA87)
+#define PRIME64_2 G_GUINT64_CONSTANT (0xC2B2AE3D27D4EB4F)
+#define PRIME64_3 G_GUINT64_CONSTANT (0x165667B19E3779F9)
+#define PRIME64_4 G_GUINT64_CONSTANT (0x85EBCA77C2B2AE63)
+#define PRIME64_5 G_GUINT64_CONSTANT (0x27D4EB2F165667C5)
+
+#define ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+static inline guint64
+g_paste_text_kernel_read64 (const guchar *p)
+{
+    guint64 v;
+
+    memcpy (&v, p, sizeof (v));
+    return GUINT64_FROM_LE (v);
+}
+
+static inline guint32
+g_paste_text_kernel_read32 (const guchar *p)
+{
+    guint32 v;
+
+    memcpy (&v, p, sizeof (v));
+    return GUINT32_FROM_LE (v);
+}
+
+static inline guint64
+g_paste_text_kernel_round (guint64 acc,
+                           guint64 input)
+{
+    acc += input * PRIME64_2;
+    acc = ROTL64 (acc, 31);
+    return acc * PRIME64_1;
+}
+
+static inline guint64
+g_paste_text_kernel_merge (guint64 acc,
+                           guint64 val)
+{
+    acc ^= g_paste_text_kernel_round (0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+static guint64
+g_paste_text_kernel_hash_with_seed (gconstpointer data,
+                                    gsize         length,
+                                    guint64       seed)
+{
+    const guchar *p = data;
+    const guchar *end = p + length;
+    guint64 h;
+
+    if (length >= 32)
+    {
+        const guchar *limit = end - 32;
+        guint64 v1 = seed + PRIME64_1 + PRIME64_2;
+        guint64 v2 = seed + PRIME64_2;
+        guint64 v3 = seed;
+        guint64 v4 = seed - PRIME64_1;
+
+        do
+        {
+            v1 = g_paste_text_kernel_round (v1, g_paste_text_kernel_read64 (p));
+            v2 = g_paste_text_kernel_round (v2, g_paste_text_kernel_read64 (p + 8));
+            v3 = g_paste_text_kernel_round (v3, g_paste_text_kernel_read64 (p + 16));
+            v4 = g_paste_text_kernel_round (v4, g_paste_text_kernel_read64 (p + 24));
+            p += 32;
+        } while (p <= limit);
+
+        h = ROTL64 (v1, 1) + ROTL64 (v2, 7) + ROTL64 (v3, 12) + ROTL64 (v4, 18);
+        h = g_paste_text_kernel_merge (h, v1);
+        h = g_paste_text_kernel_merge (h, v2);
+        h = g_paste_text_kernel_merge (h, v3);
+        h = g_paste_text_kernel_merge (h, v4);
+    }
+    else
+        h = seed + PRIME64_5;
+
+    h += (guint64) length;
+
+    for (; p + 8 <= end; p += 8)
+    {
+        h ^= g_paste_text_kernel_round (0, g_paste_text_kernel_read64 (p));
+        h = ROTL64 (h, 27) * PRIME64_1 + PRIME64_4;
+    }
+    if (p + 4 <= end)
+    {
+        h ^= (guint64) g_paste_text_kernel_read32 (p) * PRIME64_1;
+        h = ROTL64 (h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; ++p)
+    {
+        h ^= (*p) * PRIME64_5;
+        h = ROTL64 (h, 11) * PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+
+    return h;
+}
+
+/**
+ * g_paste_text_kernel_hash: (skip)
+ * @data: the data to hash
+ * @length: the length of @data
+ *
+ * 64-bit non cryptographic hash (xxHash64 with a zero seed),
+ * four independent lanes keep the multipliers busy on long buffers
+ *
+ * Returns: the hash of @data
+ */
+G_PASTE_VISIBLE guint64
+g_paste_text_kernel_hash (gconstpointer data,
+                          gsize         length)
+{
+    return g_paste_text_kernel_hash_with_seed (data, length, 0);
+}
+
+/**
+ * g_paste_text_kernel_hash_pixels: (skip)
+ * @pixels: the first pixel row
+ * @row_length: the number of meaningful bytes in each row
+ * @rows: the number of rows
+ * @rowstride: the distance in bytes between the start of two rows
+ *
+ * Hash an image row by row, each row seeding the next one, so that
+ * the padding at the end of the rows is never read and the result
+ * does not depend on the rowstride
+ *
+ * Returns: the hash of the pixels
+ */
+G_PASTE_VISIBLE guint64
+g_paste_text_kernel_hash_pixels (const guchar *pixels,
+                                 gsize         row_length,
+                                 guint         rows,
+                                 gsize         rowstride)
+{
+    guint64 h = 0;
+
+    for (guint i = 0; i < rows; ++i, pixels += rowstride)
+        h = g_paste_text_kernel_hash_with_seed (pixels, row_length, h);
+
+    return h;
+}
+
+/**
+ * g_paste_text_kernel_common_affixes: (skip)
+ * @a: a buffer
+ * @a_length: the length of @a
+ * @b: another buffer
+ * @b_length: the length of @b
+ * @prefix: (out): the length of the prefix @a and @b share
+ * @suffix: (out): the length of the suffix @a and @b share, not overlapping the prefix
+ *
+ * Compare the two buffers from both ends, eight bytes at a time
+ */
+G_PASTE_VISIBLE void
+g_paste_text_kernel_common_affixes (const gchar *a,
+                                    gsize        a_length,
+                                    const gchar *b,
+                                    gsize        b_length,
+                                    gsize       *prefix,
+                                    gsize       *suffix)
+{
+    const guchar *ua = (const guchar *) a;
+    const guchar *ub = (const guchar *) b;
+    gsize length = MIN (a_length, b_length);
+    gsize p = 0, s = 0;
+
+    while (p + 8 <= length)
+    {
+        guint64 diff = g_paste_text_kernel_read64 (ua + p) ^ g_paste_text_kernel_read64 (ub + p);
+
+        if (diff)
+        {
+            p += __builtin_ctzll (diff) / 8;
+            goto prefix_done;
+        }
+        p += 8;
+    }
+    while (p < length && ua[p] == ub[p])
+        ++p;
+
+prefix_done:
+    length -= p;
+
+    while (s + 8 <= length)
+    {
+        guint64 diff = g_paste_text_kernel_read64 (ua + a_length - s - 8) ^ g_paste_text_kernel_read64 (ub + b_length - s - 8);
+
+        if (diff)
+        {
+            s += __builtin_clzll (diff) / 8;
+            goto suffix_done;
+        }
+        s += 8;
+    }
+    while (s < length && ua[a_length - s - 1] == ub[b_length - s - 1])
+        ++s;
+
+suffix_done:
+    *prefix = p;
+    *suffix = s;
+}
@@ -0,0 +1,54 @@
+/*
+ *      This file is part of GPaste.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      GPaste is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      GPaste is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with GPaste.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __G_PASTE_TEXT_KERNEL_H__
+#define __G_PASTE_TEXT_KERNEL_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+void     g_paste_text_kernel_trim_bounds    (const gchar *text,
+                                             gsize        length,
+                                             gsize       *start,
+                                             gsize       *end);
+gboolean g_paste_text_kernel_validate_utf8  (const gchar *text,
+                                             gsize        length);
+gchar   *g_paste_text_kernel_escape         (const gchar *text,
+                                             gsize        length,
+                                             gsize       *escaped_length);
+gchar   *g_paste_text_kernel_unescape       (const gchar *text,
+                                             gsize        length,
+                                             gsize       *unescaped_length);
+guint64  g_paste_text_kernel_hash           (gconstpointer data,
+                                             gsize         length);
+guint64  g_paste_text_kernel_hash_pixels    (const guchar *pixels,
+                                             gsize         row_length,
+                                             guint         rows,
+                                             gsize         rowstride);
+void     g_paste_text_kernel_common_affixes (const gchar *a,
+                                             gsize        a_length,
+                                             const gchar *b,
+                                             gsize        b_length,
+                                             gsize       *prefix,
+                                             gsize       *suffix);
+
+G_END_DECLS
+
+#endif /*__G_PASTE_TEXT_KERNEL_H__*/
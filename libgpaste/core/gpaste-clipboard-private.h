@@ -39,6 +39,11 @@ struct _GPasteClipboardClass
     GObjectClass parent_class;
 };
 
+GBytes *g_paste_clipboard_get_text_bytes    (const GPasteClipboard *self);
+void    g_paste_clipboard_select_text_bytes (GPasteClipboard       *self,
+                                             GBytes                *text);
+GBytes *g_paste_clipboard_set_image_png     (GPasteClipboard       *self);
+
 G_END_DECLS
 
 #endif /*__G_PASTE_CLIPBOARD_PRIVATE_H__*/
@@ -18,7 +18,9 @@
  */
 
 #include "gpaste-clipboard-common.h"
-#include "gpaste-image-item.h"
+#include "gpaste-image-item-private.h"
+#include "gpaste-item-private.h"
+#include "gpaste-text-kernel.h"
 #include "gpaste-uris-item.h"
 
 #include <string.h>
@@ -32,8 +34,12 @@ struct _GPasteClipboardPrivate
     GdkAtom target;
     GtkClipboard *real;
     GPasteSettings *settings;
-    gchar *text;
+    GBytes *text;
+    gboolean has_text_hash;
+    guint64 text_hash;
     gchar *image_checksum;
+    GBytes *png;
+    guint store_source;
 };
 
 /**
@@ -81,22 +87,131 @@ g_paste_clipboard_get_text (const GPasteClipboard *self)
 {
     g_return_val_if_fail (G_PASTE_IS_CLIPBOARD (self), NULL);
 
+    GBytes *text = self->priv->text;
+
+    return (text) ? g_bytes_get_data (text, NULL) : NULL;
+}
+
+/**
+ * g_paste_clipboard_get_text_bytes: (skip)
+ */
+GBytes *
+g_paste_clipboard_get_text_bytes (const GPasteClipboard *self)
+{
+    g_return_val_if_fail (G_PASTE_IS_CLIPBOARD (self), NULL);
+
     return self->priv->text;
 }
 
 static void
 _g_paste_clipboard_set_text (GPasteClipboard *self,
-                             const gchar     *text)
+                             GBytes          *text)
 {
     g_return_if_fail (G_PASTE_IS_CLIPBOARD (self));
 
     GPasteClipboardPrivate *priv = self->priv;
 
-    g_free (priv->text);
+    /* text may be the buffer we already hold */
+    g_bytes_ref (text);
+    if (priv->text)
+        g_bytes_unref (priv->text);
+    if (priv->png)
+        g_bytes_unref (priv->png);
     g_free (priv->image_checksum);
 
-    priv->text = g_strdup (text);
+    priv->text = text;
+    priv->has_text_hash = FALSE;
     priv->image_checksum = NULL;
+    priv->png = NULL;
+}
+
+/* Only hash captured text when we actually need to compare it with an item */
+static guint64
+g_paste_clipboard_get_text_hash (GPasteClipboard *self)
+{
+    GPasteClipboardPrivate *priv = self->priv;
+
+    if (!priv->has_text_hash)
+    {
+        gsize size;
+        gconstpointer data = g_bytes_get_data (priv->text, &size);
+
+        priv->text_hash = g_paste_text_kernel_hash (data, size);
+        priv->has_text_hash = TRUE;
+    }
+
+    return priv->text_hash;
+}
+
+static gboolean
+g_paste_clipboard_store (gpointer user_data)
+{
+    GPasteClipboardPrivate *priv = G_PASTE_CLIPBOARD (user_data)->priv;
+
+    priv->store_source = 0;
+    gtk_clipboard_store (priv->real);
+
+    return FALSE;
+}
+
+/* Selecting several items in a row only hands the last one over to the clipboard manager */
+static void
+g_paste_clipboard_schedule_store (GPasteClipboard *self)
+{
+    GPasteClipboardPrivate *priv = self->priv;
+    guint32 delay = g_paste_settings_get_clipboard_store_delay (priv->settings);
+
+    if (priv->store_source)
+    {
+        g_source_remove (priv->store_source);
+        priv->store_source = 0;
+    }
+
+    gtk_clipboard_set_can_store (priv->real, NULL, 0);
+    if (delay)
+        priv->store_source = g_timeout_add (delay, g_paste_clipboard_store, self);
+    else
+        gtk_clipboard_store (priv->real);
+}
+
+static void
+_g_paste_clipboard_select_text (GPasteClipboard *self,
+                                GBytes          *text,
+                                GPasteItem      *item)
+{
+    GtkClipboard *real = self->priv->real;
+    GtkTargetList *target_list = gtk_target_list_new (NULL, 0);
+
+    _g_paste_clipboard_set_text (self, text);
+
+    gtk_target_list_add_text_targets (target_list, 0);
+
+    gint n_targets;
+    GtkTargetEntry *targets = gtk_target_table_new_from_list (target_list, &n_targets);
+
+    /* The text is served from the shared buffer, only when someone asks for it */
+    if (item)
+    {
+        gtk_clipboard_set_with_owner (real,
+                                      targets,
+                                      n_targets,
+                                      g_paste_clipboard_get_clipboard_data,
+                                      g_paste_clipboard_clear_clipboard_data,
+                                      g_object_ref (item));
+    }
+    else
+    {
+        gtk_clipboard_set_with_data (real,
+                                     targets,
+                                     n_targets,
+                                     g_paste_clipboard_get_text_data,
+                                     g_paste_clipboard_clear_bytes_data,
+                                     g_bytes_ref (text));
+    }
+    g_paste_clipboard_schedule_store (self);
+
+    gtk_target_table_free (targets, n_targets);
+    gtk_target_list_unref (target_list);
 }
 
 /**
@@ -119,31 +234,49 @@ g_paste_clipboard_set_text (GPasteClipboard *self)
         return NULL;
 
     GPasteSettings *settings = priv->settings;
-    gchar *stripped = g_strstrip (g_strdup (text));
     gboolean trim_items = g_paste_settings_get_trim_items (settings);
-    const gchar *to_add = trim_items ? stripped : text;
+    gsize length = strlen (text);
+    gsize start, end;
+
+    /* Compute the stripped bounds without duplicating the text */
+    g_paste_text_kernel_trim_bounds (text, length, &start, &end);
+
+    gsize stripped_length = end - start;
+    gboolean stripped = (stripped_length != length);
+    gsize to_add_length = trim_items ? stripped_length : length;
+
+    if (to_add_length < g_paste_settings_get_min_text_item_size (settings) ||
+        to_add_length > g_paste_settings_get_max_text_item_size (settings) ||
+        stripped_length == 0)
+    {
+        g_free (text);
+        return NULL;
+    }
+
+    if (trim_items && stripped)
+    {
+        memmove (text, text + start, stripped_length);
+        text[stripped_length] = '\0';
+    }
+
+    /* From now on, this buffer is shared by the clipboard, the history and the clients */
+    GBytes *to_add = g_bytes_new_take (text, to_add_length + 1);
     const gchar *ret = NULL;
-    gsize length = strlen (to_add);
-
-    if (length < g_paste_settings_get_min_text_item_size (settings) ||
-        length > g_paste_settings_get_max_text_item_size (settings) ||
-        strlen (stripped) == 0 ||
-        (priv->text &&
-            g_strcmp0 (priv->text, to_add) == 0))
-                goto ignore;
-
-    if (trim_items &&
-        priv->target == GDK_SELECTION_CLIPBOARD &&
-        g_strcmp0 (text, stripped) != 0)
-            g_paste_clipboard_select_text (self, stripped);
-    else
-        _g_paste_clipboard_set_text (self, to_add);
 
-    ret = priv->text;
+    if (!priv->text ||
+        !g_bytes_equal (priv->text, to_add))
+    {
+        if (trim_items &&
+            priv->target == GDK_SELECTION_CLIPBOARD &&
+            stripped)
+                _g_paste_clipboard_select_text (self, to_add, NULL);
+        else
+            _g_paste_clipboard_set_text (self, to_add);
+
+        ret = g_bytes_get_data (priv->text, NULL);
+    }
 
-ignore:
-    g_free (stripped);
-    g_free (text);
+    g_bytes_unref (to_add);
 
     return ret;
 }
@@ -165,11 +298,23 @@ g_paste_clipboard_select_text (GPasteClipboard *self,
     g_return_if_fail (text != NULL);
     g_return_if_fail (g_utf8_validate (text, -1, NULL));
 
-    GtkClipboard *real = self->priv->real;
+    GBytes *bytes = g_bytes_new (text, strlen (text) + 1);
 
-    _g_paste_clipboard_set_text (self, text);
-    gtk_clipboard_set_text (real, text, -1);
-    gtk_clipboard_store (real);
+    _g_paste_clipboard_select_text (self, bytes, NULL);
+    g_bytes_unref (bytes);
+}
+
+/**
+ * g_paste_clipboard_select_text_bytes: (skip)
+ */
+void
+g_paste_clipboard_select_text_bytes (GPasteClipboard *self,
+                                     GBytes          *text)
+{
+    g_return_if_fail (G_PASTE_IS_CLIPBOARD (self));
+    g_return_if_fail (text != NULL);
+
+    _g_paste_clipboard_select_text (self, text, NULL);
 }
 
 static void
@@ -182,7 +327,7 @@ _g_paste_clipboard_select_uris (GPasteClipboard *self,
     GtkClipboard *real = self->priv->real;
     GtkTargetList *target_list = gtk_target_list_new (NULL, 0);
 
-    _g_paste_clipboard_set_text (self, g_paste_item_get_value (G_PASTE_ITEM (item)));
+    _g_paste_clipboard_set_text (self, g_paste_item_get_value_bytes (G_PASTE_ITEM (item)));
 
     gtk_target_list_add_text_targets (target_list, 0);
     gtk_target_list_add_uri_targets (target_list, 0);
@@ -196,7 +341,7 @@ _g_paste_clipboard_select_uris (GPasteClipboard *self,
                                   g_paste_clipboard_get_clipboard_data,
                                   g_paste_clipboard_clear_clipboard_data,
                                   g_object_ref (item));
-    gtk_clipboard_store (real);
+    g_paste_clipboard_schedule_store (self);
 
     gtk_target_table_free (targets, n_targets);
     gtk_target_list_unref (target_list);
@@ -226,11 +371,15 @@ g_paste_clipboard_set_image_checksum (GPasteClipboard *self,
 
     GPasteClipboardPrivate *priv = self->priv;
 
-    g_free (priv->text);
+    if (priv->text)
+        g_bytes_unref (priv->text);
+    if (priv->png)
+        g_bytes_unref (priv->png);
     g_free (priv->image_checksum);
 
     priv->text = NULL;
     priv->image_checksum = g_strdup (image_checksum);
+    priv->png = NULL;
 }
 
 static void
@@ -242,10 +391,63 @@ _g_paste_clipboard_select_image (GPasteClipboard *self,
     g_return_if_fail (image != NULL);
 
     GtkClipboard *real = self->priv->real;
+    GtkTargetList *target_list = gtk_target_list_new (NULL, 0);
 
     g_paste_clipboard_set_image_checksum (self, checksum);
-    gtk_clipboard_set_image (real, image);
-    //gtk_clipboard_store (real);
+
+    gtk_target_list_add_image_targets (target_list, 0, TRUE);
+
+    gint n_targets;
+    GtkTargetEntry *targets = gtk_target_table_new_from_list (target_list, &n_targets);
+
+    /* Like gtk_clipboard_set_image, but the image being the owner tells us the selection is ours */
+    gtk_clipboard_set_with_owner (real,
+                                  targets,
+                                  n_targets,
+                                  g_paste_clipboard_get_image_data,
+                                  g_paste_clipboard_clear_clipboard_data,
+                                  g_object_ref (image));
+
+    gtk_target_table_free (targets, n_targets);
+    gtk_target_list_unref (target_list);
+}
+
+/* Images we select always own the selection, don't capture them back */
+static gboolean
+g_paste_clipboard_owns_image (GPasteClipboard *self)
+{
+    GObject *owner = gtk_clipboard_get_owner (self->priv->real);
+
+    return (owner && (G_PASTE_IS_IMAGE_ITEM (owner) || GDK_IS_PIXBUF (owner)));
+}
+
+static void
+_g_paste_clipboard_select_image_item (GPasteClipboard *self,
+                                      GPasteImageItem *item)
+{
+    g_return_if_fail (G_PASTE_IS_CLIPBOARD (self));
+    g_return_if_fail (G_PASTE_IS_IMAGE_ITEM (item));
+
+    GtkClipboard *real = self->priv->real;
+    GtkTargetList *target_list = gtk_target_list_new (NULL, 0);
+
+    g_paste_clipboard_set_image_checksum (self, g_paste_image_item_get_checksum (item));
+
+    gtk_target_list_add_image_targets (target_list, 0, TRUE);
+
+    gint n_targets;
+    GtkTargetEntry *targets = gtk_target_table_new_from_list (target_list, &n_targets);
+
+    /* Encoded payloads get cached on the item while it owns the selection, see g_paste_clipboard_get_clipboard_data */
+    gtk_clipboard_set_with_owner (real,
+                                  targets,
+                                  n_targets,
+                                  g_paste_clipboard_get_clipboard_data,
+                                  g_paste_clipboard_clear_clipboard_data,
+                                  g_object_ref (item));
+
+    gtk_target_table_free (targets, n_targets);
+    gtk_target_list_unref (target_list);
 }
 
 /**
@@ -262,14 +464,16 @@ g_paste_clipboard_set_image (GPasteClipboard *self)
     g_return_val_if_fail (G_PASTE_IS_CLIPBOARD (self), NULL);
 
     GPasteClipboardPrivate *priv = self->priv;
+
+    if (g_paste_clipboard_owns_image (self))
+        return NULL;
+
     GdkPixbuf *image = gtk_clipboard_wait_for_image (priv->real);
     GdkPixbuf *ret = image;
 
     if (image)
     {
-        gchar *checksum = g_compute_checksum_for_data (G_CHECKSUM_SHA256,
-                                                       (guchar *) gdk_pixbuf_get_pixels (image),
-                                                       -1);
+        gchar *checksum = g_paste_image_item_compute_checksum (image);
 
         if (g_strcmp0 (checksum, self->priv->image_checksum) != 0)
             _g_paste_clipboard_select_image (self,
@@ -284,6 +488,102 @@ g_paste_clipboard_set_image (GPasteClipboard *self)
     return ret;
 }
 
+static void
+_g_paste_clipboard_select_png (GPasteClipboard *self,
+                               GBytes          *png,
+                               GdkPixbuf       *image,
+                               const gchar     *checksum)
+{
+    GPasteClipboardPrivate *priv = self->priv;
+    GtkClipboard *real = priv->real;
+    GtkTargetList *target_list = gtk_target_list_new (NULL, 0);
+
+    g_paste_clipboard_set_image_checksum (self, checksum);
+    priv->png = g_bytes_ref (png);
+
+    /* Same targets as gtk_clipboard_set_image, image/png being served as-is */
+    gtk_target_list_add_image_targets (target_list, 0, TRUE);
+
+    gint n_targets;
+    GtkTargetEntry *targets = gtk_target_table_new_from_list (target_list, &n_targets);
+
+    /* The image being the owner tells us the selection is ours, the PNG it came from goes along */
+    g_object_set_qdata_full (G_OBJECT (image),
+                             g_paste_clipboard_png_quark,
+                             g_bytes_ref (png),
+                             (GDestroyNotify) g_bytes_unref);
+    gtk_clipboard_set_with_owner (real,
+                                  targets,
+                                  n_targets,
+                                  g_paste_clipboard_get_png_data,
+                                  g_paste_clipboard_clear_clipboard_data,
+                                  g_object_ref (image));
+
+    gtk_target_table_free (targets, n_targets);
+    gtk_target_list_unref (target_list);
+}
+
+/**
+ * g_paste_clipboard_set_image_png: (skip)
+ * @self: a #GPasteClipboard instance
+ *
+ * Put the image from the intern GtkClipboard in the #GPasteClipboard,
+ * fetching the PNG data as-is instead of decoding it
+ *
+ * Returns: (transfer full): The new PNG data if it was modified, or NULL
+ */
+GBytes *
+g_paste_clipboard_set_image_png (GPasteClipboard *self)
+{
+    g_return_val_if_fail (G_PASTE_IS_CLIPBOARD (self), NULL);
+
+    GPasteClipboardPrivate *priv = self->priv;
+
+    /* Whatever we select ourselves never needs to be fetched back */
+    if (g_paste_clipboard_owns_image (self))
+        return NULL;
+
+    GtkSelectionData *selection_data = gtk_clipboard_wait_for_contents (priv->real, g_paste_clipboard_png_target);
+
+    if (!selection_data)
+        return NULL;
+
+    gint length = gtk_selection_data_get_length (selection_data);
+    GBytes *ret = NULL;
+
+    if (length > 0)
+    {
+        GBytes *png = g_bytes_new (gtk_selection_data_get_data (selection_data), length);
+
+        /* Comparing the bytes is cheaper than decoding them again */
+        if (!priv->png || !g_bytes_equal (png, priv->png))
+        {
+            GdkPixbuf *image = g_paste_image_item_decode_png (png);
+
+            /* Named after its pixels, like the images captured as pixbufs */
+            if (image)
+            {
+                gchar *checksum = g_paste_image_item_compute_checksum (image);
+
+                if (g_strcmp0 (checksum, priv->image_checksum) != 0)
+                {
+                    _g_paste_clipboard_select_png (self, png, image, checksum);
+                    ret = g_bytes_ref (png);
+                }
+
+                g_free (checksum);
+                g_object_unref (image);
+            }
+        }
+
+        g_bytes_unref (png);
+    }
+
+    gtk_selection_data_free (selection_data);
+
+    return ret;
+}
+
 /**
  * g_paste_clipboard_select_item:
  * @self: a #GPasteClipboard instance
@@ -306,20 +606,33 @@ g_paste_clipboard_select_item (GPasteClipboard  *self,
         const gchar *checksum = g_paste_image_item_get_checksum (image_item);
 
         if (g_strcmp0 (checksum, self->priv->image_checksum) != 0)
-            _g_paste_clipboard_select_image (self,
-                                             g_paste_image_item_get_image (image_item),
-                                             checksum);
+            _g_paste_clipboard_select_image_item (self, image_item);
     }
     else
     {
-        const gchar *text = g_paste_item_get_value (item);
-
-        if (g_strcmp0 (text, self->priv->text) != 0)
+        GPasteClipboardPrivate *priv = self->priv;
+        GBytes *text = g_paste_item_get_value_bytes (item);
+        GBytes *current = priv->text;
+        gsize size;
+        guint64 hash;
+
+        g_paste_item_get_fingerprint (item, &size, &hash);
+
+        /* Compare the fingerprints first, the content only if they match */
+        if (!current ||
+            (current != text &&
+             (g_bytes_get_size (current) != size ||
+              g_paste_clipboard_get_text_hash (self) != hash ||
+              !g_bytes_equal (text, current))))
         {
             if (G_PASTE_IS_URIS_ITEM (item))
                 _g_paste_clipboard_select_uris (self, G_PASTE_URIS_ITEM (item));
             else /* if (G_PASTE_IS_TEXT_ITEM (item)) */
-                g_paste_clipboard_select_text (self, text);
+                _g_paste_clipboard_select_text (self, text, (GPasteItem *) item);
+
+            /* We already know the hash of what we just selected */
+            priv->text_hash = hash;
+            priv->has_text_hash = TRUE;
         }
     }
 }
@@ -330,6 +643,12 @@ g_paste_clipboard_dispose (GObject *object)
     GPasteClipboardPrivate *priv = G_PASTE_CLIPBOARD (object)->priv;
     GPasteSettings *settings = priv->settings;
 
+    if (priv->store_source)
+    {
+        g_source_remove (priv->store_source);
+        priv->store_source = 0;
+    }
+
     if (settings)
     {
         g_object_unref (settings);
@@ -344,7 +663,10 @@ g_paste_clipboard_finalize (GObject *object)
 {
     GPasteClipboardPrivate *priv = G_PASTE_CLIPBOARD (object)->priv;
 
-    g_free (priv->text);
+    if (priv->text)
+        g_bytes_unref (priv->text);
+    if (priv->png)
+        g_bytes_unref (priv->png);
     g_free (priv->image_checksum);
 
     G_OBJECT_CLASS (g_paste_clipboard_parent_class)->finalize (object);
@@ -367,7 +689,10 @@ g_paste_clipboard_init (GPasteClipboard *self)
     GPasteClipboardPrivate *priv = self->priv = G_PASTE_CLIPBOARD_GET_PRIVATE (self);
 
     priv->text = NULL;
+    priv->has_text_hash = FALSE;
     priv->image_checksum = NULL;
+    priv->png = NULL;
+    priv->store_source = 0;
 }
 
 /**
@@ -18,7 +18,9 @@
  */
 
 #include "gpaste-clipboards-manager-private.h"
-#include "gpaste-image-item.h"
+#include "gpaste-clipboard-common.h"
+#include "gpaste-clipboard-private.h"
+#include "gpaste-image-item-private.h"
 #include "gpaste-text-item.h"
 #include "gpaste-uris-item.h"
 
@@ -35,6 +37,43 @@ struct _GPasteClipboardsManagerPrivate
     gulong          selected_signal;
 };
 
+/* The owner answered, fetching the content now shouldn't keep us waiting long */
+static void
+g_paste_clipboards_manager_targets_received (GtkClipboard *real,
+                                             GdkAtom      *atoms,
+                                             gint          n_atoms,
+                                             gpointer      user_data)
+{
+    GPasteClipboardsManager *self = user_data;
+    GPasteClipboardsManagerPrivate *priv = self->priv;
+    GPasteClipboard *clipboard = NULL;
+
+    for (GSList *clipboards = priv->clipboards; clipboards && !clipboard; clipboards = g_slist_next (clipboards))
+    {
+        if (g_paste_clipboard_get_real (clipboards->data) == real)
+            clipboard = clipboards->data;
+    }
+
+    if (clipboard)
+    {
+        if (gtk_targets_include_uri (atoms, n_atoms) ||
+            gtk_targets_include_text (atoms, n_atoms))
+                g_paste_clipboard_set_text (clipboard);
+        else if (gtk_targets_include_image (atoms, n_atoms, FALSE)) /* writable */
+            g_paste_clipboard_set_image (clipboard);
+
+        if (g_paste_clipboard_get_text (clipboard) == NULL &&
+            g_paste_clipboard_get_image_checksum (clipboard) == NULL)
+        {
+            const GSList *history = g_paste_history_get_history (priv->history);
+            if (history != NULL)
+                g_paste_clipboard_select_item (clipboard, history->data);
+        }
+    }
+
+    g_object_unref (self);
+}
+
 /**
  * g_paste_clipboards_manager_add_clipboard:
  * @self: a #GPasteClipboardsManager instance
@@ -52,23 +91,32 @@ g_paste_clipboards_manager_add_clipboard (GPasteClipboardsManager *self,
     g_return_if_fail (G_PASTE_IS_CLIPBOARD (clipboard));
 
     GPasteClipboardsManagerPrivate *priv = self->priv;
-    GtkClipboard *real = g_paste_clipboard_get_real (clipboard);
 
     priv->clipboards = g_slist_prepend (priv->clipboards, g_object_ref (clipboard));
 
-    if (gtk_clipboard_wait_is_uris_available (real) ||
-        gtk_clipboard_wait_is_text_available (real))
-            g_paste_clipboard_set_text (clipboard);
-    else if (gtk_clipboard_wait_is_image_available (real))
-        g_paste_clipboard_set_image (clipboard);
+    /* A slow or hung owner mustn't hold the main loop */
+    gtk_clipboard_request_targets (g_paste_clipboard_get_real (clipboard),
+                                   g_paste_clipboards_manager_targets_received,
+                                   g_object_ref (self));
+}
+
+static gboolean
+g_paste_clipboards_manager_has_target (GtkSelectionData *targets,
+                                       GdkAtom           target)
+{
+    GdkAtom *atoms;
+    gint n_atoms;
+    gboolean found = FALSE;
 
-    if (g_paste_clipboard_get_text (clipboard) == NULL &&
-        g_paste_clipboard_get_image_checksum (clipboard) == NULL)
-    {
-        const GSList *history = g_paste_history_get_history (priv->history);
-        if (history != NULL)
-            g_paste_clipboard_select_item (clipboard, history->data);
-    }
+    if (!gtk_selection_data_get_targets (targets, &atoms, &n_atoms))
+        return FALSE;
+
+    for (gint i = 0; i < n_atoms && !found; ++i)
+        found = (atoms[i] == target);
+
+    g_free (atoms);
+
+    return found;
 }
 
 static gboolean
@@ -78,7 +126,7 @@ g_paste_clipboards_manager_check_clipboards (gpointer user_data)
     GPasteClipboardsManagerPrivate *priv = self->priv;
     GPasteHistory *history = priv->history;
     GPasteSettings *settings = priv->settings;
-    const gchar *synchronized_text = NULL;
+    GBytes *synchronized_text = NULL;
 
     for (GSList *clipboard = priv->clipboards; clipboard; clipboard = g_slist_next (clipboard))
     {
@@ -104,21 +152,52 @@ g_paste_clipboards_manager_check_clipboards (gpointer user_data)
 
                 if (text != NULL)
                 {
+                    /* Share the captured buffer instead of copying it around */
+                    GBytes *bytes = g_paste_clipboard_get_text_bytes (clip);
+
                     if (g_paste_settings_get_track_changes (settings))
                     {
                         GPasteItem *item;
 
                         if (uris_available)
-                            item = G_PASTE_ITEM (g_paste_uris_item_new (text));
+                            item = G_PASTE_ITEM (g_paste_uris_item_new_from_bytes (bytes));
                         else
-                            item = G_PASTE_ITEM (g_paste_text_item_new (text));
+                            item = G_PASTE_ITEM (g_paste_text_item_new_from_bytes (bytes));
 
                         g_paste_history_add (history, item);
                         g_object_unref (item);
                     }
 
                     if (g_paste_settings_get_synchronize_clipboards (settings))
-                        synchronized_text = text;
+                    {
+                        if (synchronized_text)
+                            g_bytes_unref (synchronized_text);
+                        synchronized_text = g_bytes_ref (bytes);
+                    }
+                }
+            }
+            else if (g_paste_settings_get_images_support (settings) && g_paste_clipboards_manager_has_target (targets, g_paste_clipboard_png_target))
+            {
+                /* Keep the PNG as the owner encoded it, no re-encoding */
+                GBytes *png = g_paste_clipboard_set_image_png (clip);
+
+                something_in_clipboard = (g_paste_clipboard_get_image_checksum (clip) != NULL);
+
+                if (png != NULL)
+                {
+                    if (g_paste_settings_get_track_changes (settings) &&
+                        (g_paste_clipboard_get_target (clip) == GDK_SELECTION_CLIPBOARD ||
+                            g_paste_settings_get_primary_to_history (settings)))
+                    {
+                        GPasteImageItem *item = g_paste_image_item_new_from_png (png, g_paste_clipboard_get_image_checksum (clip));
+
+                        if (item != NULL)
+                        {
+                            g_paste_history_add (history, G_PASTE_ITEM (item));
+                            g_object_unref (item);
+                        }
+                    }
+                    g_bytes_unref (png);
                 }
             }
             else if (g_paste_settings_get_images_support (settings) && gtk_selection_data_targets_include_image (targets, FALSE))
@@ -133,12 +212,14 @@ g_paste_clipboards_manager_check_clipboards (gpointer user_data)
                         (g_paste_clipboard_get_target (clip) == GDK_SELECTION_CLIPBOARD ||
                             g_paste_settings_get_primary_to_history (settings)))
                     {
-                        GPasteItem *item = G_PASTE_ITEM (g_paste_image_item_new (image));
+                        GPasteItem *item = G_PASTE_ITEM (g_paste_image_item_new_with_checksum (image,
+                                                                                               g_paste_clipboard_get_image_checksum (clip),
+                                                                                               g_paste_settings_get_images_compression_level (settings)));
 
                         g_paste_history_add (history, item);
-                        g_object_unref (image);
                         g_object_unref (item);
                     }
+                    g_object_unref (image);
                 }
             }
 
@@ -158,12 +239,14 @@ g_paste_clipboards_manager_check_clipboards (gpointer user_data)
         for (GSList *clipboard = priv->clipboards; clipboard; clipboard = g_slist_next (clipboard))
         {
             GPasteClipboard *clip = clipboard->data;
-            const gchar *text = g_paste_clipboard_get_text (clip);
+            GBytes *text = g_paste_clipboard_get_text_bytes (clip);
 
             if (text == NULL ||
-                g_strcmp0 (text, synchronized_text) != 0)
-                    g_paste_clipboard_select_text (clip, synchronized_text);
+                (text != synchronized_text && !g_bytes_equal (text, synchronized_text)))
+                    g_paste_clipboard_select_text_bytes (clip, synchronized_text);
         }
+
+        g_bytes_unref (synchronized_text);
     }
 
     return TRUE;
@@ -18,55 +18,1825 @@
  */
 
 #include "gpaste-history-private.h"
-#include "gpaste-image-item.h"
-#include "gpaste-text-item.h"
+#include "gpaste-image-item-private.h"
+#include "gpaste-item-private.h"
+#include "gpaste-settings-keys.h"
+#include "gpaste-text-item-private.h"
+#include "gpaste-text-kernel.h"
 #include "gpaste-uris-item.h"
 
+#include <errno.h>
 #include <glib/gi18n-lib.h>
+#include <glib/gstdio.h>
 #include <libxml/xmlreader.h>
 #include <libxml/xmlwriter.h>
+#include <string.h>
 
 #define G_PASTE_HISTORY_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE ((obj), G_PASTE_TYPE_HISTORY, GPasteHistoryPrivate))
 
+/* 2.0 brought deflated items, deltas and segments, which 1.0 readers would take for plain values */
+#define G_PASTE_HISTORY_VERSION       "2.0"
+#define G_PASTE_HISTORY_VERSION_MAJOR 2
+
+/* Don't write a delta saving less than that to the history file */
+#define G_PASTE_HISTORY_DELTA_MIN_SAVING 64
+/* Number of items sealed at once into an immutable segment file */
+#define G_PASTE_HISTORY_SEGMENT_SIZE 64
+
 G_DEFINE_TYPE (GPasteHistory, g_paste_history, G_TYPE_OBJECT)
 
-struct _GPasteHistoryPrivate
-{
-    GPasteSettings *settings;
-    GSList         *history;
+typedef struct
+{
+    gchar   *file_name;
+    guint32  length;
+    gboolean loaded;
+    gboolean dirty;
+    /* Fingerprint hashes of its items as last written, NULL if unknown */
+    GArray  *hashes;
+} GPasteHistorySegment;
+
+struct _GPasteHistoryPrivate
+{
+    GPasteSettings *settings;
+    GSList         *history;
+
+    /* A save waiting for images still being written by the worker pool */
+    gboolean        save_pending;
+
+    /* The history file being read in a thread, the items added meanwhile stay in front */
+    gboolean        loading;
+    guint           load_serial;
+
+    /* Image files nothing references anymore */
+    guint           gc_source;
+    gboolean        gc_running;
+    gboolean        gc_pending;
+
+    /* The newest items live in the manifest, older ones in segments, newest first */
+    guint32         head_length;
+    GQueue          segments;
+    gchar          *segments_dir_path;
+    GSList         *stale_segments;
+    guint           merge_source;
+    guint           save_source;
+    gboolean        merge_running;
+
+    /* Whoever waits for the state to hand over, once nothing is pending */
+    GPasteHistoryStateFunc state_func;
+    gpointer               state_data;
+
+    gulong          changed_signal;
+    gulong          cache_size_signal;
+    gulong          element_size_signal;
+};
+
+enum
+{
+    ADDED,
+    CHANGED,
+    GARBAGE_COLLECTED,
+    LOADED,
+    SELECTED,
+
+    LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL] = { 0 };
+
+static gboolean g_paste_history_ensure_loaded (GPasteHistory *self,
+                                               guint32        pos);
+static void     g_paste_history_send_state    (GPasteHistory *self);
+static void     g_paste_history_schedule_gc   (GPasteHistory *self);
+
+static gchar *
+g_paste_history_get_segments_dir_path (const gchar *name)
+{
+    gchar *segments_dir_name = g_strconcat (name, ".segments", NULL);
+    gchar *segments_dir_path = g_build_filename (g_get_user_data_dir (), "gpaste", segments_dir_name, NULL);
+
+    g_free (segments_dir_name);
+
+    return segments_dir_path;
+}
+
+/* Named after their creation time, never rewritten in place */
+static gchar *
+g_paste_history_new_segment_file_name (void)
+{
+    static gint64 last = 0;
+    gint64 now = MAX (g_get_real_time (), last + 1);
+
+    last = now;
+
+    return g_strdup_printf ("%016" G_GINT64_MODIFIER "x.xml", now);
+}
+
+static void
+g_paste_history_segment_set_hashes (GPasteHistorySegment *segment,
+                                    GArray               *hashes)
+{
+    if (segment->hashes)
+        g_array_unref (segment->hashes);
+    segment->hashes = hashes;
+}
+
+static void
+g_paste_history_segment_free (GPasteHistorySegment *segment)
+{
+    g_paste_history_segment_set_hashes (segment, NULL);
+    g_free (segment->file_name);
+    g_slice_free (GPasteHistorySegment, segment);
+}
+
+/* The fingerprint hashes of @length items starting at @history */
+static GArray *
+g_paste_history_get_hashes (GSList  *history,
+                            guint32  length)
+{
+    GArray *hashes = g_array_sized_new (FALSE, /* zero terminated */
+                                        FALSE, /* clear */
+                                        sizeof (guint64),
+                                        length);
+
+    for (guint32 i = 0; history && i < length; history = g_slist_next (history), ++i)
+    {
+        guint64 hash;
+
+        g_paste_item_get_fingerprint (history->data, NULL, &hash); /* size */
+        g_array_append_val (hashes, hash);
+    }
+
+    return hashes;
+}
+
+static GArray *
+g_paste_history_new_hashes (const guint64 *data,
+                            gsize          length)
+{
+    if (!length)
+        return NULL;
+
+    GArray *hashes = g_array_sized_new (FALSE, /* zero terminated */
+                                        FALSE, /* clear */
+                                        sizeof (guint64),
+                                        length);
+
+    return g_array_append_vals (hashes, data, length);
+}
+
+static void
+g_paste_history_drop_segment (GPasteHistory *self,
+                              GList         *link)
+{
+    GPasteHistoryPrivate *priv = self->priv;
+    GPasteHistorySegment *segment = link->data;
+
+    /* Its file only goes away once the manifest stops referencing it */
+    if (segment->file_name)
+        priv->stale_segments = g_slist_prepend (priv->stale_segments, g_build_filename (priv->segments_dir_path, segment->file_name, NULL));
+    g_paste_history_segment_free (segment);
+    g_queue_delete_link (&priv->segments, link);
+}
+
+/* Keep track of where the item at @pos was stored */
+static void
+g_paste_history_forget_position (GPasteHistory *self,
+                                 guint32        pos)
+{
+    GPasteHistoryPrivate *priv = self->priv;
+
+    if (pos < priv->head_length)
+    {
+        --priv->head_length;
+        return;
+    }
+
+    pos -= priv->head_length;
+    for (GList *link = priv->segments.head; link; link = g_list_next (link))
+    {
+        GPasteHistorySegment *segment = link->data;
+
+        if (pos < segment->length)
+        {
+            segment->dirty = TRUE;
+            if (!--segment->length)
+                g_paste_history_drop_segment (self, link);
+            return;
+        }
+        pos -= segment->length;
+    }
+}
+
+static GSList *
+_g_paste_history_remove (GPasteHistory *self,
+                         GSList        *elem,
+                         gboolean       remove_leftovers)
+{
+    GPasteItem *item = elem->data;
+
+    g_paste_history_forget_position (self, g_slist_position (self->priv->history, elem));
+
+    if (remove_leftovers && G_PASTE_IS_IMAGE_ITEM (item))
+    {
+        GFile *image = g_file_new_for_path (g_paste_item_get_value (item));
+        g_file_delete (image,
+                       NULL, /* cancellable */
+                       NULL); /* error */
+        g_object_unref (image);
+
+        gchar *thumbnail_path = g_paste_image_item_get_thumbnail_path (G_PASTE_IMAGE_ITEM (item));
+        GFile *thumbnail = g_file_new_for_path (thumbnail_path);
+        g_file_delete (thumbnail,
+                       NULL, /* cancellable */
+                       NULL); /* error */
+        g_object_unref (thumbnail);
+        g_free (thumbnail_path);
+    }
+
+    g_object_unref (item);
+    return g_slist_delete_link (self->priv->history,
+                                elem);
+}
+
+/* Repeated screenshots of the same thing: only keep the newest one */
+static gboolean
+g_paste_history_remove_near_duplicates (GPasteHistory   *self,
+                                        GPasteImageItem *image)
+{
+    GPasteHistoryPrivate *priv = self->priv;
+    guint32 threshold = g_paste_settings_get_images_similarity (priv->settings);
+    guint64 phash, other_phash;
+    gboolean removed = FALSE;
+
+    if (!threshold || !g_paste_image_item_get_phash (image, &phash))
+        return FALSE;
+
+    for (GSList *history = priv->history; history;)
+    {
+        GSList *next = g_slist_next (history);
+        GPasteItem *item = history->data;
+
+        if (item != G_PASTE_ITEM (image) && G_PASTE_IS_IMAGE_ITEM (item) &&
+            g_paste_image_item_get_phash (G_PASTE_IMAGE_ITEM (item), &other_phash) &&
+            g_paste_image_item_phash_distance (phash, other_phash) < threshold)
+        {
+            /* Its files may be shared with another history, only the collector knows */
+            priv->history = _g_paste_history_remove (self, history, FALSE);
+            removed = TRUE;
+        }
+        history = next;
+    }
+
+    if (removed)
+        g_paste_history_schedule_gc (self);
+
+    return removed;
+}
+
+typedef struct
+{
+    GPasteHistory *self;
+    gchar         *current_history;
+    GHashTable    *in_use;
+    GHashTable    *elsewhere;
+    GSList        *segments;
+    gboolean       segment_images;
+    gint64         started;
+    guint64        reclaimed;
+    guint64        kept;
+} GPasteHistoryGcJob;
+
+/* Mark every image a saved history references, following its segments */
+static void
+g_paste_history_gc_mark (GHashTable  *marked,
+                         const gchar *history_file_path,
+                         const gchar *segments_dir_path)
+{
+    xmlTextReaderPtr reader = xmlNewTextReaderFilename (history_file_path);
+
+    if (!reader)
+        return;
+
+    while (xmlTextReaderRead (reader) == 1)
+    {
+        const gchar *name = (const gchar *) xmlTextReaderConstName (reader);
+
+        if (xmlTextReaderNodeType (reader) != 1)
+            continue;
+
+        if (segments_dir_path && g_strcmp0 (name, "segment") == 0)
+        {
+            gchar *file = (gchar *) xmlTextReaderGetAttribute (reader, BAD_CAST "file");
+
+            if (file)
+            {
+                gchar *file_name = g_path_get_basename (file);
+                gchar *path = g_build_filename (segments_dir_path, file_name, NULL);
+
+                g_paste_history_gc_mark (marked, path, NULL); /* segments_dir_path */
+                g_free (path);
+                g_free (file_name);
+            }
+
+            g_free (file);
+            continue;
+        }
+        if (g_strcmp0 (name, "item") != 0)
+            continue;
+
+        gchar *kind = (gchar *) xmlTextReaderGetAttribute (reader, BAD_CAST "kind");
+
+        if (g_strcmp0 (kind, "Image") == 0)
+        {
+            gchar *raw_value = (gchar *) xmlTextReaderReadString (reader);
+
+            if (raw_value)
+                g_hash_table_add (marked, g_paste_text_kernel_unescape (raw_value, strlen (raw_value), NULL));
+            g_free (raw_value);
+        }
+
+        g_free (kind);
+    }
+
+    xmlFreeTextReader (reader);
+}
+
+static void
+g_paste_history_gc_sweep (GPasteHistoryGcJob *job,
+                          const gchar        *gpaste_dir_path)
+{
+    gchar *images_dir_path = g_build_filename (gpaste_dir_path, "images", NULL);
+    gchar *thumbnails_dir_path = g_build_filename (gpaste_dir_path, "thumbnails", NULL);
+    GDir *dir = g_dir_open (images_dir_path, 0, NULL); /* flags, error */
+    const gchar *name;
+    GStatBuf st;
+
+    if (dir)
+    {
+        while ((name = g_dir_read_name (dir)))
+        {
+            /* Leave alone the temporary files of the images being written */
+            if (!g_str_has_suffix (name, ".png"))
+                continue;
+
+            gchar *path = g_build_filename (images_dir_path, name, NULL);
+
+            if (g_stat (path, &st) == 0)
+            {
+                /* Images written since we started belong to items we didn't see */
+                if (g_hash_table_contains (job->in_use, path) ||
+                    g_hash_table_contains (job->elsewhere, path) ||
+                    st.st_mtime >= job->started)
+                {
+                    job->kept += (guint64) st.st_size;
+                }
+                else if (g_unlink (path) == 0)
+                    job->reclaimed += (guint64) st.st_size;
+            }
+
+            g_free (path);
+        }
+        g_dir_close (dir);
+    }
+
+    /* Thumbnails are named after their image */
+    if ((dir = g_dir_open (thumbnails_dir_path, 0, NULL))) /* flags, error */
+    {
+        while ((name = g_dir_read_name (dir)))
+        {
+            gchar *image_path = g_build_filename (images_dir_path, name, NULL);
+
+            if (!g_file_test (image_path, G_FILE_TEST_EXISTS))
+            {
+                gchar *path = g_build_filename (thumbnails_dir_path, name, NULL);
+
+                if (g_stat (path, &st) == 0 && g_unlink (path) == 0)
+                    job->reclaimed += (guint64) st.st_size;
+                g_free (path);
+            }
+
+            g_free (image_path);
+        }
+        g_dir_close (dir);
+    }
+
+    g_free (thumbnails_dir_path);
+    g_free (images_dir_path);
+}
+
+static GSList *
+g_paste_history_get_oldest_image (GPasteHistory *self,
+                                  GHashTable    *elsewhere)
+{
+    GSList *oldest = NULL;
+
+    /* Never evict the active item, whatever its age */
+    for (GSList *history = g_slist_next (self->priv->history); history; history = g_slist_next (history))
+    {
+        GPasteItem *item = history->data;
+
+        /* Dropping an image another history uses wouldn't free anything */
+        if (!G_PASTE_IS_IMAGE_ITEM (item) ||
+            !g_paste_image_item_is_persisted (G_PASTE_IMAGE_ITEM (item)) ||
+            g_hash_table_contains (elsewhere, g_paste_item_get_value (item)))
+        {
+            continue;
+        }
+
+        if (!oldest || g_date_time_compare (g_paste_image_item_get_date (G_PASTE_IMAGE_ITEM (item)),
+                                            g_paste_image_item_get_date (oldest->data)) < 0)
+        {
+            oldest = history;
+        }
+    }
+
+    return oldest;
+}
+
+static gboolean
+g_paste_history_gc_done (gpointer user_data)
+{
+    GPasteHistoryGcJob *job = user_data;
+    GPasteHistory *self = job->self;
+    GPasteHistoryPrivate *priv = self->priv;
+    guint64 quota = (guint64) g_paste_settings_get_images_disk_quota (priv->settings) * 1024 * 1024;
+    gboolean removed = FALSE;
+    GSList *oldest;
+
+    /* The oldest images live in the segments we didn't load, read them so that they go first */
+    if (quota && job->kept > quota && job->segment_images)
+        g_paste_history_ensure_loaded (self, G_MAXUINT32);
+
+    while (quota && job->kept > quota && (oldest = g_paste_history_get_oldest_image (self, job->elsewhere)))
+    {
+        guint64 size = g_paste_image_item_get_file_size (oldest->data);
+
+        job->kept -= MIN (size, job->kept);
+        job->reclaimed += size;
+        priv->history = _g_paste_history_remove (self, oldest, TRUE);
+        removed = TRUE;
+    }
+
+    priv->gc_running = FALSE;
+
+    if (removed)
+    {
+        g_signal_emit (self,
+                       signals[CHANGED],
+                       0); /* detail */
+    }
+
+    g_signal_emit (self,
+                   signals[GARBAGE_COLLECTED],
+                   0, /* detail */
+                   job->reclaimed);
+
+    g_object_unref (self);
+    g_free (job->current_history);
+    g_slist_free_full (job->segments,
+                       g_free);
+    g_hash_table_unref (job->in_use);
+    g_hash_table_unref (job->elsewhere);
+    g_slice_free (GPasteHistoryGcJob, job);
+
+    return FALSE;
+}
+
+static gpointer
+g_paste_history_gc_worker (gpointer data)
+{
+    GPasteHistoryGcJob *job = data;
+    gchar *gpaste_dir_path = g_build_filename (g_get_user_data_dir (), "gpaste", NULL);
+    GDir *dir = g_dir_open (gpaste_dir_path, 0, NULL); /* flags, error */
+
+    if (dir)
+    {
+        const gchar *name;
+
+        while ((name = g_dir_read_name (dir)))
+        {
+            /* The loaded history may not be saved yet, its images are already marked */
+            if (!g_str_has_suffix (name, ".xml") || g_strcmp0 (name, job->current_history) == 0)
+                continue;
+
+            gchar *path = g_build_filename (gpaste_dir_path, name, NULL);
+            gchar *history_name = g_strndup (name, strlen (name) - 4);
+            gchar *segments_dir_path = g_paste_history_get_segments_dir_path (history_name);
+
+            g_paste_history_gc_mark (job->elsewhere, path, segments_dir_path);
+            g_free (segments_dir_path);
+            g_free (history_name);
+            g_free (path);
+        }
+        g_dir_close (dir);
+    }
+
+    /* The images of the segments we didn't load are in use too */
+    guint loaded_images = g_hash_table_size (job->in_use);
+
+    for (GSList *segment = job->segments; segment; segment = g_slist_next (segment))
+        g_paste_history_gc_mark (job->in_use, segment->data, NULL); /* segments_dir_path */
+    job->segment_images = (g_hash_table_size (job->in_use) > loaded_images);
+
+    g_paste_history_gc_sweep (job, gpaste_dir_path);
+    g_free (gpaste_dir_path);
+
+    g_idle_add (g_paste_history_gc_done, job);
+
+    return NULL;
+}
+
+/**
+ * g_paste_history_collect_garbage:
+ * @self: a #GPasteHistory instance
+ *
+ * Delete the stored images no history references anymore, then drop
+ * the oldest images of the #GPasteHistory while over the disk quota.
+ * The work is done in a thread, "garbage-collected" is emitted with
+ * the number of bytes reclaimed once it's over
+ *
+ * Returns:
+ */
+G_PASTE_VISIBLE void
+g_paste_history_collect_garbage (GPasteHistory *self)
+{
+    g_return_if_fail (G_PASTE_IS_HISTORY (self));
+
+    GPasteHistoryPrivate *priv = self->priv;
+
+    if (priv->gc_source)
+    {
+        g_source_remove (priv->gc_source);
+        priv->gc_source = 0;
+    }
+
+    /* The running one will answer for us */
+    if (priv->gc_running)
+        return;
+
+    /* The images of the history being read would look unused */
+    if (priv->loading)
+    {
+        priv->gc_pending = TRUE;
+        return;
+    }
+
+    GPasteHistoryGcJob *job = g_slice_new (GPasteHistoryGcJob);
+
+    job->self = g_object_ref (self);
+    job->current_history = g_strconcat (g_paste_settings_get_history_name (priv->settings), ".xml", NULL);
+    job->in_use = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    job->elsewhere = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    job->segments = NULL;
+    job->segment_images = FALSE;
+    job->started = g_get_real_time () / G_USEC_PER_SEC;
+    job->reclaimed = 0;
+    job->kept = 0;
+
+    for (GSList *history = priv->history; history; history = g_slist_next (history))
+    {
+        GPasteItem *item = history->data;
+
+        if (G_PASTE_IS_IMAGE_ITEM (item))
+            g_hash_table_add (job->in_use, g_strdup (g_paste_item_get_value (item)));
+    }
+
+    for (GList *link = priv->segments.head; link; link = g_list_next (link))
+    {
+        GPasteHistorySegment *segment = link->data;
+
+        if (!segment->loaded && segment->file_name)
+            job->segments = g_slist_prepend (job->segments, g_build_filename (priv->segments_dir_path, segment->file_name, NULL));
+    }
+
+    priv->gc_running = TRUE;
+    g_thread_unref (g_thread_new ("gpaste-gc", g_paste_history_gc_worker, job));
+}
+
+static gboolean
+g_paste_history_scheduled_gc (gpointer user_data)
+{
+    GPasteHistory *self = user_data;
+
+    self->priv->gc_source = 0;
+    g_paste_history_collect_garbage (self);
+
+    return FALSE;
+}
+
+/* Some images may have become unreachable, have a look once things settle down */
+static void
+g_paste_history_schedule_gc (GPasteHistory *self)
+{
+    GPasteHistoryPrivate *priv = self->priv;
+
+    if (!priv->gc_source)
+        priv->gc_source = g_timeout_add_seconds (60, g_paste_history_scheduled_gc, self);
+}
+
+/* Whatever the thread reads now gets dropped */
+static void
+g_paste_history_cancel_load (GPasteHistory *self)
+{
+    GPasteHistoryPrivate *priv = self->priv;
+
+    priv->loading = FALSE;
+    ++priv->load_serial;
+
+    /* Someone still waits for "garbage-collected" */
+    if (priv->gc_pending)
+    {
+        priv->gc_pending = FALSE;
+        if (priv->gc_source)
+            g_source_remove (priv->gc_source);
+        priv->gc_source = g_idle_add (g_paste_history_scheduled_gc, self);
+    }
+}
+
+/* Counted from the items we still hold: dropped ones may persist later, or never */
+static gboolean
+g_paste_history_has_pending_images (GPasteHistory *self)
+{
+    for (GSList *history = self->priv->history; history; history = g_slist_next (history))
+    {
+        GPasteItem *item = history->data;
+
+        if (G_PASTE_IS_IMAGE_ITEM (item) && !g_paste_image_item_is_persisted (G_PASTE_IMAGE_ITEM (item)))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+static void
+g_paste_history_image_persisted (GPasteImageItem *image,
+                                 gpointer         user_data)
+{
+    GPasteHistory *self = user_data;
+    GPasteHistoryPrivate *priv = self->priv;
+
+    /* The perceptual hash is computed along with the file */
+    if (g_slist_find (priv->history, image) && g_paste_history_remove_near_duplicates (self, image))
+    {
+        g_signal_emit (self,
+                       signals[CHANGED],
+                       0); /* detail */
+    }
+    else if (priv->save_pending && !g_paste_history_has_pending_images (self))
+    {
+        priv->save_pending = FALSE;
+        g_paste_history_save (self);
+    }
+
+    if (g_paste_settings_get_images_disk_quota (priv->settings))
+        g_paste_history_schedule_gc (self);
+
+    g_paste_history_send_state (self);
+}
+
+/* Never save a reference to a file which isn't there, whoever owns the clipboard keeps its copy */
+static void
+g_paste_history_image_persist_failed (GPasteImageItem *image,
+                                      gpointer         user_data)
+{
+    GPasteHistory *self = user_data;
+    GPasteHistoryPrivate *priv = self->priv;
+    GSList *history = g_slist_find (priv->history, image);
+
+    if (history)
+    {
+        priv->history = _g_paste_history_remove (self, history, FALSE);
+        g_signal_emit (self,
+                       signals[CHANGED],
+                       0); /* detail */
+    }
+    else if (priv->save_pending && !g_paste_history_has_pending_images (self))
+    {
+        priv->save_pending = FALSE;
+        g_paste_history_save (self);
+    }
+
+    g_paste_history_send_state (self);
+}
+
+/* Items past the displayed ones are rarely read again, compress the big ones */
+static void
+g_paste_history_compress_cold_items (GPasteHistory *self)
+{
+    GPasteHistoryPrivate *priv = self->priv;
+    GPasteSettings *settings = priv->settings;
+    guint32 threshold = g_paste_settings_get_compression_threshold (settings);
+
+    if (!threshold)
+        return;
+
+    for (GSList *history = g_slist_nth (priv->history, g_paste_settings_get_max_displayed_history_size (settings));
+         history;
+         history = g_slist_next (history))
+    {
+        GPasteItem *item = history->data;
+        gsize size;
+
+        /* Uris and images are small, and their value gets parsed */
+        if (G_OBJECT_TYPE (item) != G_PASTE_TYPE_TEXT_ITEM)
+            continue;
+
+        g_paste_item_get_fingerprint (item, &size, NULL); /* hash */
+        if (size > threshold)
+            g_paste_item_compress (item);
+    }
+}
+
+/* Cut on character boundaries, the history file has to stay valid UTF-8 */
+static void
+g_paste_history_get_delta (GBytes      *previous,
+                           const gchar *value,
+                           gsize        length,
+                           gsize       *prefix,
+                           gsize       *suffix)
+{
+    gsize previous_size;
+    const gchar *previous_value = g_bytes_get_data (previous, &previous_size);
+
+    g_paste_text_kernel_common_affixes (previous_value, previous_size - 1, value, length, prefix, suffix);
+
+    while (*prefix && (value[*prefix] & 0xC0) == 0x80)
+        --*prefix;
+    while (*suffix && (value[length - *suffix] & 0xC0) == 0x80)
+        --*suffix;
+
+    if (*prefix + *suffix < G_PASTE_HISTORY_DELTA_MIN_SAVING)
+        *prefix = *suffix = 0;
+}
+
+static GBytes *
+g_paste_history_apply_delta (GBytes  *previous,
+                             GBytes  *middle,
+                             guint64  prefix,
+                             guint64  suffix)
+{
+    if (!previous)
+        return NULL;
+
+    /* Both sizes include the trailing NUL, the affixes don't */
+    gsize previous_size, middle_size;
+    const gchar *previous_value = g_bytes_get_data (previous, &previous_size);
+    const gchar *middle_value = g_bytes_get_data (middle, &middle_size);
+
+    if (prefix > previous_size - 1 || suffix > previous_size - 1 - prefix)
+        return NULL;
+
+    gsize size = prefix + middle_size + suffix;
+    gchar *value = g_malloc (size);
+
+    memcpy (value, previous_value, prefix);
+    memcpy (value + prefix, middle_value, middle_size - 1);
+    memcpy (value + prefix + middle_size - 1, previous_value + previous_size - 1 - suffix, suffix);
+    value[size - 1] = '\0';
+
+    return g_bytes_new_take (value, size);
+}
+
+/* Each item is settled before serving as a base, so deltas never chain */
+static void
+g_paste_history_pack (GSList *history)
+{
+    for (; history && history->next; history = g_slist_next (history))
+    {
+        if (G_PASTE_IS_TEXT_ITEM (history->data) && G_PASTE_IS_TEXT_ITEM (history->next->data))
+            g_paste_item_set_delta_base (history->next->data, history->data);
+    }
+}
+
+static GPasteItem *
+g_paste_history_load_compressed (const gchar *raw_value,
+                                 const gchar *raw_length,
+                                 const gchar *kind)
+{
+    if (!raw_value || !raw_length || g_strcmp0 (kind, "Text") != 0)
+        return NULL;
+
+    gsize compressed_size;
+    guchar *data = g_base64_decode (raw_value, &compressed_size);
+    GBytes *compressed = g_bytes_new_take (data, compressed_size);
+    GPasteItem *item = g_paste_item_new_compressed (G_PASTE_TYPE_TEXT_ITEM,
+                                                    compressed,
+                                                    g_ascii_strtoull (raw_length, NULL, 10));
+
+    g_bytes_unref (compressed);
+
+    return item;
+}
+
+/* Items of a newer format could mean anything, a newer manifest becomes a history of its own */
+static gboolean
+g_paste_history_check_version (xmlTextReaderPtr reader,
+                               const gchar     *path,
+                               gboolean         manifest)
+{
+    gchar *version = (gchar *) xmlTextReaderGetAttribute (reader, BAD_CAST "version");
+    guint64 major = (version) ? g_ascii_strtoull (version, NULL, 10) : 1;
+
+    g_free (version);
+
+    if (major <= G_PASTE_HISTORY_VERSION_MAJOR)
+        return TRUE;
+
+    if (!manifest)
+    {
+        g_warning ("%s: unsupported history version %" G_GUINT64_FORMAT ", not loading it", path, major);
+        return FALSE;
+    }
+
+    /* Saving over it or collecting its segments and images would lose it */
+    gchar *file_name = g_path_get_basename (path);
+    gchar *name = g_strndup (file_name, strlen (file_name) - 4);
+    gchar *aside_name = g_strdup_printf ("%s-v%" G_GUINT64_FORMAT, name, major);
+    gchar *aside_file_name = g_strconcat (aside_name, ".xml", NULL);
+    gchar *dir_path = g_path_get_dirname (path);
+    gchar *aside_path = g_build_filename (dir_path, aside_file_name, NULL);
+    gchar *segments_dir_path = g_paste_history_get_segments_dir_path (name);
+    gchar *aside_segments_dir_path = g_paste_history_get_segments_dir_path (aside_name);
+
+    g_warning ("%s: unsupported history version %" G_GUINT64_FORMAT ", moved to %s", path, major, aside_path);
+    if (g_rename (path, aside_path) != 0)
+        g_warning ("%s: %s", aside_path, g_strerror (errno));
+    else if (g_file_test (segments_dir_path, G_FILE_TEST_IS_DIR) && g_rename (segments_dir_path, aside_segments_dir_path) != 0)
+        g_warning ("%s: %s", aside_segments_dir_path, g_strerror (errno));
+
+    g_free (aside_segments_dir_path);
+    g_free (segments_dir_path);
+    g_free (aside_path);
+    g_free (dir_path);
+    g_free (aside_file_name);
+    g_free (aside_name);
+    g_free (name);
+    g_free (file_name);
+
+    return FALSE;
+}
+
+/* Prepends the items read to @items, records the segments a manifest references */
+static guint32
+g_paste_history_read_file (GPasteHistory *self,
+                           const gchar   *path,
+                           guint32        max_items,
+                           GSList       **items,
+                           GQueue        *segments)
+{
+    GPasteSettings *settings = self->priv->settings;
+    xmlTextReaderPtr reader = xmlNewTextReaderFilename (path);
+    GBytes *previous = NULL;
+    guint32 i = 0;
+
+    if (!reader)
+        return 0;
+
+    while (xmlTextReaderRead (reader) == 1)
+    {
+        if (xmlTextReaderNodeType (reader) != 1)
+            continue;
+        const gchar *name = (const gchar *) xmlTextReaderConstName (reader);
+        if (g_strcmp0 (name, "history") == 0)
+        {
+            if (!g_paste_history_check_version (reader, path, segments != NULL))
+                break;
+            continue;
+        }
+        if (segments && g_strcmp0 (name, "segment") == 0)
+        {
+            gchar *file = (gchar *) xmlTextReaderGetAttribute (reader, BAD_CAST "file");
+            gchar *length = (gchar *) xmlTextReaderGetAttribute (reader, BAD_CAST "items");
+            gchar *hashes = (gchar *) xmlTextReaderGetAttribute (reader, BAD_CAST "hashes");
+
+            if (file && length)
+            {
+                GPasteHistorySegment *segment = g_slice_new0 (GPasteHistorySegment);
+
+                segment->file_name = g_path_get_basename (file);
+                segment->length = (guint32) g_ascii_strtoull (length, NULL, 10);
+                if (hashes)
+                {
+                    segment->hashes = g_array_new (FALSE, FALSE, sizeof (guint64)); /* zero terminated, clear */
+                    for (gchar *hash = hashes, *end; *hash; hash = end)
+                    {
+                        guint64 value = g_ascii_strtoull (hash, &end, 16);
+
+                        if (end == hash)
+                            break;
+                        g_array_append_val (segment->hashes, value);
+                    }
+                    if (!segment->hashes->len)
+                        g_paste_history_segment_set_hashes (segment, NULL);
+                }
+                g_queue_push_tail (segments, segment);
+            }
+
+            g_free (hashes);
+            g_free (length);
+            g_free (file);
+            continue;
+        }
+        if (!name || g_strcmp0 (name, "item") != 0 || i >= max_items)
+            continue;
+
+        ++i;
+
+        gchar *kind = (gchar *) xmlTextReaderGetAttribute (reader, BAD_CAST "kind");
+        gchar *date = (gchar *) xmlTextReaderGetAttribute (reader, BAD_CAST "date");
+        gchar *encoding = (gchar *) xmlTextReaderGetAttribute (reader, BAD_CAST "encoding");
+        gchar *raw_value = (gchar *) xmlTextReaderReadString (reader);
+
+        if (g_strcmp0 (encoding, "deflate") == 0)
+        {
+            gchar *raw_length = (gchar *) xmlTextReaderGetAttribute (reader, BAD_CAST "length");
+            GPasteItem *item = g_paste_history_load_compressed (raw_value, raw_length, kind);
+
+            if (item != NULL)
+                *items = g_slist_prepend (*items, item);
+            /* Keep the value for the next delta */
+            if (previous)
+                g_bytes_unref (previous);
+            previous = (item) ? g_paste_item_ref_value_bytes (item) : NULL;
+
+            g_free (raw_length);
+            g_free (raw_value);
+            g_free (encoding);
+            g_free (date);
+            g_free (kind);
+            continue;
+        }
+        if (encoding)
+        {
+            /* Unknown encoding: skip the item, and what may be a delta against it */
+            g_warning ("%s: skipping an item with unsupported encoding %s", path, encoding);
+            if (previous)
+                g_bytes_unref (previous);
+            previous = NULL;
+
+            g_free (raw_value);
+            g_free (encoding);
+            g_free (date);
+            g_free (kind);
+            continue;
+        }
+
+        gsize length;
+        gchar *value = g_paste_text_kernel_unescape (raw_value, (raw_value) ? strlen (raw_value) : 0, &length);
+        GBytes *bytes = g_bytes_new_take (value, length + 1);
+        gchar *prefix = (gchar *) xmlTextReaderGetAttribute (reader, BAD_CAST "prefix");
+        gchar *suffix = (gchar *) xmlTextReaderGetAttribute (reader, BAD_CAST "suffix");
+
+        /* Stored as the difference to the previous one */
+        if (prefix && suffix)
+        {
+            GBytes *middle = bytes;
+
+            bytes = g_paste_history_apply_delta (previous,
+                                                 middle,
+                                                 g_ascii_strtoull (prefix, NULL, 10),
+                                                 g_ascii_strtoull (suffix, NULL, 10));
+            value = (bytes) ? (gchar *) g_bytes_get_data (bytes, NULL) : NULL;
+            g_bytes_unref (middle);
+        }
+
+        if (!bytes)
+        {
+            /* Nothing sensible to apply the delta to, skip it */
+        }
+        else if (g_strcmp0 (kind, "Text") == 0)
+        {
+            GPasteTextItem *item = g_paste_text_item_new_from_bytes (bytes);
+
+            if (item != NULL)
+                *items = g_slist_prepend (*items, item);
+        }
+        else if (g_strcmp0 (kind, "Uris") == 0)
+        {
+            GPasteUrisItem *item = g_paste_uris_item_new_from_bytes (bytes);
+
+            if (item != NULL)
+                *items = g_slist_prepend (*items, item);
+        }
+        else if (g_strcmp0 (kind, "Image") == 0)
+        {
+            if (g_paste_settings_get_images_support (settings))
+            {
+                GDateTime *date_time = g_date_time_new_from_unix_local (g_ascii_strtoll (date,
+                                                                                         NULL, /* end */
+                                                                                         0)); /* base */
+                gchar *checksum = (gchar *) xmlTextReaderGetAttribute (reader, BAD_CAST "checksum");
+                gchar *width = (gchar *) xmlTextReaderGetAttribute (reader, BAD_CAST "width");
+                gchar *height = (gchar *) xmlTextReaderGetAttribute (reader, BAD_CAST "height");
+                gchar *size = (gchar *) xmlTextReaderGetAttribute (reader, BAD_CAST "size");
+                gchar *phash = (gchar *) xmlTextReaderGetAttribute (reader, BAD_CAST "phash");
+                GPasteImageItem *item = g_paste_image_item_new_from_file_full (value,
+                                                                               date_time,
+                                                                               checksum,
+                                                                               (width) ? (gint) g_ascii_strtoll (width, NULL, 10) : 0,
+                                                                               (height) ? (gint) g_ascii_strtoll (height, NULL, 10) : 0,
+                                                                               (size) ? (gsize) g_ascii_strtoull (size, NULL, 10) : 0);
+
+                if (item != NULL && phash)
+                    g_paste_image_item_set_phash (item, g_ascii_strtoull (phash, NULL, 16));
+
+                g_free (phash);
+                g_free (size);
+                g_free (height);
+                g_free (width);
+                g_free (checksum);
+
+                if (item != NULL)
+                    *items = g_slist_prepend (*items, item);
+
+                g_date_time_unref (date_time);
+            }
+            else
+            {
+                GFile *img_file = g_file_new_for_path (value);
+
+                if (g_file_query_exists (img_file,
+                                         NULL)) /* cancellable */
+                {
+                    g_file_delete (img_file,
+                                   NULL, /* cancellable */
+                                   NULL); /* error */
+                }
+
+                g_object_unref (img_file);
+            }
+        }
+
+        g_free (raw_value);
+        if (previous)
+            g_bytes_unref (previous);
+        previous = bytes;
+        g_free (suffix);
+        g_free (prefix);
+        g_free (encoding);
+        g_free (date);
+        g_free (kind);
+    }
+
+    if (previous)
+        g_bytes_unref (previous);
+    xmlFreeTextReader (reader);
+
+    return i;
+}
+
+/* Buffers the document so that it can replace @path in one rename */
+static xmlTextWriterPtr
+g_paste_history_new_writer (xmlBufferPtr *buffer)
+{
+    *buffer = xmlBufferCreate ();
+
+    if (!*buffer)
+        return NULL;
+
+    xmlTextWriterPtr writer = xmlNewTextWriterMemory (*buffer, 0);
+
+    if (!writer)
+        xmlBufferFree (*buffer);
+
+    return writer;
+}
+
+/* @path is either left untouched or fully replaced, never truncated */
+static gboolean
+g_paste_history_commit_writer (xmlTextWriterPtr writer,
+                               xmlBufferPtr     buffer,
+                               const gchar     *path)
+{
+    gboolean ok = (xmlTextWriterEndDocument (writer) >= 0 &&
+                   xmlTextWriterFlush (writer) >= 0);
+
+    xmlFreeTextWriter (writer);
+
+    if (ok)
+    {
+        GError *error = NULL;
+
+        /* g_file_set_contents writes a temporary file and renames it over @path */
+        if (!g_file_set_contents (path,
+                                  (const gchar *) xmlBufferContent (buffer),
+                                  xmlBufferLength (buffer),
+                                  &error))
+        {
+            g_warning ("%s: %s", path, error->message);
+            g_error_free (error);
+            ok = FALSE;
+        }
+    }
+    else
+        g_warning ("%s: could not write the history", path);
+
+    xmlBufferFree (buffer);
+
+    return ok;
+}
+
+/* Writes @length items starting at @history, then references to @segments */
+static gboolean
+g_paste_history_write_file (GPasteHistory *self,
+                            const gchar   *path,
+                            GSList        *history,
+                            guint32        length,
+                            GQueue        *segments)
+{
+    xmlBufferPtr buffer;
+    xmlTextWriterPtr writer = g_paste_history_new_writer (&buffer);
+
+    if (!writer)
+        return FALSE;
+
+    xmlTextWriterSetIndent (writer, TRUE);
+    xmlTextWriterSetIndentString (writer, BAD_CAST "  ");
+
+    xmlTextWriterStartDocument (writer, "1.0", "UTF-8", NULL);
+    xmlTextWriterStartElement (writer, BAD_CAST "history");
+    xmlTextWriterWriteAttribute (writer, BAD_CAST "version", BAD_CAST G_PASTE_HISTORY_VERSION);
+
+    gboolean delta_storage = g_paste_settings_get_delta_storage (self->priv->settings);
+    GBytes *previous = NULL;
+
+    for (guint32 i = 0; history && i < length; history = g_slist_next (history), ++i)
+    {
+        GPasteItem *item = history->data;
+        GBytes *compressed = g_paste_item_get_compressed (item);
+        /* Compressed items are written as is, their value only serves as the base of the next delta */
+        GBytes *bytes = (compressed && !delta_storage) ? NULL : g_paste_item_ref_value_bytes (item);
+        gsize size = 0, prefix = 0, suffix = 0;
+        const gchar *value = (bytes) ? g_bytes_get_data (bytes, &size) : NULL;
+
+        if (!compressed && delta_storage && previous && !G_PASTE_IS_IMAGE_ITEM (item))
+            g_paste_history_get_delta (previous, value, size - 1, &prefix, &suffix);
+
+        xmlTextWriterStartElement (writer, BAD_CAST "item");
+        xmlTextWriterWriteAttribute (writer, BAD_CAST "kind", BAD_CAST g_paste_item_get_kind (item));
+        if (compressed)
+        {
+            g_paste_item_get_fingerprint (item, &size, NULL); /* hash */
+            xmlTextWriterWriteAttribute (writer, BAD_CAST "encoding", BAD_CAST "deflate");
+            xmlTextWriterWriteFormatAttribute (writer, BAD_CAST "length", "%" G_GSIZE_FORMAT, size);
+        }
+        else if (prefix || suffix)
+        {
+            xmlTextWriterWriteFormatAttribute (writer, BAD_CAST "prefix", "%" G_GSIZE_FORMAT, prefix);
+            xmlTextWriterWriteFormatAttribute (writer, BAD_CAST "suffix", "%" G_GSIZE_FORMAT, suffix);
+        }
+        if (G_PASTE_IS_IMAGE_ITEM (item))
+        {
+            GPasteImageItem *image = G_PASTE_IMAGE_ITEM (item);
+            const gchar *checksum = g_paste_image_item_get_checksum (image);
+            gsize file_size = g_paste_image_item_get_file_size (image);
+
+            xmlTextWriterWriteFormatAttribute (writer, BAD_CAST "date", "%ld",
+                                               g_date_time_to_unix ((GDateTime *) g_paste_image_item_get_date (image)));
+            /* Enough to load and dedup the image without ever opening it */
+            guint64 phash;
+
+            if (checksum)
+                xmlTextWriterWriteAttribute (writer, BAD_CAST "checksum", BAD_CAST checksum);
+            if (g_paste_image_item_get_phash (image, &phash))
+                xmlTextWriterWriteFormatAttribute (writer, BAD_CAST "phash", "%016" G_GINT64_MODIFIER "x", phash);
+            if (file_size)
+            {
+                xmlTextWriterWriteFormatAttribute (writer, BAD_CAST "width", "%d", g_paste_image_item_get_width (image));
+                xmlTextWriterWriteFormatAttribute (writer, BAD_CAST "height", "%d", g_paste_image_item_get_height (image));
+                xmlTextWriterWriteFormatAttribute (writer, BAD_CAST "size", "%" G_GSIZE_FORMAT, file_size);
+            }
+        }
+        if (compressed)
+        {
+            gsize compressed_size;
+            const gchar *data = g_bytes_get_data (compressed, &compressed_size);
+
+            xmlTextWriterWriteBase64 (writer, data, 0, compressed_size);
+        }
+        else
+        {
+            xmlTextWriterStartCDATA (writer);
+
+            gchar *data = g_paste_text_kernel_escape (value + prefix, size - 1 - prefix - suffix, NULL);
+            xmlTextWriterWriteString (writer, BAD_CAST data);
+            g_free (data);
+
+            xmlTextWriterEndCDATA (writer);
+        }
+        xmlTextWriterEndElement (writer);
+
+        if (previous)
+            g_bytes_unref (previous);
+        previous = bytes;
+    }
+
+    if (previous)
+        g_bytes_unref (previous);
+
+    for (GList *link = (segments) ? segments->head : NULL; link; link = g_list_next (link))
+    {
+        GPasteHistorySegment *segment = link->data;
+
+        if (!segment->file_name)
+            continue;
+
+        xmlTextWriterStartElement (writer, BAD_CAST "segment");
+        xmlTextWriterWriteAttribute (writer, BAD_CAST "file", BAD_CAST segment->file_name);
+        xmlTextWriterWriteFormatAttribute (writer, BAD_CAST "items", "%" G_GUINT32_FORMAT, segment->length);
+        /* Enough to tell whether an item copied again may be in there without reading it */
+        if (segment->hashes)
+        {
+            GString *hashes = g_string_sized_new (segment->hashes->len * 17);
+
+            for (guint i = 0; i < segment->hashes->len; ++i)
+                g_string_append_printf (hashes, "%s%016" G_GINT64_MODIFIER "x", (i) ? " " : "", g_array_index (segment->hashes, guint64, i));
+            xmlTextWriterWriteAttribute (writer, BAD_CAST "hashes", BAD_CAST hashes->str);
+            g_string_free (hashes, TRUE);
+        }
+        xmlTextWriterEndElement (writer);
+    }
+
+    xmlTextWriterEndElement (writer);
+
+    return g_paste_history_commit_writer (writer, buffer, path);
+}
+
+static guint32
+g_paste_history_load_segment (GPasteHistory        *self,
+                              GPasteHistorySegment *segment)
+{
+    GPasteHistoryPrivate *priv = self->priv;
+    gchar *path = g_build_filename (priv->segments_dir_path, segment->file_name, NULL);
+    GSList *last = g_slist_last (priv->history);
+    GSList *items = NULL;
+
+    segment->length = g_paste_history_read_file (self, path, G_MAXUINT32, &items, NULL); /* segments */
+    segment->loaded = TRUE;
+    priv->history = g_slist_concat (priv->history, g_slist_reverse (items));
+
+    if (g_paste_settings_get_delta_storage (priv->settings))
+        g_paste_history_pack ((last) ? last : priv->history);
+
+    g_free (path);
+
+    return segment->length;
+}
+
+/* Old segments are only read once something past the loaded items is asked for */
+static gboolean
+g_paste_history_ensure_loaded (GPasteHistory *self,
+                               guint32        pos)
+{
+    GPasteHistoryPrivate *priv = self->priv;
+    guint32 length = g_slist_length (priv->history);
+    gboolean loaded = FALSE;
+
+    for (GList *link = priv->segments.head; link && length <= pos; link = g_list_next (link))
+    {
+        GPasteHistorySegment *segment = link->data;
+
+        if (!segment->loaded)
+        {
+            length += g_paste_history_load_segment (self, segment);
+            loaded = TRUE;
+        }
+    }
+
+    if (loaded)
+        g_paste_history_compress_cold_items (self);
+
+    return pos < length;
+}
+
+/* Fifo mode and unsaved histories keep everything in memory */
+static void
+g_paste_history_unseal (GPasteHistory *self)
+{
+    GPasteHistoryPrivate *priv = self->priv;
+    GList *link;
+
+    if (!priv->segments.length)
+        return;
+
+    g_paste_history_ensure_loaded (self, G_MAXUINT32);
+    while ((link = priv->segments.head))
+        g_paste_history_drop_segment (self, link);
+    priv->head_length = g_slist_length (priv->history);
+}
+
+/* Once the manifest holds two segments worth of items, its oldest half becomes one */
+static void
+g_paste_history_seal (GPasteHistory *self)
+{
+    GPasteHistoryPrivate *priv = self->priv;
+
+    while (priv->head_length >= 2 * G_PASTE_HISTORY_SEGMENT_SIZE)
+    {
+        GPasteHistorySegment *segment = g_slice_new0 (GPasteHistorySegment);
+
+        segment->length = G_PASTE_HISTORY_SEGMENT_SIZE;
+        segment->loaded = TRUE;
+        segment->dirty = TRUE;
+        g_queue_push_head (&priv->segments, segment);
+        priv->head_length -= G_PASTE_HISTORY_SEGMENT_SIZE;
+    }
+}
+
+/* Segments are cut and concatenated without parsing their items */
+static guint32
+g_paste_history_copy_items (xmlTextWriterPtr writer,
+                            const gchar     *path,
+                            guint32          max_items)
+{
+    xmlTextReaderPtr reader = xmlNewTextReaderFilename (path);
+    guint32 copied = 0;
+
+    if (!reader)
+        return 0;
+
+    for (gint ret = xmlTextReaderRead (reader); ret == 1 && copied < max_items;)
+    {
+        if (xmlTextReaderNodeType (reader) == 1 && g_strcmp0 ((const gchar *) xmlTextReaderConstName (reader), "item") == 0)
+        {
+            gchar *item = (gchar *) xmlTextReaderReadOuterXml (reader);
+
+            if (item)
+            {
+                xmlTextWriterWriteRaw (writer, BAD_CAST item);
+                ++copied;
+            }
+            g_free (item);
+            ret = xmlTextReaderNext (reader);
+        }
+        else
+            ret = xmlTextReaderRead (reader);
+    }
+
+    xmlFreeTextReader (reader);
+
+    return copied;
+}
+
+static guint32
+g_paste_history_join_segments (const gchar  *path,
+                               gchar       **sources,
+                               guint32       max_items)
+{
+    xmlBufferPtr buffer;
+    xmlTextWriterPtr writer = g_paste_history_new_writer (&buffer);
+    guint32 copied = 0;
+
+    if (!writer)
+        return 0;
+
+    xmlTextWriterStartDocument (writer, "1.0", "UTF-8", NULL);
+    xmlTextWriterStartElement (writer, BAD_CAST "history");
+    xmlTextWriterWriteAttribute (writer, BAD_CAST "version", BAD_CAST G_PASTE_HISTORY_VERSION);
+
+    for (gchar **source = sources; *source && copied < max_items; ++source)
+        copied += g_paste_history_copy_items (writer, *source, max_items - copied);
+
+    xmlTextWriterEndElement (writer);
+
+    return (g_paste_history_commit_writer (writer, buffer, path)) ? copied : 0;
+}
+
+/* The newest items of a segment come first, keep those */
+static void
+g_paste_history_truncate_segment (GPasteHistory *self,
+                                  GList         *link,
+                                  guint32        length)
+{
+    GPasteHistoryPrivate *priv = self->priv;
+    GPasteHistorySegment *segment = link->data;
+    gchar *path = g_build_filename (priv->segments_dir_path, segment->file_name, NULL);
+    gchar *file_name = g_paste_history_new_segment_file_name ();
+    gchar *new_path = g_build_filename (priv->segments_dir_path, file_name, NULL);
+    gchar *sources[] = { path, NULL };
+
+    if (g_paste_history_join_segments (new_path, sources, length) == length)
+    {
+        priv->stale_segments = g_slist_prepend (priv->stale_segments, path);
+        g_free (segment->file_name);
+        segment->file_name = file_name;
+        segment->length = length;
+    }
+    else
+    {
+        /* Losing a few more old items beats keeping too many */
+        g_unlink (new_path);
+        g_free (file_name);
+        g_free (path);
+        g_paste_history_drop_segment (self, link);
+    }
+
+    g_free (new_path);
+}
+
+/* Drops the oldest items past max-history-size */
+static gboolean
+g_paste_history_trim (GPasteHistory *self)
+{
+    GPasteHistoryPrivate *priv = self->priv;
+    guint32 max_history_size = g_paste_settings_get_max_history_size (priv->settings);
+    guint32 length = g_slist_length (priv->history);
+    guint64 extra = length;
+    GList *link;
+
+    for (link = priv->segments.head; link; link = g_list_next (link))
+    {
+        GPasteHistorySegment *segment = link->data;
+
+        if (!segment->loaded)
+            extra += segment->length;
+    }
+
+    if (extra <= max_history_size)
+        return FALSE;
+    extra -= max_history_size;
+
+    /* The segments nobody looked into go without being read */
+    while (extra && (link = priv->segments.tail) && !((GPasteHistorySegment *) link->data)->loaded)
+    {
+        GPasteHistorySegment *segment = link->data;
+
+        if (segment->length > extra)
+        {
+            g_paste_history_truncate_segment (self, link, segment->length - extra);
+            extra = 0;
+        }
+        else
+        {
+            extra -= segment->length;
+            g_paste_history_drop_segment (self, link);
+        }
+    }
+
+    if (!extra)
+        return TRUE;
+
+    /* Everything left is loaded, fifo histories have no segments */
+    if (g_paste_settings_get_fifo (priv->settings))
+    {
+        GSList *previous = g_slist_nth (priv->history, extra - 1);
+        GSList *dropped = priv->history;
+
+        /* start the shortened list at the right place */
+        priv->history = previous->next;
+        /* terminate the original list so that it can be freed (below) */
+        previous->next = NULL;
+        g_slist_free_full (dropped,
+                           g_object_unref);
+    }
+    else
+    {
+        GSList *last = g_slist_nth (priv->history, length - extra - 1);
+
+        g_slist_free_full (last->next,
+                           g_object_unref);
+        last->next = NULL;
+    }
+
+    while (extra && (link = priv->segments.tail))
+    {
+        GPasteHistorySegment *segment = link->data;
+        guint32 dropped = MIN (segment->length, extra);
+
+        extra -= dropped;
+        if (dropped == segment->length)
+            g_paste_history_drop_segment (self, link);
+        else
+        {
+            segment->length -= dropped;
+            segment->dirty = TRUE;
+        }
+    }
+    priv->head_length -= extra;
+
+    return TRUE;
+}
+
+/* Only the segments which changed get written again, each to a new file */
+static void
+g_paste_history_save_segments (GPasteHistory *self)
+{
+    GPasteHistoryPrivate *priv = self->priv;
+    GSList *history = g_slist_nth (priv->history, priv->head_length);
+
+    for (GList *link = priv->segments.head; link; link = g_list_next (link))
+    {
+        GPasteHistorySegment *segment = link->data;
+
+        if (!segment->loaded)
+            break;
+
+        if (segment->dirty)
+        {
+            gchar *file_name = g_paste_history_new_segment_file_name ();
+            gchar *path = g_build_filename (priv->segments_dir_path, file_name, NULL);
+
+            g_mkdir_with_parents (priv->segments_dir_path, 0700);
+            if (g_paste_history_write_file (self, path, history, segment->length, NULL)) /* segments */
+            {
+                if (segment->file_name)
+                    priv->stale_segments = g_slist_prepend (priv->stale_segments, g_build_filename (priv->segments_dir_path, segment->file_name, NULL));
+                g_free (segment->file_name);
+                segment->file_name = file_name;
+                segment->dirty = FALSE;
+                g_paste_history_segment_set_hashes (segment, g_paste_history_get_hashes (history, segment->length));
+            }
+            else
+                g_free (file_name);
+
+            g_free (path);
+        }
+
+        history = g_slist_nth (history, segment->length);
+    }
+}
+
+/* Backups get their own copy of every segment */
+static GQueue *
+g_paste_history_export_segments (GPasteHistory *self,
+                                 const gchar   *segments_dir_path)
+{
+    GPasteHistoryPrivate *priv = self->priv;
+    GSList *history = g_slist_nth (priv->history, priv->head_length);
+    GQueue *segments = g_queue_new ();
+    GDir *dir = g_dir_open (segments_dir_path, 0, NULL); /* flags, error */
+
+    /* Whatever was saved under that name is replaced */
+    if (dir)
+    {
+        const gchar *name;
+
+        while ((name = g_dir_read_name (dir)))
+        {
+            gchar *path = g_build_filename (segments_dir_path, name, NULL);
+
+            g_unlink (path);
+            g_free (path);
+        }
+        g_dir_close (dir);
+    }
+
+    if (priv->segments.length)
+        g_mkdir_with_parents (segments_dir_path, 0700);
+
+    for (GList *link = priv->segments.head; link; link = g_list_next (link))
+    {
+        GPasteHistorySegment *segment = link->data;
+        GPasteHistorySegment *copy = g_slice_new0 (GPasteHistorySegment);
+
+        copy->length = segment->length;
+        if (segment->loaded)
+        {
+            copy->file_name = g_paste_history_new_segment_file_name ();
+
+            gchar *path = g_build_filename (segments_dir_path, copy->file_name, NULL);
+
+            g_paste_history_write_file (self, path, history, segment->length, NULL); /* segments */
+            copy->hashes = g_paste_history_get_hashes (history, segment->length);
+            history = g_slist_nth (history, segment->length);
+            g_free (path);
+        }
+        else if (segment->file_name)
+        {
+            copy->file_name = g_strdup (segment->file_name);
+            copy->hashes = (segment->hashes) ? g_array_ref (segment->hashes) : NULL;
+
+            gchar *source_path = g_build_filename (priv->segments_dir_path, segment->file_name, NULL);
+            gchar *target_path = g_build_filename (segments_dir_path, segment->file_name, NULL);
+            GFile *source = g_file_new_for_path (source_path);
+            GFile *target = g_file_new_for_path (target_path);
+
+            g_file_copy (source,
+                         target,
+                         G_FILE_COPY_OVERWRITE,
+                         NULL, /* cancellable */
+                         NULL, /* progress callback */
+                         NULL, /* progress callback data */
+                         NULL); /* error */
+
+            g_object_unref (target);
+            g_object_unref (source);
+            g_free (target_path);
+            g_free (source_path);
+        }
+        g_queue_push_tail (segments, copy);
+    }
+
+    return segments;
+}
+
+/* Called once the manifest doesn't reference them anymore */
+static void
+g_paste_history_flush_stale_segments (GPasteHistory *self)
+{
+    GPasteHistoryPrivate *priv = self->priv;
+
+    /* The collector may still be looking for images in there */
+    if (priv->gc_running)
+        return;
+
+    for (GSList *stale = priv->stale_segments; stale; stale = g_slist_next (stale))
+        g_unlink (stale->data);
+    g_slist_free_full (priv->stale_segments,
+                       g_free);
+    priv->stale_segments = NULL;
+
+    if (!priv->segments.length && priv->segments_dir_path)
+        g_rmdir (priv->segments_dir_path);
+}
+
+typedef struct
+{
+    GPasteHistory        *self;
+    GPasteHistorySegment *newer;
+    GPasteHistorySegment *older;
+    gchar                *segments_dir_path;
+    gchar                *names[2];
+    gchar                *sources[3];
+    gchar                *file_name;
+    gchar                *path;
+    guint32               length;
+} GPasteHistoryMergeJob;
+
+static gboolean
+g_paste_history_merge_done (gpointer user_data)
+{
+    GPasteHistoryMergeJob *job = user_data;
+    GPasteHistory *self = job->self;
+    GPasteHistoryPrivate *priv = self->priv;
+    GList *link = g_queue_find (&priv->segments, job->newer);
+
+    priv->merge_running = FALSE;
+
+    /* The history may have moved on in the meantime */
+    if (job->length && link && link->next && link->next->data == job->older &&
+        g_strcmp0 (job->segments_dir_path, priv->segments_dir_path) == 0 &&
+        !job->newer->loaded && g_strcmp0 (job->newer->file_name, job->names[0]) == 0 &&
+        !job->older->loaded && g_strcmp0 (job->older->file_name, job->names[1]) == 0)
+    {
+        priv->stale_segments = g_slist_prepend (priv->stale_segments, job->sources[0]);
+        job->sources[0] = NULL;
+        g_free (job->newer->file_name);
+        job->newer->file_name = job->file_name;
+        job->file_name = NULL;
+        job->newer->length = job->length;
+        if (job->newer->hashes && job->older->hashes)
+        {
+            GArray *hashes = g_paste_history_new_hashes ((const guint64 *) job->newer->hashes->data, job->newer->hashes->len);
+
+            g_paste_history_segment_set_hashes (job->newer, g_array_append_vals (hashes, job->older->hashes->data, job->older->hashes->len));
+        }
+        else
+            g_paste_history_segment_set_hashes (job->newer, NULL);
+        g_paste_history_drop_segment (self, link->next);
+
+        g_paste_history_save (self);
+    }
+    else
+        g_unlink (job->path);
+
+    g_object_unref (self);
+    g_free (job->path);
+    g_free (job->file_name);
+    g_free (job->sources[1]);
+    g_free (job->sources[0]);
+    g_free (job->names[1]);
+    g_free (job->names[0]);
+    g_free (job->segments_dir_path);
+    g_slice_free (GPasteHistoryMergeJob, job);
+
+    return FALSE;
+}
+
+static gpointer
+g_paste_history_merge_worker (gpointer data)
+{
+    GPasteHistoryMergeJob *job = data;
+
+    job->length = g_paste_history_join_segments (job->path, job->sources, G_MAXUINT32);
+    g_idle_add (g_paste_history_merge_done, job);
+
+    return NULL;
+}
+
+/* Merge two neighbour segments which would fit in one */
+static gboolean
+g_paste_history_merge_segments (gpointer user_data)
+{
+    GPasteHistory *self = user_data;
+    GPasteHistoryPrivate *priv = self->priv;
+
+    priv->merge_source = 0;
+
+    for (GList *link = priv->segments.head; link && link->next; link = g_list_next (link))
+    {
+        GPasteHistorySegment *newer = link->data;
+        GPasteHistorySegment *older = link->next->data;
+
+        if (newer->length + older->length > G_PASTE_HISTORY_SEGMENT_SIZE)
+            continue;
+
+        if (newer->loaded)
+        {
+            /* Then older is the first one not loaded, if any, and small */
+            if (!older->loaded)
+                g_paste_history_load_segment (self, older);
+            newer->length += older->length;
+            newer->dirty = TRUE;
+            g_paste_history_drop_segment (self, link->next);
+
+            g_paste_history_save (self);
+        }
+        else if (newer->file_name && older->file_name)
+        {
+            GPasteHistoryMergeJob *job = g_slice_new0 (GPasteHistoryMergeJob);
+
+            job->self = g_object_ref (self);
+            job->newer = newer;
+            job->older = older;
+            job->segments_dir_path = g_strdup (priv->segments_dir_path);
+            job->names[0] = g_strdup (newer->file_name);
+            job->names[1] = g_strdup (older->file_name);
+            job->sources[0] = g_build_filename (priv->segments_dir_path, newer->file_name, NULL);
+            job->sources[1] = g_build_filename (priv->segments_dir_path, older->file_name, NULL);
+            job->file_name = g_paste_history_new_segment_file_name ();
+            job->path = g_build_filename (priv->segments_dir_path, job->file_name, NULL);
+
+            priv->merge_running = TRUE;
+            g_thread_unref (g_thread_new ("gpaste-merge", g_paste_history_merge_worker, job));
+        }
+        else
+            continue;
+
+        break;
+    }
 
-    gulong          changed_signal;
-};
+    return FALSE;
+}
 
-enum
+static void
+g_paste_history_schedule_merge (GPasteHistory *self)
 {
-    CHANGED,
-    SELECTED,
+    GPasteHistoryPrivate *priv = self->priv;
 
-    LAST_SIGNAL
-};
+    if (!priv->merge_source && !priv->merge_running && priv->segments.length > 1)
+        priv->merge_source = g_idle_add_full (G_PRIORITY_LOW, g_paste_history_merge_segments, self, NULL); /* notify */
+}
 
-static guint signals[LAST_SIGNAL] = { 0 };
+static gboolean
+g_paste_history_hashes_contain (GArray  *hashes,
+                                guint64  hash)
+{
+    for (guint i = 0; i < hashes->len; ++i)
+    {
+        if (g_array_index (hashes, guint64, i) == hash)
+            return TRUE;
+    }
 
-static GSList *
-_g_paste_history_remove (GPasteHistory *self,
-                         GSList        *elem,
-                         gboolean       remove_leftovers)
+    return FALSE;
+}
+
+/* Only reads the segments which may hold a copy of @item, according to their hashes */
+static gboolean
+g_paste_history_remove_segment_duplicate (GPasteHistory *self,
+                                          GPasteItem    *item)
 {
-    GPasteItem *item = elem->data;
+    GPasteHistoryPrivate *priv = self->priv;
+    guint32 start = priv->head_length;
+    guint64 hash;
 
-    if (remove_leftovers && G_PASTE_IS_IMAGE_ITEM (item))
+    g_paste_item_get_fingerprint (item, NULL, &hash); /* size */
+
+    for (GList *link = priv->segments.head; link; link = g_list_next (link))
     {
-        GFile *image = g_file_new_for_path (g_paste_item_get_value (item));
-        g_file_delete (image,
-                       NULL, /* cancellable */
-                       NULL); /* error */
-        g_object_unref (image);
+        GPasteHistorySegment *segment = link->data;
+
+        if (!segment->loaded && segment->hashes && g_paste_history_hashes_contain (segment->hashes, hash))
+        {
+            if (!g_paste_history_ensure_loaded (self, start))
+                return FALSE;
+
+            GSList *history = g_slist_nth (priv->history, start);
+
+            for (guint32 i = 0; history && i < segment->length; history = g_slist_next (history), ++i)
+            {
+                if (g_paste_item_equals (history->data, item))
+                {
+                    priv->history = _g_paste_history_remove (self, history, FALSE);
+                    return TRUE;
+                }
+            }
+        }
+
+        start += segment->length;
     }
 
-    g_object_unref (item);
-    return g_slist_delete_link (self->priv->history,
-                                elem);
+    return FALSE;
 }
 
 /**
@@ -87,6 +1857,7 @@ g_paste_history_add (GPasteHistory *self,
 
     GPasteHistoryPrivate *priv = self->priv;
     GSList *history = priv->history;
+    gboolean moved = FALSE;
 
     if (history)
     {
@@ -97,43 +1868,73 @@ g_paste_history_add (GPasteHistory *self,
             if (g_paste_item_equals (history->data, item))
             {
                 priv->history = _g_paste_history_remove (self, history, FALSE);
+                moved = TRUE;
                 break;
             }
         }
+        if (!moved)
+            moved = g_paste_history_remove_segment_duplicate (self, item);
+    }
+    if (G_PASTE_IS_IMAGE_ITEM (item) && !g_paste_image_item_is_persisted (G_PASTE_IMAGE_ITEM (item)))
+    {
+        g_signal_connect_object (item,
+                                 "persisted",
+                                 G_CALLBACK (g_paste_history_image_persisted),
+                                 self,
+                                 0); /* flags */
+        g_signal_connect_object (item,
+                                 "persist-failed",
+                                 G_CALLBACK (g_paste_history_image_persist_failed),
+                                 self,
+                                 0); /* flags */
     }
+    else if (G_PASTE_IS_IMAGE_ITEM (item))
+        g_paste_history_remove_near_duplicates (self, G_PASTE_IMAGE_ITEM (item));
+
     gboolean fifo = g_paste_settings_get_fifo (priv->settings);
+
+    if (fifo)
+        g_paste_history_unseal (self);
+
+    if (priv->history && g_paste_settings_get_delta_storage (priv->settings))
+    {
+        GPasteItem *previous = (fifo) ? g_slist_last (priv->history)->data : priv->history->data;
+
+        if (G_PASTE_IS_TEXT_ITEM (item) && G_PASTE_IS_TEXT_ITEM (previous))
+            g_paste_item_set_delta_base (item, previous);
+    }
+
     history = priv->history = fifo ?
         g_slist_append (priv->history, g_object_ref (item)) :
         g_slist_prepend (priv->history, g_object_ref (item));
+    ++priv->head_length;
 
     GSList *next = history->next;
 
     if (next)
+    {
         g_paste_item_set_state (next->data, G_PASTE_ITEM_STATE_IDLE);
+        /* Going back to the previous item is the most likely next selection */
+        if (G_PASTE_IS_IMAGE_ITEM (next->data))
+            g_paste_image_item_prefetch (next->data);
+    }
     g_paste_item_set_state (item, G_PASTE_ITEM_STATE_ACTIVE);
 
-    guint32 max_history_size = g_paste_settings_get_max_history_size (priv->settings);
+    if (g_paste_history_trim (self))
+        g_paste_history_schedule_gc (self);
+    if (!fifo)
+        g_paste_history_seal (self);
+
+    g_paste_history_compress_cold_items (self);
 
-    if (g_slist_length (history) > max_history_size)
+    /* Selecting an older item only moves it back on top */
+    if (!moved)
     {
-        if (fifo)
-        {
-            GSList *previous = g_slist_nth(history, g_slist_length(history) - max_history_size - 1);
-            /* start the shortened list at the right place */
-            priv->history = previous->next;
-            /* terminate the original list so that it can be freed (below) */
-            previous->next = NULL;
-        }
-        else
-        {
-            for (guint32 i = 0; i < max_history_size - 1; ++i)
-                history = g_slist_next (history);
-        }
-        g_slist_free_full (g_slist_next (history),
-                           g_object_unref);
-        history->next = NULL;
+        g_signal_emit (self,
+                       signals[ADDED],
+                       0, /* detail */
+                       item);
     }
-
     g_signal_emit (self,
                    signals[CHANGED],
                    0); /* detail */
@@ -158,9 +1959,11 @@ g_paste_history_remove (GPasteHistory *self,
     g_return_if_fail (G_PASTE_IS_HISTORY (self));
 
     GPasteHistoryPrivate *priv = self->priv;
-    GSList *history = priv->history;
+    gboolean in_range = g_paste_history_ensure_loaded (self, pos);
+
+    g_return_if_fail (in_range);
 
-    g_return_if_fail (pos < g_slist_length (history));
+    GSList *history = priv->history;
 
     for (guint32 i = 0; i < pos; ++i)
         history = g_slist_next (history);
@@ -180,11 +1983,11 @@ _g_paste_history_get (GPasteHistory *self,
 {
     g_return_val_if_fail (G_PASTE_IS_HISTORY (self), NULL);
 
-    GSList *history = self->priv->history;
+    gboolean in_range = g_paste_history_ensure_loaded (self, pos);
 
-    g_return_val_if_fail (pos < g_slist_length (history), NULL);
+    g_return_val_if_fail (in_range, NULL);
 
-    return G_PASTE_ITEM (g_slist_nth_data (history, pos));
+    return G_PASTE_ITEM (g_slist_nth_data (self->priv->history, pos));
 }
 
 /**
@@ -203,312 +2006,781 @@ g_paste_history_get (GPasteHistory *self,
     return _g_paste_history_get (self, pos);
 }
 
-/**
- * g_paste_history_get_value:
- * @self: a #GPasteHistory instance
- * @index: the index of the #GPasteItem
- *
- * Get the value of a #GPasteItem from the #GPasteHistory
- *
- * Returns: the read-only value of the #GPasteItem
- */
-G_PASTE_VISIBLE const gchar *
-g_paste_history_get_value (GPasteHistory *self,
-                           guint32        pos)
-{
-    GPasteItem *item = _g_paste_history_get (self, pos);
+/**
+ * g_paste_history_get_value:
+ * @self: a #GPasteHistory instance
+ * @index: the index of the #GPasteItem
+ *
+ * Get the value of a #GPasteItem from the #GPasteHistory
+ *
+ * Returns: the read-only value of the #GPasteItem
+ */
+G_PASTE_VISIBLE const gchar *
+g_paste_history_get_value (GPasteHistory *self,
+                           guint32        pos)
+{
+    GPasteItem *item = _g_paste_history_get (self, pos);
+
+    g_return_val_if_fail (item != NULL, NULL);
+
+    return g_paste_item_get_value (item);
+}
+
+/**
+ * g_paste_history_select:
+ * @self: a #GPasteHistory instance
+ * @index: the index of the #GPasteItem to select
+ *
+ * Select a #GPasteItem from the #GPasteHistory
+ *
+ * Returns:
+ */
+G_PASTE_VISIBLE void
+g_paste_history_select (GPasteHistory *self,
+                        guint32        pos)
+{
+    g_return_if_fail (G_PASTE_IS_HISTORY (self));
+
+    gboolean in_range = g_paste_history_ensure_loaded (self, pos);
+
+    g_return_if_fail (in_range);
+
+    g_signal_emit (self,
+                   signals[SELECTED],
+                   0, /* detail */
+                   g_slist_nth_data (self->priv->history, pos));
+}
+
+/**
+ * g_paste_history_empty:
+ * @self: a #GPasteHistory instance
+ *
+ * Empty the #GPasteHistory
+ *
+ * Returns:
+ */
+G_PASTE_VISIBLE void
+g_paste_history_empty (GPasteHistory *self)
+{
+    g_return_if_fail (G_PASTE_IS_HISTORY (self));
+
+    GPasteHistoryPrivate *priv = self->priv;
+    GList *link;
+
+    g_paste_history_cancel_load (self);
+    g_slist_free_full (priv->history,
+                       g_object_unref);
+    priv->history = NULL;
+    priv->head_length = 0;
+    while ((link = priv->segments.head))
+        g_paste_history_drop_segment (self, link);
+    priv->save_pending = FALSE;
+
+    g_signal_emit (self,
+                   signals[CHANGED],
+                   0); /* detail */
+
+    g_paste_history_schedule_gc (self);
+}
+
+/**
+ * g_paste_history_save:
+ * @self: a #GPasteHistory instance
+ *
+ * Save the #GPasteHistory to the history file
+ *
+ * Returns:
+ */
+G_PASTE_VISIBLE void
+g_paste_history_save (GPasteHistory *self)
+{
+    g_return_if_fail (G_PASTE_IS_HISTORY (self));
+
+    GPasteHistoryPrivate *priv = self->priv;
+
+    /* Don't reference image files that aren't on disk yet, nor overwrite the file being read */
+    if (priv->loading || g_paste_history_has_pending_images (self))
+    {
+        priv->save_pending = TRUE;
+        return;
+    }
+
+    gboolean save_history = g_paste_settings_get_save_history (priv->settings);
+    gchar *history_dir_path = g_build_filename (g_get_user_data_dir (), "gpaste", NULL);
+    GFile *history_dir = g_file_new_for_path (history_dir_path);
+    GError *error = NULL;
+
+    if (!g_file_query_exists (history_dir,
+                              NULL)) /* cancellable */
+    {
+        if (!save_history)
+            goto out;
+        g_file_make_directory_with_parents (history_dir,
+                                            NULL, /* cancellable */
+                                            &error);
+        if (error != NULL)
+        {
+            g_error (_("Could not create history dir"));
+            g_error_free (error);
+            goto out;
+        }
+    }
+
+    const gchar *name = g_paste_settings_get_history_name (priv->settings);
+    gchar *history_file_name = g_strconcat (name, ".xml", NULL);
+    gchar *history_file_path = g_build_filename (history_dir_path, history_file_name, NULL);
+    gchar *segments_dir_path = g_paste_history_get_segments_dir_path (name);
+    GFile *history_file = g_file_new_for_path (history_file_path);
+
+    if (!save_history)
+    {
+        g_paste_history_unseal (self);
+        g_paste_history_flush_stale_segments (self);
+        g_file_delete (history_file,
+                       NULL, /* cancellable*/
+                       NULL); /* error */
+    }
+    else
+    {
+        LIBXML_TEST_VERSION
+
+        /* Saved under another name, as a backup */
+        if (priv->segments_dir_path && g_strcmp0 (segments_dir_path, priv->segments_dir_path) != 0)
+        {
+            GQueue *segments = g_paste_history_export_segments (self, segments_dir_path);
+
+            g_paste_history_write_file (self, history_file_path, priv->history, priv->head_length, segments);
+            g_queue_free_full (segments,
+                               (GDestroyNotify) g_paste_history_segment_free);
+        }
+        else
+        {
+            g_paste_history_save_segments (self);
+            /* The old manifest still points at the stale segments until the new one is in place */
+            if (g_paste_history_write_file (self, history_file_path, priv->history, priv->head_length, &priv->segments))
+            {
+                g_paste_history_flush_stale_segments (self);
+                g_paste_history_schedule_merge (self);
+            }
+        }
+    }
+
+    g_object_unref (history_file);
+    g_free (segments_dir_path);
+    g_free (history_file_path);
+    g_free (history_file_name);
+out:
+    g_object_unref (history_dir);
+    g_free (history_dir_path);
+}
+
+static void
+g_paste_history_reset (GPasteHistory *self)
+{
+    GPasteHistoryPrivate *priv = self->priv;
+
+    g_paste_history_cancel_load (self);
+    g_slist_free_full (priv->history,
+                       g_object_unref);
+    priv->history = NULL;
+    priv->head_length = 0;
+    g_queue_foreach (&priv->segments, (GFunc) g_paste_history_segment_free, NULL); /* user data */
+    g_queue_clear (&priv->segments);
+    g_free (priv->segments_dir_path);
+    priv->segments_dir_path = g_paste_history_get_segments_dir_path (g_paste_settings_get_history_name (priv->settings));
+}
+
+static gchar *
+g_paste_history_get_file_path (GPasteHistory *self)
+{
+    gchar *history_file_name = g_strconcat (g_paste_settings_get_history_name (self->priv->settings), ".xml", NULL);
+    gchar *history_file_path = g_build_filename (g_get_user_data_dir (), "gpaste", history_file_name, NULL);
+
+    g_free (history_file_name);
+
+    return history_file_path;
+}
+
+/* Puts the @items and @segments read from the manifest behind the items added since the reset */
+static void
+g_paste_history_finish_load (GPasteHistory *self,
+                             GSList        *items,
+                             GQueue        *segments,
+                             gboolean       found)
+{
+    GPasteHistoryPrivate *priv = self->priv;
+    GPasteSettings *settings = priv->settings;
+    gboolean fifo = g_paste_settings_get_fifo (settings);
+    GSList *added = priv->history;
+
+    /* Copied again while we were reading, the new one stays */
+    for (GSList *history = added; history; history = g_slist_next (history))
+    {
+        for (GSList *loaded = items; loaded; loaded = g_slist_next (loaded))
+        {
+            if (g_paste_item_equals (loaded->data, history->data))
+            {
+                g_object_unref (loaded->data);
+                items = g_slist_delete_link (items, loaded);
+                break;
+            }
+        }
+    }
+
+    items = g_slist_reverse (items);
+    if (found && g_paste_settings_get_delta_storage (settings))
+        g_paste_history_pack (items);
+
+    guint32 length = g_slist_length (items);
+
+    priv->history = (fifo) ? g_slist_concat (items, added) : g_slist_concat (added, items);
+
+    /* Sealed while we were reading, what we read comes right after */
+    if (priv->segments.length && length)
+    {
+        GPasteHistorySegment *segment = g_slice_new0 (GPasteHistorySegment);
+
+        segment->length = length;
+        segment->loaded = TRUE;
+        segment->dirty = TRUE;
+        g_queue_push_tail (&priv->segments, segment);
+    }
+    else
+        priv->head_length += length;
+
+    for (GPasteHistorySegment *segment; (segment = g_queue_pop_head (segments));)
+        g_queue_push_tail (&priv->segments, segment);
+
+    if (found)
+    {
+        if (fifo)
+            g_paste_history_unseal (self);
+        else
+            g_paste_history_seal (self);
+        g_paste_history_trim (self);
+        for (GSList *history = added; history && priv->segments.length; history = g_slist_next (history))
+            g_paste_history_remove_segment_duplicate (self, history->data);
+        g_paste_history_ensure_loaded (self, g_paste_settings_get_max_displayed_history_size (settings) - 1);
+        g_paste_history_compress_cold_items (self);
+    }
+    else
+    {
+        /* Create the empty file to be listed as an available history */
+        g_paste_history_save (self);
+    }
+
+    /* Otherwise the newest one added is already active */
+    if (priv->history && !added)
+    {
+        GPasteItem *first = priv->history->data;
 
-    g_return_val_if_fail (item != NULL, NULL);
+        g_paste_item_set_state (first, G_PASTE_ITEM_STATE_ACTIVE);
+        if (G_PASTE_IS_IMAGE_ITEM (first))
+            g_paste_image_item_prefetch (G_PASTE_IMAGE_ITEM (first));
+    }
 
-    return g_paste_item_get_value (item);
+    g_paste_history_schedule_gc (self);
+    g_paste_history_schedule_merge (self);
 }
 
 /**
- * g_paste_history_select:
+ * g_paste_history_load:
  * @self: a #GPasteHistory instance
- * @index: the index of the #GPasteItem to select
  *
- * Select a #GPasteItem from the #GPasteHistory
+ * Load the #GPasteHistory from the history file
  *
  * Returns:
  */
 G_PASTE_VISIBLE void
-g_paste_history_select (GPasteHistory *self,
-                        guint32        pos)
+g_paste_history_load (GPasteHistory *self)
 {
     g_return_if_fail (G_PASTE_IS_HISTORY (self));
 
-    GSList *history = self->priv->history;
+    gchar *history_file_path = g_paste_history_get_file_path (self);
+    gboolean found = g_file_test (history_file_path, G_FILE_TEST_EXISTS);
+    GQueue segments = G_QUEUE_INIT;
+    GSList *items = NULL;
 
-    g_return_if_fail (pos < g_slist_length (history));
+    g_paste_history_reset (self);
 
-    g_signal_emit (self,
-                   signals[SELECTED],
-                   0, /* detail */
-                   g_slist_nth_data (history, pos));
+    if (found)
+    {
+        LIBXML_TEST_VERSION
+
+        /* Only the manifest is read, segments wait until they're looked into */
+        g_paste_history_read_file (self,
+                                   history_file_path,
+                                   g_paste_settings_get_max_history_size (self->priv->settings),
+                                   &items,
+                                   &segments);
+    }
+
+    g_paste_history_finish_load (self, items, &segments, found);
+
+    g_free (history_file_path);
 }
 
-/**
- * g_paste_history_empty:
- * @self: a #GPasteHistory instance
- *
- * Empty the #GPasteHistory
- *
- * Returns:
- */
-G_PASTE_VISIBLE void
-g_paste_history_empty (GPasteHistory *self)
+typedef struct
 {
-    g_return_if_fail (G_PASTE_IS_HISTORY (self));
+    GPasteHistory *self;
+    gchar         *path;
+    guint32        max_items;
+    guint          serial;
+    gboolean       found;
+    GSList        *items;
+    GQueue         segments;
+} GPasteHistoryLoadJob;
 
+static gboolean
+g_paste_history_load_done (gpointer user_data)
+{
+    GPasteHistoryLoadJob *job = user_data;
+    GPasteHistory *self = job->self;
     GPasteHistoryPrivate *priv = self->priv;
 
-    g_slist_free_full (priv->history,
-                       g_object_unref);
-    priv->history = NULL;
+    /* Emptied, switched or adopted another state in the meantime otherwise */
+    if (priv->loading && job->serial == priv->load_serial)
+    {
+        priv->loading = FALSE;
+        g_paste_history_finish_load (self, job->items, &job->segments, job->found);
 
-    g_signal_emit (self,
-                   signals[CHANGED],
-                   0); /* detail */
-}
+        if (priv->save_pending)
+        {
+            priv->save_pending = FALSE;
+            g_paste_history_save (self);
+        }
 
-static gchar *
-g_paste_history_replace (const gchar *text,
-                         const gchar *pattern,
-                         const gchar *substitution)
-{
-    gchar *regex_string = g_regex_escape_string (pattern, -1);
-    GRegex *regex = g_regex_new (regex_string,
-                                 0, /* Compile options */
-                                 0, /* Match options */
-                                 NULL); /* Error */
-    gchar *encoded_text = g_regex_replace_literal (regex,
-                                                   text,
-                                                   (gssize) -1,
-                                                   0, /* Start position */
-                                                   substitution,
-                                                   0, /* Match options */
-                                                   NULL); /* Error */
-    g_regex_unref (regex);
-    g_free (regex_string);
-
-    return encoded_text;
-}
+        if (priv->gc_pending)
+        {
+            priv->gc_pending = FALSE;
+            g_paste_history_collect_garbage (self);
+        }
 
-static gchar *
-g_paste_history_encode (const gchar *text)
-{
-    gchar *_encoded_text = g_paste_history_replace (text, "&", "&amp;");
-    gchar *encoded_text = g_paste_history_replace (_encoded_text, ">", "&gt;");
+        g_signal_emit (self,
+                       signals[CHANGED],
+                       0); /* detail */
+    }
+    else
+    {
+        g_slist_free_full (job->items,
+                           g_object_unref);
+        g_queue_foreach (&job->segments, (GFunc) g_paste_history_segment_free, NULL); /* user data */
+        g_queue_clear (&job->segments);
+    }
+
+    /* A newer one will tell */
+    if (!priv->loading)
+    {
+        g_signal_emit (self,
+                       signals[LOADED],
+                       0); /* detail */
+        g_paste_history_send_state (self);
+    }
 
-    g_free (_encoded_text);
+    g_object_unref (self);
+    g_free (job->path);
+    g_slice_free (GPasteHistoryLoadJob, job);
 
-    return encoded_text;
+    return FALSE;
 }
 
-static gchar *
-g_paste_history_decode (const gchar *text)
+static gpointer
+g_paste_history_load_worker (gpointer data)
 {
-    gchar *_decoded_text = g_paste_history_replace (text, "&gt;", ">");
-    gchar *decoded_text = g_paste_history_replace (_decoded_text, "&amp;", "&");
+    GPasteHistoryLoadJob *job = data;
+
+    job->found = g_file_test (job->path, G_FILE_TEST_EXISTS);
+    if (job->found)
+        g_paste_history_read_file (job->self, job->path, job->max_items, &job->items, &job->segments);
 
-    g_free (_decoded_text);
+    g_idle_add (g_paste_history_load_done, job);
 
-    return decoded_text;
+    return NULL;
 }
 
 /**
- * g_paste_history_save:
+ * g_paste_history_load_in_background:
  * @self: a #GPasteHistory instance
  *
- * Save the #GPasteHistory to the history file
+ * Load the #GPasteHistory from the history file in a thread, "loaded"
+ * is emitted once it's over. Until then, the history only holds the
+ * items added in the meantime, which stay in front of the loaded ones
  *
  * Returns:
  */
 G_PASTE_VISIBLE void
-g_paste_history_save (GPasteHistory *self)
+g_paste_history_load_in_background (GPasteHistory *self)
 {
     g_return_if_fail (G_PASTE_IS_HISTORY (self));
 
     GPasteHistoryPrivate *priv = self->priv;
+    GPasteHistoryLoadJob *job = g_slice_new0 (GPasteHistoryLoadJob);
 
-    gboolean save_history = g_paste_settings_get_save_history (priv->settings);
-    gchar *history_dir_path = g_build_filename (g_get_user_data_dir (), "gpaste", NULL);
-    GFile *history_dir = g_file_new_for_path (history_dir_path);
-    GError *error = NULL;
+    g_paste_history_reset (self);
 
-    if (!g_file_query_exists (history_dir,
-                              NULL)) /* cancellable */
+    /* Initializes the parser, which has to happen before any thread uses it */
+    LIBXML_TEST_VERSION
+
+    job->self = g_object_ref (self);
+    job->path = g_paste_history_get_file_path (self);
+    job->max_items = g_paste_settings_get_max_history_size (priv->settings);
+    job->serial = priv->load_serial;
+    g_queue_init (&job->segments);
+
+    priv->loading = TRUE;
+    g_thread_unref (g_thread_new ("gpaste-load", g_paste_history_load_worker, job));
+}
+
+/* Only once neither the history nor an image is still being read or written */
+static GVariant *
+g_paste_history_get_state (GPasteHistory *self)
+{
+    GPasteHistoryPrivate *priv = self->priv;
+
+    /* Whatever the next process does, the files match what it gets */
+    g_paste_history_save (self);
+
+    GVariantBuilder segments, stale, items;
+
+    g_variant_builder_init (&segments, G_VARIANT_TYPE ("a(subat)"));
+    for (GList *link = priv->segments.head; link; link = g_list_next (link))
     {
-        if (!save_history)
-            goto out;
-        g_file_make_directory_with_parents (history_dir,
-                                            NULL, /* cancellable */
-                                            &error);
-        if (error != NULL)
+        GPasteHistorySegment *segment = link->data;
+        GArray *hashes = segment->hashes;
+
+        if (segment->file_name)
         {
-            g_error (_("Could not create history dir"));
-            g_error_free (error);
-            goto out;
+            g_variant_builder_add (&segments, "(sub@at)", segment->file_name, segment->length, segment->loaded,
+                                   g_variant_new_fixed_array (G_VARIANT_TYPE_UINT64,
+                                                              (hashes) ? hashes->data : NULL,
+                                                              (hashes) ? hashes->len : 0,
+                                                              sizeof (guint64)));
         }
     }
 
-    gchar *history_file_name = g_strconcat (g_paste_settings_get_history_name (priv->settings), ".xml", NULL);
-    gchar *history_file_path = g_build_filename (history_dir_path, history_file_name, NULL);
-    GFile *history_file = g_file_new_for_path (history_file_path);
+    g_variant_builder_init (&stale, G_VARIANT_TYPE_STRING_ARRAY);
+    for (GSList *path = priv->stale_segments; path; path = g_slist_next (path))
+        g_variant_builder_add (&stale, "s", path->data);
 
-    if (!save_history)
-        g_file_delete (history_file,
-                       NULL, /* cancellable*/
-                       NULL); /* error */
-    else
+    g_variant_builder_init (&items, G_VARIANT_TYPE ("a(saya{sv})"));
+    for (GSList *history = priv->history; history; history = g_slist_next (history))
     {
-        LIBXML_TEST_VERSION
+        GPasteItem *item = history->data;
+        GBytes *compressed = g_paste_item_get_compressed (item);
+        /* Compressed items are handed over as is */
+        GBytes *bytes = (compressed) ? g_bytes_ref (compressed) : g_paste_item_ref_value_bytes (item);
+        GVariantBuilder meta;
+
+        g_variant_builder_init (&meta, G_VARIANT_TYPE_VARDICT);
+        if (compressed)
+        {
+            gsize length;
 
-        xmlTextWriterPtr writer = xmlNewTextWriterFilename (history_file_path, 0);
+            g_paste_item_get_fingerprint (item, &length, NULL); /* hash */
+            g_variant_builder_add (&meta, "{sv}", "length", g_variant_new_uint64 (length));
+        }
+        if (G_PASTE_IS_IMAGE_ITEM (item))
+        {
+            GPasteImageItem *image = G_PASTE_IMAGE_ITEM (item);
+            const gchar *checksum = g_paste_image_item_get_checksum (image);
+            gsize file_size = g_paste_image_item_get_file_size (image);
+            guint64 phash;
+
+            g_variant_builder_add (&meta, "{sv}", "date",
+                                   g_variant_new_int64 (g_date_time_to_unix ((GDateTime *) g_paste_image_item_get_date (image))));
+            if (checksum)
+                g_variant_builder_add (&meta, "{sv}", "checksum", g_variant_new_string (checksum));
+            if (g_paste_image_item_get_phash (image, &phash))
+                g_variant_builder_add (&meta, "{sv}", "phash", g_variant_new_uint64 (phash));
+            if (file_size)
+            {
+                g_variant_builder_add (&meta, "{sv}", "width", g_variant_new_int32 (g_paste_image_item_get_width (image)));
+                g_variant_builder_add (&meta, "{sv}", "height", g_variant_new_int32 (g_paste_image_item_get_height (image)));
+                g_variant_builder_add (&meta, "{sv}", "size", g_variant_new_uint64 (file_size));
+            }
+        }
 
-        xmlTextWriterSetIndent (writer, TRUE);
-        xmlTextWriterSetIndentString (writer, BAD_CAST "  ");
+        g_variant_builder_add (&items, "(s@ay@a{sv})",
+                               g_paste_item_get_kind (item),
+                               g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE,
+                                                          g_bytes_get_data (bytes, NULL),
+                                                          g_bytes_get_size (bytes),
+                                                          1), /* element size */
+                               g_variant_builder_end (&meta));
+        g_bytes_unref (bytes);
+    }
 
-        xmlTextWriterStartDocument (writer, "1.0", "UTF-8", NULL);
-        xmlTextWriterStartElement (writer, BAD_CAST "history");
-        xmlTextWriterWriteAttribute (writer, BAD_CAST "version", BAD_CAST "1.0");
+    return g_variant_new (G_PASTE_HISTORY_STATE_TYPE,
+                          g_paste_settings_get_history_name (priv->settings),
+                          priv->head_length,
+                          &segments,
+                          &stale,
+                          &items);
+}
 
-        for (GSList *history = priv->history; history; history = g_slist_next (history))
-        {
-            GPasteItem *item = history->data;
+/* The threads writing images or reading the history won't survive the process we hand over to */
+static void
+g_paste_history_send_state (GPasteHistory *self)
+{
+    GPasteHistoryPrivate *priv = self->priv;
+    GPasteHistoryStateFunc func = priv->state_func;
 
-            xmlTextWriterStartElement (writer, BAD_CAST "item");
-            xmlTextWriterWriteAttribute (writer, BAD_CAST "kind", BAD_CAST g_paste_item_get_kind (item));
-            if (G_PASTE_IS_IMAGE_ITEM (item))
-                xmlTextWriterWriteFormatAttribute (writer, BAD_CAST "date", "%ld",
-                                                   g_date_time_to_unix ((GDateTime *) g_paste_image_item_get_date (G_PASTE_IMAGE_ITEM (item))));
-            xmlTextWriterStartCDATA (writer);
+    if (!func || priv->loading || g_paste_history_has_pending_images (self))
+        return;
 
-            gchar *data = g_paste_history_encode (g_paste_item_get_value (item));
-            xmlTextWriterWriteString (writer, BAD_CAST data);
-            g_free (data);
+    priv->state_func = NULL;
 
-            xmlTextWriterEndCDATA (writer);
-            xmlTextWriterEndElement (writer);
-        }
+    GVariant *state = g_variant_ref_sink (g_paste_history_get_state (self));
 
-        xmlTextWriterEndElement (writer);
-        xmlTextWriterEndDocument (writer);
+    func (self, state, priv->state_data);
+    g_variant_unref (state);
+}
+
+/**
+ * g_paste_history_request_state:
+ * @self: a #GPasteHistory instance
+ * @func: (scope async): called with the state once nothing is being read nor written anymore
+ * @user_data: data to pass to @func
+ *
+ * Save the #GPasteHistory, then describe its loaded items and its segments
+ * so that another process can adopt them with g_paste_history_adopt_state()
+ * without reading the history file again.
+ * @func may be called before this returns, the state is a #GVariant of type
+ * %G_PASTE_HISTORY_STATE_TYPE.
+ *
+ * Returns: %FALSE if the state was already requested and @func won't be called
+ */
+G_PASTE_VISIBLE gboolean
+g_paste_history_request_state (GPasteHistory          *self,
+                               GPasteHistoryStateFunc  func,
+                               gpointer                user_data)
+{
+    g_return_val_if_fail (G_PASTE_IS_HISTORY (self), FALSE);
+    g_return_val_if_fail (func, FALSE);
 
-        xmlTextWriterFlush (writer);
-        xmlFreeTextWriter (writer);
+    GPasteHistoryPrivate *priv = self->priv;
+
+    if (priv->state_func)
+        return FALSE;
+
+    priv->state_func = func;
+    priv->state_data = user_data;
+    g_paste_history_send_state (self);
+
+    return TRUE;
+}
+
+static GPasteItem *
+g_paste_history_adopt_item (GPasteHistory *self,
+                            const gchar   *kind,
+                            GVariant      *value,
+                            GVariant      *meta)
+{
+    gsize size;
+    gconstpointer data = g_variant_get_fixed_array (value, &size, 1); /* element size */
+    GBytes *bytes = g_bytes_new (data, size);
+    GPasteItem *item = NULL;
+    guint64 length;
+
+    if (g_variant_lookup (meta, "length", "t", &length))
+    {
+        if (g_strcmp0 (kind, "Text") == 0)
+            item = g_paste_item_new_compressed (G_PASTE_TYPE_TEXT_ITEM, bytes, length);
+    }
+    else if (g_strcmp0 (kind, "Text") == 0)
+        item = G_PASTE_ITEM (g_paste_text_item_new_from_bytes (bytes));
+    else if (g_strcmp0 (kind, "Uris") == 0)
+        item = G_PASTE_ITEM (g_paste_uris_item_new_from_bytes (bytes));
+    else if (g_strcmp0 (kind, "Image") == 0 && size && !((const gchar *) data)[size - 1] &&
+             g_paste_settings_get_images_support (self->priv->settings))
+    {
+        gint64 date = 0;
+        const gchar *checksum = NULL;
+        gint32 width = 0, height = 0;
+        guint64 file_size = 0, phash;
+
+        g_variant_lookup (meta, "date", "x", &date);
+        g_variant_lookup (meta, "checksum", "&s", &checksum);
+        g_variant_lookup (meta, "width", "i", &width);
+        g_variant_lookup (meta, "height", "i", &height);
+        g_variant_lookup (meta, "size", "t", &file_size);
+
+        GDateTime *date_time = g_date_time_new_from_unix_local (date);
+        GPasteImageItem *image = g_paste_image_item_new_from_file_full (data,
+                                                                        date_time,
+                                                                        checksum,
+                                                                        width,
+                                                                        height,
+                                                                        file_size);
+
+        if (image != NULL && g_variant_lookup (meta, "phash", "t", &phash))
+            g_paste_image_item_set_phash (image, phash);
+
+        g_date_time_unref (date_time);
+        item = G_PASTE_ITEM (image);
     }
 
-    g_object_unref (history_file);
-    g_free (history_file_path);
-    g_free (history_file_name);
-out:
-    g_object_unref (history_dir);
-    g_free (history_dir_path);
+    g_bytes_unref (bytes);
+
+    return item;
 }
 
 /**
- * g_paste_history_load:
+ * g_paste_history_adopt_state:
  * @self: a #GPasteHistory instance
+ * @state: (transfer none): a #GVariant handed by g_paste_history_request_state()
  *
- * Load the #GPasteHistory from the history file
+ * Take over the history described by @state instead of loading it
+ * from the history file
  *
- * Returns:
+ * Returns: %FALSE if @state doesn't describe the current history,
+ *          g_paste_history_load() is then still needed
  */
-G_PASTE_VISIBLE void
-g_paste_history_load (GPasteHistory *self)
+G_PASTE_VISIBLE gboolean
+g_paste_history_adopt_state (GPasteHistory *self,
+                             GVariant      *state)
 {
-    g_return_if_fail (G_PASTE_IS_HISTORY (self));
+    g_return_val_if_fail (G_PASTE_IS_HISTORY (self), FALSE);
+    g_return_val_if_fail (state != NULL, FALSE);
 
     GPasteHistoryPrivate *priv = self->priv;
     GPasteSettings *settings = priv->settings;
 
-    g_slist_free_full (priv->history,
-                       g_object_unref);
-    priv->history = NULL;
-
-    gchar *history_file_name = g_strconcat (g_paste_settings_get_history_name (settings), ".xml", NULL);
-    gchar *history_file_path = g_build_filename (g_get_user_data_dir (), "gpaste", history_file_name, NULL);
-    GFile *history_file = g_file_new_for_path (history_file_path);
+    if (!g_variant_is_of_type (state, G_VARIANT_TYPE (G_PASTE_HISTORY_STATE_TYPE)))
+        return FALSE;
 
-    if (g_file_query_exists (history_file,
-                             NULL)) /* cancellable */
-    {
-        LIBXML_TEST_VERSION
+    const gchar *name;
+    guint32 head_length;
+    GVariantIter *segments_iter, *stale_iter, *items_iter;
 
-        xmlTextReaderPtr reader = xmlNewTextReaderFilename (history_file_path);
-        guint32 max_history_size = g_paste_settings_get_max_history_size (settings);
+    g_variant_get (state, "(&sua(subat)asa(saya{sv}))", &name, &head_length, &segments_iter, &stale_iter, &items_iter);
 
-        for (guint32 i = 0; i < max_history_size && xmlTextReaderRead (reader) == 1;)
-        {
-            if (xmlTextReaderNodeType (reader) != 1)
-                continue;
-            const gchar *name = (const gchar *) xmlTextReaderConstName (reader);
-            if (!name || g_strcmp0 (name, "item") != 0)
-                continue;
+    GQueue segments = G_QUEUE_INIT;
+    GSList *items = NULL;
+    guint64 expected = head_length;
+    guint32 length = 0;
+    gboolean adopted = (g_strcmp0 (name, g_paste_settings_get_history_name (settings)) == 0);
+    const gchar *file_name;
+    guint32 segment_length;
+    gboolean loaded;
+    GVariant *hashes;
 
-            ++i;
+    while (g_variant_iter_next (segments_iter, "(&sub@at)", &file_name, &segment_length, &loaded, &hashes))
+    {
+        GPasteHistorySegment *segment = g_slice_new0 (GPasteHistorySegment);
+        gsize n_hashes;
+        const guint64 *hashes_data = g_variant_get_fixed_array (hashes, &n_hashes, sizeof (guint64));
+
+        segment->file_name = g_path_get_basename (file_name);
+        segment->length = segment_length;
+        segment->loaded = loaded;
+        segment->hashes = g_paste_history_new_hashes (hashes_data, n_hashes);
+        g_variant_unref (hashes);
+        /* Loaded ones come first */
+        if (loaded)
+            expected += segment_length;
+        g_queue_push_tail (&segments, segment);
+    }
 
-            gchar *kind = (gchar *) xmlTextReaderGetAttribute (reader, BAD_CAST "kind");
-            gchar *date = (gchar *) xmlTextReaderGetAttribute (reader, BAD_CAST "date");
-            gchar *raw_value = (gchar *) xmlTextReaderReadString (reader);
-            gchar *value = g_paste_history_decode (raw_value);
+    const gchar *kind;
+    GVariant *value, *meta;
 
-            if (g_strcmp0 (kind, "Text") == 0)
-                priv->history = g_slist_append (priv->history, g_paste_text_item_new (value));
-            else if (g_strcmp0 (kind, "Uris") == 0)
-                priv->history = g_slist_append (priv->history, g_paste_uris_item_new (value));
-            else if (g_strcmp0 (kind, "Image") == 0)
-            {
-                if (g_paste_settings_get_images_support (settings))
-                {
-                    GDateTime *date_time = g_date_time_new_from_unix_local (g_ascii_strtoll (date,
-                                                                                             NULL, /* end */
-                                                                                             0)); /* base */
-                    GPasteImageItem *item = g_paste_image_item_new_from_file (value, date_time);
+    while (adopted && g_variant_iter_next (items_iter, "(&s@ay@a{sv})", &kind, &value, &meta))
+    {
+        GPasteItem *item = g_paste_history_adopt_item (self, kind, value, meta);
 
-                    if (item != NULL)
-                        priv->history = g_slist_append (priv->history, item);
+        /* The files are up to date, better read them again than lose that item */
+        if (item)
+        {
+            items = g_slist_prepend (items, item);
+            ++length;
+        }
+        else
+            adopted = FALSE;
 
-                    g_date_time_unref (date_time);
-                }
-                else
-                {
-                    GFile *img_file = g_file_new_for_path (value);
+        g_variant_unref (meta);
+        g_variant_unref (value);
+    }
 
-                    if (g_file_query_exists (img_file,
-                                             NULL)) /* cancellable */
-                    {
-                        g_file_delete (img_file,
-                                       NULL, /* cancellable */
-                                       NULL); /* error */
-                    }
+    if (length != expected)
+        adopted = FALSE;
 
-                    g_object_unref (img_file);
-                }
-            }
+    if (adopted)
+    {
+        g_paste_history_cancel_load (self);
+        g_slist_free_full (priv->history,
+                           g_object_unref);
+        priv->history = g_slist_reverse (items);
+        priv->head_length = head_length;
+        g_queue_foreach (&priv->segments, (GFunc) g_paste_history_segment_free, NULL); /* user data */
+        g_queue_clear (&priv->segments);
+        priv->segments = segments;
+        g_free (priv->segments_dir_path);
+        priv->segments_dir_path = g_paste_history_get_segments_dir_path (name);
+
+        gchar *path;
+
+        while (g_variant_iter_next (stale_iter, "s", &path))
+            priv->stale_segments = g_slist_prepend (priv->stale_segments, path);
+
+        if (g_paste_settings_get_delta_storage (settings))
+            g_paste_history_pack (priv->history);
+        if (g_paste_settings_get_fifo (settings))
+            g_paste_history_unseal (self);
+        g_paste_history_trim (self);
+        g_paste_history_ensure_loaded (self, g_paste_settings_get_max_displayed_history_size (settings) - 1);
+        g_paste_history_compress_cold_items (self);
+
+        if (priv->history)
+        {
+            GPasteItem *first = priv->history->data;
 
-            g_free (raw_value);
-            g_free (value);
-            g_free (date);
-            g_free (kind);
+            g_paste_item_set_state (first, G_PASTE_ITEM_STATE_ACTIVE);
+            if (G_PASTE_IS_IMAGE_ITEM (first))
+                g_paste_image_item_prefetch (G_PASTE_IMAGE_ITEM (first));
         }
 
-        xmlFreeTextReader (reader);
+        g_paste_history_schedule_gc (self);
+        g_paste_history_schedule_merge (self);
     }
     else
     {
-        /* Create the empty file to be listed as an available history */
-        g_paste_history_save (self);
+        g_slist_free_full (items,
+                           g_object_unref);
+        g_queue_foreach (&segments, (GFunc) g_paste_history_segment_free, NULL); /* user data */
+        g_queue_clear (&segments);
     }
 
-    g_object_unref (history_file);
-    g_free (history_file_path);
-    g_free (history_file_name);
+    g_variant_iter_free (items_iter);
+    g_variant_iter_free (stale_iter);
+    g_variant_iter_free (segments_iter);
+
+    return adopted;
+}
+
+static gboolean
+g_paste_history_save_changes (gpointer user_data)
+{
+    GPasteHistory *self = user_data;
+
+    self->priv->save_source = 0;
+    /* Keep enough items loaded to fill the displayed history */
+    g_paste_history_ensure_loaded (self, g_paste_settings_get_max_displayed_history_size (self->priv->settings) - 1);
+    g_paste_history_save (self);
+
+    return FALSE;
+}
+
+static void
+g_paste_history_flush_changes (GPasteHistory *self)
+{
+    GPasteHistoryPrivate *priv = self->priv;
 
-    if (priv->history)
-        g_paste_item_set_state (priv->history->data, G_PASTE_ITEM_STATE_ACTIVE);
+    if (priv->save_source)
+    {
+        g_source_remove (priv->save_source);
+        g_paste_history_save_changes (self);
+    }
 }
 
 /**
@@ -528,6 +2800,7 @@ g_paste_history_switch (GPasteHistory *self,
     g_return_if_fail (name != NULL);
     g_return_if_fail (g_utf8_validate (name, -1, NULL));
 
+    g_paste_history_flush_changes (self);
     g_paste_settings_set_history_name (self->priv->settings, name);
     g_paste_history_load (self);
 
@@ -557,7 +2830,9 @@ g_paste_history_delete (GPasteHistory *self,
     gchar *history_file_path = g_build_filename (g_get_user_data_dir (), "gpaste", history_file_name, NULL);
     GFile *history_file = g_file_new_for_path (history_file_path);
 
+    /* Drops the segments along with the items */
     g_paste_history_empty (self);
+    g_paste_history_flush_changes (self);
     if (g_file_query_exists (history_file,
                              NULL)) /* cancellable */
     {
@@ -571,13 +2846,15 @@ g_paste_history_delete (GPasteHistory *self,
     g_free (history_file_name);
 }
 
-static gboolean
+/* An operation can change the history several times in a row, save the outcome once */
+static void
 g_paste_history_self_changed (GPasteHistory *self,
                               gpointer       user_data G_GNUC_UNUSED)
 {
-    g_paste_history_save (self);
+    GPasteHistoryPrivate *priv = self->priv;
 
-    return TRUE;
+    if (!priv->save_source)
+        priv->save_source = g_idle_add (g_paste_history_save_changes, self);
 }
 
 static void
@@ -587,9 +2864,26 @@ g_paste_history_dispose (GObject *object)
     GPasteHistoryPrivate *priv = self->priv;
     GPasteSettings *settings = priv->settings;
 
+    if (settings)
+        g_paste_history_flush_changes (self);
+
+    if (priv->gc_source)
+    {
+        g_source_remove (priv->gc_source);
+        priv->gc_source = 0;
+    }
+
+    if (priv->merge_source)
+    {
+        g_source_remove (priv->merge_source);
+        priv->merge_source = 0;
+    }
+
     if (settings)
     {
         g_signal_handler_disconnect (self, priv->changed_signal);
+        g_signal_handler_disconnect (settings, priv->cache_size_signal);
+        g_signal_handler_disconnect (settings, priv->element_size_signal);
         g_object_unref (settings);
         priv->settings = NULL;
     }
@@ -604,6 +2898,11 @@ g_paste_history_finalize (GObject *object)
 
     g_slist_free_full (priv->history,
                        g_object_unref);
+    g_queue_foreach (&priv->segments, (GFunc) g_paste_history_segment_free, NULL); /* user data */
+    g_queue_clear (&priv->segments);
+    g_slist_free_full (priv->stale_segments,
+                       g_free);
+    g_free (priv->segments_dir_path);
 
     G_OBJECT_CLASS (g_paste_history_parent_class)->finalize (object);
 }
@@ -618,6 +2917,16 @@ g_paste_history_class_init (GPasteHistoryClass *klass)
     object_class->dispose = g_paste_history_dispose;
     object_class->finalize = g_paste_history_finalize;
 
+    signals[ADDED] = g_signal_new ("added",
+                                   G_PASTE_TYPE_HISTORY,
+                                   G_SIGNAL_RUN_LAST,
+                                   0, /* class offset */
+                                   NULL, /* accumulator */
+                                   NULL, /* accumulator data */
+                                   g_cclosure_marshal_VOID__OBJECT,
+                                   G_TYPE_NONE,
+                                   1, /* number of params */
+                                   G_PASTE_TYPE_ITEM);
     signals[CHANGED] = g_signal_new ("changed",
                                      G_PASTE_TYPE_HISTORY,
                                      G_SIGNAL_RUN_LAST,
@@ -627,6 +2936,25 @@ g_paste_history_class_init (GPasteHistoryClass *klass)
                                      g_cclosure_marshal_VOID__VOID,
                                      G_TYPE_NONE,
                                      0); /* number of params */
+    signals[GARBAGE_COLLECTED] = g_signal_new ("garbage-collected",
+                                               G_PASTE_TYPE_HISTORY,
+                                               G_SIGNAL_RUN_LAST,
+                                               0, /* class offset */
+                                               NULL, /* accumulator */
+                                               NULL, /* accumulator data */
+                                               NULL, /* generic marshaller */
+                                               G_TYPE_NONE,
+                                               1, /* number of params */
+                                               G_TYPE_UINT64);
+    signals[LOADED] = g_signal_new ("loaded",
+                                    G_PASTE_TYPE_HISTORY,
+                                    G_SIGNAL_RUN_LAST,
+                                    0, /* class offset */
+                                    NULL, /* accumulator */
+                                    NULL, /* accumulator data */
+                                    g_cclosure_marshal_VOID__VOID,
+                                    G_TYPE_NONE,
+                                    0); /* number of params */
     signals[SELECTED] = g_signal_new ("selected",
                                       G_PASTE_TYPE_HISTORY,
                                       G_SIGNAL_RUN_LAST,
@@ -656,7 +2984,8 @@ g_paste_history_init (GPasteHistory *self)
  * g_paste_history_get_history:
  * @self: a #GPasteHistory instance
  *
- * Get the inner history of a #GPasteHistory
+ * Get the inner history of a #GPasteHistory, without the
+ * segments which haven't been looked into yet
  *
  * Returns: (element-type GPasteItem) (transfer none): The inner history
  */
@@ -668,6 +2997,35 @@ g_paste_history_get_history (GPasteHistory *self)
     return self->priv->history;
 }
 
+static void
+g_paste_history_cache_size_changed (GPasteSettings *settings,
+                                    const gchar    *key G_GNUC_UNUSED,
+                                    gpointer        user_data G_GNUC_UNUSED)
+{
+    g_paste_image_item_set_cache_budget ((gsize) g_paste_settings_get_images_cache_size (settings) * 1024 * 1024);
+}
+
+/* Text previews follow it, rebuild them */
+static void
+g_paste_history_element_size_changed (GPasteSettings *settings,
+                                      const gchar    *key G_GNUC_UNUSED,
+                                      gpointer        user_data)
+{
+    GPasteHistory *self = user_data;
+
+    g_paste_text_item_set_preview_size (g_paste_settings_get_element_size (settings));
+
+    for (GSList *history = self->priv->history; history; history = g_slist_next (history))
+    {
+        if (G_PASTE_IS_TEXT_ITEM (history->data))
+            g_paste_item_set_display_string (history->data, NULL);
+    }
+
+    g_signal_emit (self,
+                   signals[CHANGED],
+                   0); /* detail */
+}
+
 /**
  * g_paste_history_new:
  * @settings: (transfer none): a #GPasteSettings instance
@@ -683,8 +3041,19 @@ g_paste_history_new (GPasteSettings *settings)
     g_return_val_if_fail (G_PASTE_IS_SETTINGS (settings), NULL);
     
     GPasteHistory *self = g_object_new (G_PASTE_TYPE_HISTORY, NULL);
+    GPasteHistoryPrivate *priv = self->priv;
 
-    self->priv->settings = g_object_ref (settings);
+    priv->settings = g_object_ref (settings);
+    priv->cache_size_signal = g_signal_connect (G_OBJECT (settings),
+                                                "changed::" IMAGES_CACHE_SIZE_KEY,
+                                                G_CALLBACK (g_paste_history_cache_size_changed),
+                                                NULL); /* user data */
+    g_paste_history_cache_size_changed (settings, IMAGES_CACHE_SIZE_KEY, NULL);
+    priv->element_size_signal = g_signal_connect (G_OBJECT (settings),
+                                                  "changed::" ELEMENT_SIZE_KEY,
+                                                  G_CALLBACK (g_paste_history_element_size_changed),
+                                                  self);
+    g_paste_text_item_set_preview_size (g_paste_settings_get_element_size (settings));
 
     return self;
 }
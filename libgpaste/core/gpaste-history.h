@@ -41,9 +41,16 @@ G_BEGIN_DECLS
 #define G_PASTE_IS_HISTORY_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass), G_PASTE_TYPE_HISTORY))
 #define G_PASTE_HISTORY_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj), G_PASTE_TYPE_HISTORY, GPasteHistoryClass))
 
+/* Describes the items and segments a #GPasteHistory hands over to another process */
+#define G_PASTE_HISTORY_STATE_TYPE "(sua(subat)asa(saya{sv}))"
+
 typedef struct _GPasteHistory GPasteHistory;
 typedef struct _GPasteHistoryClass GPasteHistoryClass;
 
+typedef void (*GPasteHistoryStateFunc) (GPasteHistory *self,
+                                        GVariant      *state,
+                                        gpointer       user_data);
+
 #ifdef G_PASTE_COMPILATION
 G_PASTE_VISIBLE
 #endif
@@ -59,14 +66,21 @@ const gchar      *g_paste_history_get_value (GPasteHistory *self,
                                              guint32        index);
 void              g_paste_history_select    (GPasteHistory *self,
                                              guint32        index);
-void         g_paste_history_empty       (GPasteHistory *self);
-void         g_paste_history_save        (GPasteHistory *self);
-void         g_paste_history_load        (GPasteHistory *self);
-void         g_paste_history_switch      (GPasteHistory *self,
-                                          const gchar   *name);
-void         g_paste_history_delete      (GPasteHistory *self,
-                                          GError       **error);
-GSList      *g_paste_history_get_history (GPasteHistory *self);
+void         g_paste_history_empty           (GPasteHistory *self);
+void         g_paste_history_save            (GPasteHistory *self);
+void         g_paste_history_load            (GPasteHistory *self);
+void         g_paste_history_load_in_background (GPasteHistory *self);
+void         g_paste_history_switch          (GPasteHistory *self,
+                                              const gchar   *name);
+void         g_paste_history_delete          (GPasteHistory *self,
+                                              GError       **error);
+GSList      *g_paste_history_get_history     (GPasteHistory *self);
+void         g_paste_history_collect_garbage (GPasteHistory *self);
+gboolean     g_paste_history_request_state   (GPasteHistory          *self,
+                                              GPasteHistoryStateFunc  func,
+                                              gpointer                user_data);
+gboolean     g_paste_history_adopt_state     (GPasteHistory *self,
+                                              GVariant      *state);
 
 GPasteHistory *g_paste_history_new (GPasteSettings *settings);
 
@@ -40,6 +40,27 @@ struct _GPasteImageItemClass
     GPasteItemClass parent_class;
 };
 
+gchar           *g_paste_image_item_compute_checksum    (GdkPixbuf             *image);
+GdkPixbuf       *g_paste_image_item_decode_png         (GBytes                *png);
+gchar           *g_paste_image_item_get_thumbnail_path (const GPasteImageItem *self);
+GPasteImageItem *g_paste_image_item_new_with_checksum  (GdkPixbuf             *img,
+                                                        const gchar           *checksum,
+                                                        guint32                compression_level);
+GPasteImageItem *g_paste_image_item_new_from_file_full (const gchar           *path,
+                                                        GDateTime             *date,
+                                                        const gchar           *checksum,
+                                                        gint                   width,
+                                                        gint                   height,
+                                                        gsize                  file_size);
+gboolean         g_paste_image_item_get_phash          (const GPasteImageItem *self,
+                                                        guint64               *phash);
+void             g_paste_image_item_set_phash          (GPasteImageItem       *self,
+                                                        guint64                phash);
+guint            g_paste_image_item_phash_distance     (guint64                phash,
+                                                        guint64                other);
+void             g_paste_image_item_prefetch           (GPasteImageItem       *self);
+void             g_paste_image_item_set_cache_budget   (gsize                  budget);
+
 G_END_DECLS
 
 #endif /*__G_PASTE_IMAGE_ITEM_PRIVATE_H__*/
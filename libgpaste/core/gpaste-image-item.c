@@ -18,10 +18,16 @@
  */
 
 #include "gpaste-image-item-private.h"
+#include "gpaste-text-kernel.h"
 
 #include <glib/gi18n-lib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
 #include <sys/stat.h>
 
+#define G_PASTE_IMAGE_ITEM_THUMBNAIL_SIZE 256
+
 #define G_PASTE_IMAGE_ITEM_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE ((obj), G_PASTE_TYPE_IMAGE_ITEM, GPasteImageItemPrivate))
 
 G_DEFINE_TYPE (GPasteImageItem, g_paste_image_item, G_PASTE_TYPE_ITEM)
@@ -31,15 +37,175 @@ struct _GPasteImageItemPrivate
     gchar     *checksum;
     GDateTime *date;
     GdkPixbuf *image;
+    GBytes    *png;
+    gboolean   persisted;
+    gint       width;
+    gint       height;
+    gsize      file_size;
+    GList     *decoded_link;
+    gsize      decoded_size;
+    gboolean   prefetching;
+    guint64    phash;
+    gboolean   has_phash;
+};
+
+enum
+{
+    PERSISTED,
+    PERSIST_FAILED,
+
+    LAST_SIGNAL
 };
 
+static guint signals[LAST_SIGNAL] = { 0 };
+
+/* Encoding and writing run here, never on the main loop */
+static GThreadPool *persist_pool = NULL;
+
+/* Decoded pixbufs shared by all the items, most recently used first */
+static GQueue decoded_images = G_QUEUE_INIT;
+static gsize decoded_size = 0;
+static gsize decoded_budget = 64 * 1024 * 1024;
+
+/* Decodes ahead of time, one at a time */
+static GThreadPool *prefetch_pool = NULL;
+
+/* Builds the thumbnails older histories lack, one at a time */
+static GThreadPool *thumbnail_pool = NULL;
+
+typedef struct
+{
+    GPasteImageItem             *self;
+    gchar                       *path;
+    gchar                       *thumbnail_path;
+    GdkPixbuf                   *image;
+    GBytes                      *png;
+    GBytes                      *thumbnail;
+    GPasteImageItemThumbnailFunc callback;
+    gpointer                     user_data;
+} GPasteImageItemThumbnailJob;
+
+typedef struct
+{
+    GPasteImageItem *self;
+    gchar           *path;
+    GdkPixbuf       *image;
+} GPasteImageItemPrefetchJob;
+
+typedef struct
+{
+    GPasteImageItem *self;
+    gchar           *path;
+    GdkPixbuf       *image;
+    gchar           *thumbnail_path;
+    GBytes          *png;
+    guint32          compression_level;
+    gsize            file_size;
+    guint64          phash;
+    gboolean         has_phash;
+    gboolean         failed;
+} GPasteImageItemPersistJob;
+
+static void
+g_paste_image_item_drop_image (GPasteImageItem *self)
+{
+    GPasteImageItemPrivate *priv = self->priv;
+
+    if (priv->decoded_link)
+    {
+        g_queue_delete_link (&decoded_images, priv->decoded_link);
+        decoded_size -= priv->decoded_size;
+        priv->decoded_link = NULL;
+        priv->decoded_size = 0;
+    }
+    if (priv->image)
+        g_clear_object (&priv->image);
+}
+
+/* Less than a sixteenth of the memory left: give back everything we can */
+static gboolean
+g_paste_image_item_memory_is_low (void)
+{
+    gchar *meminfo;
+
+    if (!g_file_get_contents ("/proc/meminfo", &meminfo, NULL, NULL)) /* length, error */
+        return FALSE;
+
+    const gchar *total_line = strstr (meminfo, "MemTotal:");
+    const gchar *available_line = strstr (meminfo, "MemAvailable:");
+    guint64 total = (total_line) ? g_ascii_strtoull (total_line + strlen ("MemTotal:"), NULL, 10) : 0;
+    guint64 available = (available_line) ? g_ascii_strtoull (available_line + strlen ("MemAvailable:"), NULL, 10) : 0;
+
+    g_free (meminfo);
+
+    return (total && available && available < total / 16);
+}
+
+static void
+g_paste_image_item_trim_cache (gsize            budget,
+                               GPasteImageItem *keep)
+{
+    GList *link = decoded_images.tail;
+
+    while (decoded_size > budget && link)
+    {
+        GList *previous = link->prev;
+        GPasteImageItem *item = link->data;
+
+        /* Until its file is written, the pixbuf is the only copy we have */
+        if (item != keep && item->priv->persisted)
+            g_paste_image_item_drop_image (item);
+        link = previous;
+    }
+}
+
+/* Mark the decoded image as the most recently used one */
+static void
+g_paste_image_item_touch (GPasteImageItem *self)
+{
+    GPasteImageItemPrivate *priv = self->priv;
+
+    if (!priv->image)
+        return;
+
+    if (priv->decoded_link)
+    {
+        g_queue_unlink (&decoded_images, priv->decoded_link);
+        g_queue_push_head_link (&decoded_images, priv->decoded_link);
+    }
+    else
+    {
+        priv->decoded_size = (gsize) gdk_pixbuf_get_rowstride (priv->image) * (gsize) gdk_pixbuf_get_height (priv->image);
+        decoded_size += priv->decoded_size;
+        g_queue_push_head (&decoded_images, self);
+        priv->decoded_link = decoded_images.head;
+
+        g_paste_image_item_trim_cache ((g_paste_image_item_memory_is_low ()) ? 0 : decoded_budget, self);
+    }
+}
+
+/**
+ * g_paste_image_item_set_cache_budget: (skip)
+ * @budget: the memory budget, in bytes
+ *
+ * Set how much memory the decoded images of all the items may use
+ *
+ * Returns:
+ */
+void
+g_paste_image_item_set_cache_budget (gsize budget)
+{
+    decoded_budget = budget;
+    g_paste_image_item_trim_cache (budget, NULL);
+}
+
 /**
  * g_paste_image_item_get_checksum:
  * @self: a #GPasteImageItem instance
  *
  * Get the checksum of the GdkPixbuf contained in the #GPasteImageItem
  *
- * Returns: read-only string representatig the SHA256 checksum of the image
+ * Returns: read-only string representatig the checksum of the image
  */
 G_PASTE_VISIBLE const gchar *
 g_paste_image_item_get_checksum (const GPasteImageItem *self)
@@ -65,6 +231,103 @@ g_paste_image_item_get_date (const GPasteImageItem *self)
     return self->priv->date;
 }
 
+/**
+ * g_paste_image_item_get_width:
+ * @self: a #GPasteImageItem instance
+ *
+ * Get the width of the image, known without decoding it
+ *
+ * Returns: the width in pixels, 0 if unknown
+ */
+G_PASTE_VISIBLE gint
+g_paste_image_item_get_width (const GPasteImageItem *self)
+{
+    g_return_val_if_fail (G_PASTE_IS_IMAGE_ITEM (self), 0);
+
+    return self->priv->width;
+}
+
+/**
+ * g_paste_image_item_get_height:
+ * @self: a #GPasteImageItem instance
+ *
+ * Get the height of the image, known without decoding it
+ *
+ * Returns: the height in pixels, 0 if unknown
+ */
+G_PASTE_VISIBLE gint
+g_paste_image_item_get_height (const GPasteImageItem *self)
+{
+    g_return_val_if_fail (G_PASTE_IS_IMAGE_ITEM (self), 0);
+
+    return self->priv->height;
+}
+
+/**
+ * g_paste_image_item_get_file_size:
+ * @self: a #GPasteImageItem instance
+ *
+ * Get the size of the PNG file of the image
+ *
+ * Returns: the size in bytes, 0 if unknown or not written yet
+ */
+G_PASTE_VISIBLE gsize
+g_paste_image_item_get_file_size (const GPasteImageItem *self)
+{
+    g_return_val_if_fail (G_PASTE_IS_IMAGE_ITEM (self), 0);
+
+    return self->priv->file_size;
+}
+
+/**
+ * g_paste_image_item_is_persisted:
+ * @self: a #GPasteImageItem instance
+ *
+ * Whether the image file has already been written to disk
+ * The "persisted" signal gets emitted once it is,
+ * "persist-failed" if it could not be written
+ *
+ * Returns: %TRUE if the file is on disk
+ */
+G_PASTE_VISIBLE gboolean
+g_paste_image_item_is_persisted (const GPasteImageItem *self)
+{
+    g_return_val_if_fail (G_PASTE_IS_IMAGE_ITEM (self), FALSE);
+
+    return self->priv->persisted;
+}
+
+/**
+ * g_paste_image_item_decode_png: (skip)
+ * @png: the PNG encoded image
+ *
+ * Returns: (transfer full): the decoded image, or NULL if @png isn't a valid PNG
+ */
+GdkPixbuf *
+g_paste_image_item_decode_png (GBytes *png)
+{
+    GdkPixbufLoader *loader = gdk_pixbuf_loader_new_with_type ("png", NULL); /* Error */
+    GdkPixbuf *image = NULL;
+
+    if (!loader)
+        return NULL;
+
+    gsize length;
+    const guchar *data = g_bytes_get_data (png, &length);
+    gboolean written = gdk_pixbuf_loader_write (loader, data, length, NULL); /* Error */
+
+    /* Always closed, even after a failed write */
+    if (gdk_pixbuf_loader_close (loader, NULL) && written) /* Error */
+    {
+        image = gdk_pixbuf_loader_get_pixbuf (loader);
+        if (image)
+            g_object_ref (image);
+    }
+    g_object_unref (loader);
+
+    return image;
+}
+
 /**
  * g_paste_image_item_get_image:
  * @self: a #GPasteImageItem instance
@@ -78,7 +341,21 @@ g_paste_image_item_get_image (const GPasteImageItem *self)
 {
     g_return_val_if_fail (G_PASTE_IS_IMAGE_ITEM (self), NULL);
 
-    return self->priv->image;
+    GPasteImageItemPrivate *priv = self->priv;
+
+    /* Only decode the stored file when someone actually needs the pixels */
+    if (!priv->image && priv->png)
+    {
+        /* Not written yet, decode what we'll write */
+        priv->image = g_paste_image_item_decode_png (priv->png);
+    }
+    else if (!priv->image)
+        priv->image = gdk_pixbuf_new_from_file (g_paste_item_get_value (G_PASTE_ITEM (self)),
+                                                NULL); /* Error */
+
+    g_paste_image_item_touch ((GPasteImageItem *) self);
+
+    return priv->image;
 }
 
 static gboolean
@@ -87,8 +364,17 @@ g_paste_image_item_equals (const GPasteItem *self,
 {
     g_return_val_if_fail (G_PASTE_IS_IMAGE_ITEM (self), FALSE);
 
-    return (G_PASTE_IS_IMAGE_ITEM (other) &&
-            (g_strcmp0 (G_PASTE_IMAGE_ITEM (self)->priv->checksum, G_PASTE_IMAGE_ITEM (other)->priv->checksum) == 0));
+    if (!G_PASTE_IS_IMAGE_ITEM (other))
+        return FALSE;
+
+    const gchar *checksum = G_PASTE_IMAGE_ITEM (self)->priv->checksum;
+    const gchar *other_checksum = G_PASTE_IMAGE_ITEM (other)->priv->checksum;
+
+    /* Without checksum, we can only tell whether it's the same file */
+    if (!checksum || !other_checksum)
+        return (g_strcmp0 (g_paste_item_get_value (self), g_paste_item_get_value (other)) == 0);
+
+    return (g_strcmp0 (checksum, other_checksum) == 0);
 }
 
 static const gchar *
@@ -107,16 +393,15 @@ g_paste_image_item_set_state (GPasteItem     *self,
 
     GPasteImageItemPrivate *priv = G_PASTE_IMAGE_ITEM (self)->priv;
 
+    /* The image gets decoded lazily by g_paste_image_item_get_image
+     * and dropped by the shared cache when it runs out of budget */
     switch (state)
     {
     case G_PASTE_ITEM_STATE_IDLE:
-        if (priv->image)
-            g_clear_object (&priv->image);
         break;
     case G_PASTE_ITEM_STATE_ACTIVE:
-        if (!priv->image)
-            priv->image = gdk_pixbuf_new_from_file (g_paste_item_get_value (G_PASTE_ITEM (self)),
-                                                    NULL); /* Error */
+        if (priv->image)
+            g_paste_image_item_touch (G_PASTE_IMAGE_ITEM (self));
         break;
     }
 }
@@ -130,8 +415,9 @@ g_paste_image_item_dispose (GObject *object)
     if (date)
     {
         g_date_time_unref (date);
-        if (priv->image)
-            g_object_unref (priv->image);
+        g_paste_image_item_drop_image (G_PASTE_IMAGE_ITEM (object));
+        if (priv->png)
+            g_bytes_unref (priv->png);
         priv->date = NULL;
     }
 
@@ -161,12 +447,129 @@ g_paste_image_item_class_init (GPasteImageItemClass *klass)
 
     gobject_class->dispose = g_paste_image_item_dispose;
     gobject_class->finalize = g_paste_image_item_finalize;
+
+    signals[PERSISTED] = g_signal_new ("persisted",
+                                       G_PASTE_TYPE_IMAGE_ITEM,
+                                       G_SIGNAL_RUN_LAST,
+                                       0, /* class offset */
+                                       NULL, /* accumulator */
+                                       NULL, /* accumulator data */
+                                       g_cclosure_marshal_VOID__VOID,
+                                       G_TYPE_NONE,
+                                       0); /* number of params */
+    signals[PERSIST_FAILED] = g_signal_new ("persist-failed",
+                                            G_PASTE_TYPE_IMAGE_ITEM,
+                                            G_SIGNAL_RUN_LAST,
+                                            0, /* class offset */
+                                            NULL, /* accumulator */
+                                            NULL, /* accumulator data */
+                                            g_cclosure_marshal_VOID__VOID,
+                                            G_TYPE_NONE,
+                                            0); /* number of params */
 }
 
 static void
 g_paste_image_item_init (GPasteImageItem *self)
 {
     self->priv = G_PASTE_IMAGE_ITEM_GET_PRIVATE (self);
+
+    self->priv->persisted = TRUE;
+    self->priv->decoded_link = NULL;
+    self->priv->decoded_size = 0;
+    self->priv->prefetching = FALSE;
+    self->priv->has_phash = FALSE;
+}
+
+/* The file name of a stored image is its checksum: the pixel fingerprint, or the SHA-256 of the PNG for older ones */
+static gchar *
+g_paste_image_item_checksum_from_path (const gchar *path)
+{
+    gchar *basename = g_path_get_basename (path);
+    gsize length = strlen (basename) - 4;
+
+    if ((length == 64 || length == 16) && g_str_has_suffix (basename, ".png"))
+    {
+        basename[length] = '\0';
+        for (guint i = 0; i < length; ++i)
+        {
+            if (!g_ascii_isxdigit (basename[i]))
+                goto invalid;
+        }
+        return basename;
+    }
+
+invalid:
+    g_free (basename);
+    return NULL;
+}
+
+static void
+g_paste_image_item_set_checksum (GPasteImageItem *self,
+                                 gchar           *checksum)
+{
+    GPasteImageItemPrivate *priv = self->priv;
+
+    priv->checksum = checksum;
+
+    /* The first 64 bits of the SHA-256 are as good as any hash for the fingerprint */
+    if (checksum)
+    {
+        gchar prefix[17];
+
+        memcpy (prefix, checksum, 16);
+        prefix[16] = '\0';
+        g_paste_item_set_fingerprint (G_PASTE_ITEM (self),
+                                      strlen (checksum),
+                                      g_ascii_strtoull (prefix,
+                                                        NULL, /* end */
+                                                        16)); /* base */
+    }
+}
+
+static void
+g_paste_image_item_set_size (GPasteImageItem *self,
+                             gint             width,
+                             gint             height)
+{
+    GPasteImageItemPrivate *priv = self->priv;
+
+    priv->width = width;
+    priv->height = height;
+
+    /* This is the date format "month/day/year time" */
+    gchar *formatted_date = g_date_time_format (self->priv->date, _("%m/%d/%y %T"));
+    /* This gets displayed in history when selecting an image */
+    gchar *display_string = g_strdup_printf (_("[Image, %d x %d (%s)]"),
+                                             width,
+                                             height,
+                                             formatted_date);
+    g_paste_item_set_display_string (G_PASTE_ITEM (self), display_string);
+    g_free (display_string);
+    g_free (formatted_date);
+}
+
+/**
+ * g_paste_image_item_compute_checksum: (skip)
+ * @image: the #GdkPixbuf to fingerprint
+ *
+ * Compute the fingerprint of the pixels of @image, only the meaningful
+ * bytes of each row are hashed, never the rowstride padding
+ *
+ * Returns: the fingerprint as 16 hexadecimal digits, free it with g_free
+ */
+gchar *
+g_paste_image_item_compute_checksum (GdkPixbuf *image)
+{
+    g_return_val_if_fail (GDK_IS_PIXBUF (image), NULL);
+
+    gsize row_length = (gsize) gdk_pixbuf_get_width (image) *
+                       (gsize) ((gdk_pixbuf_get_n_channels (image) * gdk_pixbuf_get_bits_per_sample (image) + 7) / 8);
+    guint64 hash = g_paste_text_kernel_hash_pixels (gdk_pixbuf_get_pixels (image),
+                                                    row_length,
+                                                    (guint) gdk_pixbuf_get_height (image),
+                                                    (gsize) gdk_pixbuf_get_rowstride (image));
+
+    return g_strdup_printf ("%016" G_GINT64_MODIFIER "x", hash);
 }
 
 static GPasteImageItem *
@@ -185,28 +588,637 @@ _g_paste_image_item_new (const gchar *path,
     if (image)
     {
         if (!checksum)
+            checksum = g_paste_image_item_compute_checksum (image);
+        g_paste_image_item_set_checksum (self, checksum);
+        g_paste_image_item_set_size (self,
+                                     gdk_pixbuf_get_width (image),
+                                     gdk_pixbuf_get_height (image));
+        g_paste_image_item_touch (self);
+    }
+
+    return self;
+}
+
+static gchar *
+g_paste_image_item_get_path_in (const gchar *dir_name,
+                                const gchar *filename)
+{
+    gchar *dir_path = g_build_filename (g_get_user_data_dir (), "gpaste", dir_name, NULL);
+    GFile *dir = g_file_new_for_path (dir_path);
+
+    if (!g_file_query_exists (dir, NULL))
+        mkdir (dir_path, (mode_t) 0700);
+    g_object_unref (dir);
+
+    gchar *path = g_build_filename (dir_path, filename, NULL);
+
+    g_free (dir_path);
+
+    return path;
+}
+
+static gchar *
+g_paste_image_item_get_path_for_checksum (const gchar *checksum)
+{
+    gchar *filename = g_strconcat (checksum, ".png", NULL);
+    gchar *path = g_paste_image_item_get_path_in ("images", filename);
+
+    g_free (filename);
+
+    return path;
+}
+
+/**
+ * g_paste_image_item_get_thumbnail_path: (skip)
+ * @self: a #GPasteImageItem instance
+ *
+ * Get the path of the thumbnail, which has the same name as the image
+ * in the thumbnails directory
+ *
+ * Returns: the path of the thumbnail, free it with g_free
+ */
+gchar *
+g_paste_image_item_get_thumbnail_path (const GPasteImageItem *self)
+{
+    g_return_val_if_fail (G_PASTE_IS_IMAGE_ITEM (self), NULL);
+
+    gchar *filename = g_path_get_basename (g_paste_item_get_value (G_PASTE_ITEM (self)));
+    gchar *path = g_paste_image_item_get_path_in ("thumbnails", filename);
+
+    g_free (filename);
+
+    return path;
+}
+
+static GdkPixbuf *
+g_paste_image_item_scale_thumbnail (GdkPixbuf *image)
+{
+    gint width = gdk_pixbuf_get_width (image);
+    gint height = gdk_pixbuf_get_height (image);
+    gint max = MAX (width, height);
+
+    if (max <= G_PASTE_IMAGE_ITEM_THUMBNAIL_SIZE)
+        return g_object_ref (image);
+
+    return gdk_pixbuf_scale_simple (image,
+                                    MAX (1, width * G_PASTE_IMAGE_ITEM_THUMBNAIL_SIZE / max),
+                                    MAX (1, height * G_PASTE_IMAGE_ITEM_THUMBNAIL_SIZE / max),
+                                    GDK_INTERP_BILINEAR);
+}
+
+/* dHash: shrink to 9x8 grey levels and keep whether each pixel is brighter than its right neighbour */
+static gboolean
+g_paste_image_item_compute_phash (GdkPixbuf *image,
+                                  guint64   *phash)
+{
+    GdkPixbuf *small = gdk_pixbuf_scale_simple (image, 9, 8, GDK_INTERP_TILES);
+
+    if (!small)
+        return FALSE;
+
+    const guchar *pixels = gdk_pixbuf_get_pixels (small);
+    gint rowstride = gdk_pixbuf_get_rowstride (small);
+    gint n_channels = gdk_pixbuf_get_n_channels (small);
+    guint64 hash = 0;
+
+    for (gint y = 0; y < 8; ++y)
+    {
+        const guchar *row = pixels + y * rowstride;
+        guint previous = 0;
+
+        for (gint x = 0; x < 9; ++x)
         {
-            guint length;
-            const guchar *data = gdk_pixbuf_get_pixels_with_length (image,
-                                                                    &length);
-            checksum = g_compute_checksum_for_data (G_CHECKSUM_SHA256,
-                                                    data,
-                                                    length);
+            const guchar *pixel = row + x * n_channels;
+            guint grey = (pixel[0] * 299 + pixel[1] * 587 + pixel[2] * 114) / 1000;
+
+            if (x)
+                hash = (hash << 1) | (previous > grey);
+            previous = grey;
         }
-        priv->checksum = checksum;
-        /* This is the date format "month/day/year time" */
-        gchar *formatted_date = g_date_time_format (date, _("%m/%d/%y %T"));
-        /* This gets displayed in history when selecting an image */
-        gchar *display_string = g_strdup_printf (_("[Image, %d x %d (%s)]"),
-                                                 gdk_pixbuf_get_width (image),
-                                                 gdk_pixbuf_get_height (image),
-                                                 formatted_date);
-        g_paste_item_set_display_string (g_paste_item, display_string);
-        g_free (display_string);
-        g_free (formatted_date);
     }
 
-    return self;
+    g_object_unref (small);
+    *phash = hash;
+
+    return TRUE;
+}
+
+/**
+ * g_paste_image_item_get_phash: (skip)
+ * @self: a #GPasteImageItem instance
+ * @phash: (out): where to store the perceptual hash
+ *
+ * Get the perceptual hash of the image, known once it has been persisted
+ *
+ * Returns: whether @phash was set
+ */
+gboolean
+g_paste_image_item_get_phash (const GPasteImageItem *self,
+                              guint64               *phash)
+{
+    g_return_val_if_fail (G_PASTE_IS_IMAGE_ITEM (self), FALSE);
+
+    GPasteImageItemPrivate *priv = self->priv;
+
+    if (priv->has_phash)
+        *phash = priv->phash;
+
+    return priv->has_phash;
+}
+
+/**
+ * g_paste_image_item_set_phash: (skip)
+ * @self: a #GPasteImageItem instance
+ * @phash: the perceptual hash of the image
+ *
+ * Set the perceptual hash of the image, as saved in the history
+ *
+ * Returns:
+ */
+void
+g_paste_image_item_set_phash (GPasteImageItem *self,
+                              guint64          phash)
+{
+    g_return_if_fail (G_PASTE_IS_IMAGE_ITEM (self));
+
+    GPasteImageItemPrivate *priv = self->priv;
+
+    priv->phash = phash;
+    priv->has_phash = TRUE;
+}
+
+/**
+ * g_paste_image_item_phash_distance: (skip)
+ * @phash: a perceptual hash
+ * @other: another perceptual hash
+ *
+ * Count the bits that differ between two perceptual hashes
+ *
+ * Returns: the Hamming distance, from 0 (same picture) to 64
+ */
+guint
+g_paste_image_item_phash_distance (guint64 phash,
+                                   guint64 other)
+{
+    guint distance = 0;
+
+    for (guint64 diff = phash ^ other; diff; diff &= diff - 1)
+        ++distance;
+
+    return distance;
+}
+
+static gboolean
+g_paste_image_item_persist_done (gpointer user_data)
+{
+    GPasteImageItemPersistJob *job = user_data;
+    GPasteImageItem *self = job->self;
+    GPasteImageItemPrivate *priv = self->priv;
+
+    if (job->failed)
+    {
+        /* Still not on disk: the pixbuf or PNG we hold stays the only copy */
+        g_signal_emit (self,
+                       signals[PERSIST_FAILED],
+                       0); /* detail */
+    }
+    else
+    {
+        priv->persisted = TRUE;
+        if (job->file_size)
+            priv->file_size = job->file_size;
+        if (job->has_phash)
+            g_paste_image_item_set_phash (self, job->phash);
+        if (priv->png)
+        {
+            g_bytes_unref (priv->png);
+            priv->png = NULL;
+        }
+
+        g_signal_emit (self,
+                       signals[PERSISTED],
+                       0); /* detail */
+    }
+
+    g_object_unref (self);
+    g_free (job->path);
+    g_free (job->thumbnail_path);
+    g_slice_free (GPasteImageItemPersistJob, job);
+
+    return FALSE;
+}
+
+static void
+g_paste_image_item_persist_worker (gpointer data,
+                                   gpointer user_data G_GNUC_UNUSED)
+{
+    GPasteImageItemPersistJob *job = data;
+    GError *error = NULL;
+    /* Nothing to write, we're only here for the perceptual hash */
+    gboolean on_disk = (!job->image && !job->png);
+    GdkPixbuf *existing;
+
+    if (job->image)
+    {
+        gchar *buffer;
+        gsize length;
+        gchar *compression = g_strdup_printf ("%u", job->compression_level);
+
+        if (gdk_pixbuf_save_to_buffer (job->image,
+                                       &buffer,
+                                       &length,
+                                       "png",
+                                       &error,
+                                       "compression", compression,
+                                       NULL))
+        {
+            job->png = g_bytes_new_take (buffer, length);
+        }
+        g_free (compression);
+    }
+
+    if (job->png)
+    {
+        gsize length;
+        const gchar *data = g_bytes_get_data (job->png, &length);
+
+        /* g_file_set_contents writes a temporary file and renames it, readers never see half an image */
+        if (g_file_set_contents (job->path,
+                                 data,
+                                 length,
+                                 &error))
+        {
+            job->file_size = length;
+        }
+        g_bytes_unref (job->png);
+    }
+
+    if (error)
+    {
+        g_warning ("%s: %s", job->path, error->message);
+        g_error_free (error);
+        job->failed = TRUE;
+    }
+    else if (on_disk && (existing = gdk_pixbuf_new_from_file (job->thumbnail_path, NULL))) /* Error */
+    {
+        /* Written along with the image, no need to decode the full one */
+        job->has_phash = g_paste_image_item_compute_phash (existing, &job->phash);
+        g_object_unref (existing);
+    }
+    else
+    {
+        /* History listings only ever need this small preview */
+        GdkPixbuf *image = (job->image) ? g_object_ref (job->image) : gdk_pixbuf_new_from_file (job->path, NULL); /* Error */
+
+        if (image)
+        {
+            GdkPixbuf *thumbnail = g_paste_image_item_scale_thumbnail (image);
+
+            gchar *buffer;
+            gsize length;
+
+            /* Thumbnails are mapped and sent as is, never truncate one in place */
+            if (gdk_pixbuf_save_to_buffer (thumbnail,
+                                           &buffer,
+                                           &length,
+                                           "png",
+                                           NULL, /* Error */
+                                           NULL))
+            {
+                g_file_set_contents (job->thumbnail_path, buffer, length, NULL); /* Error */
+                g_free (buffer);
+            }
+            /* The thumbnail has all the detail a 9x8 hash needs */
+            job->has_phash = g_paste_image_item_compute_phash (thumbnail, &job->phash);
+            g_object_unref (thumbnail);
+            g_object_unref (image);
+        }
+    }
+
+    if (job->image)
+        g_object_unref (job->image);
+
+    g_idle_add (g_paste_image_item_persist_done, job);
+}
+
+/* Hand the file over to the worker pool, the item is usable right away */
+static void
+g_paste_image_item_persist (GPasteImageItem *self,
+                            GdkPixbuf       *image,
+                            GBytes          *png,
+                            guint32          compression_level)
+{
+    static gsize initialized = 0;
+
+    if (g_once_init_enter (&initialized))
+    {
+        persist_pool = g_thread_pool_new (g_paste_image_item_persist_worker,
+                                          NULL, /* user data */
+                                          2, /* max threads */
+                                          FALSE, /* exclusive */
+                                          NULL); /* error */
+        g_once_init_leave (&initialized, 1);
+    }
+
+    GPasteImageItemPersistJob *job = g_slice_new (GPasteImageItemPersistJob);
+
+    job->self = g_object_ref (self);
+    job->path = g_strdup (g_paste_item_get_value (G_PASTE_ITEM (self)));
+    job->thumbnail_path = g_paste_image_item_get_thumbnail_path (self);
+    job->image = (image) ? g_object_ref (image) : NULL;
+    job->png = (png) ? g_bytes_ref (png) : NULL;
+    job->compression_level = compression_level;
+    job->file_size = 0;
+    job->has_phash = FALSE;
+    job->failed = FALSE;
+
+    self->priv->persisted = FALSE;
+
+    g_thread_pool_push (persist_pool, job, NULL); /* error */
+}
+
+static gboolean
+g_paste_image_item_prefetch_done (gpointer user_data)
+{
+    GPasteImageItemPrefetchJob *job = user_data;
+    GPasteImageItem *self = job->self;
+    GPasteImageItemPrivate *priv = self->priv;
+
+    priv->prefetching = FALSE;
+
+    /* Someone may have needed it synchronously in the meantime */
+    if (job->image && !priv->image)
+    {
+        priv->image = job->image;
+        g_paste_image_item_touch (self);
+    }
+    else if (job->image)
+        g_object_unref (job->image);
+
+    g_object_unref (self);
+    g_free (job->path);
+    g_slice_free (GPasteImageItemPrefetchJob, job);
+
+    return FALSE;
+}
+
+static void
+g_paste_image_item_prefetch_worker (gpointer data,
+                                    gpointer user_data G_GNUC_UNUSED)
+{
+    GPasteImageItemPrefetchJob *job = data;
+
+    job->image = gdk_pixbuf_new_from_file (job->path, NULL); /* Error */
+
+    g_idle_add (g_paste_image_item_prefetch_done, job);
+}
+
+/**
+ * g_paste_image_item_prefetch: (skip)
+ * @self: a #GPasteImageItem instance
+ *
+ * Decode the image in the background when it's likely to be needed soon
+ *
+ * Returns:
+ */
+void
+g_paste_image_item_prefetch (GPasteImageItem *self)
+{
+    g_return_if_fail (G_PASTE_IS_IMAGE_ITEM (self));
+
+    GPasteImageItemPrivate *priv = self->priv;
+
+    /* Not on disk yet means still in memory */
+    if (priv->image || priv->prefetching || !priv->persisted || !decoded_budget)
+        return;
+
+    static gsize initialized = 0;
+
+    if (g_once_init_enter (&initialized))
+    {
+        prefetch_pool = g_thread_pool_new (g_paste_image_item_prefetch_worker,
+                                           NULL, /* user data */
+                                           1, /* max threads */
+                                           FALSE, /* exclusive */
+                                           NULL); /* error */
+        g_once_init_leave (&initialized, 1);
+    }
+
+    GPasteImageItemPrefetchJob *job = g_slice_new (GPasteImageItemPrefetchJob);
+
+    job->self = g_object_ref (self);
+    job->path = g_strdup (g_paste_item_get_value (G_PASTE_ITEM (self)));
+    job->image = NULL;
+
+    priv->prefetching = TRUE;
+
+    g_thread_pool_push (prefetch_pool, job, NULL); /* error */
+}
+
+static GBytes *
+g_paste_image_item_encode_thumbnail (GdkPixbuf *image)
+{
+    GdkPixbuf *thumbnail = g_paste_image_item_scale_thumbnail (image);
+    GBytes *ret = NULL;
+    gchar *buffer;
+    gsize length;
+
+    if (gdk_pixbuf_save_to_buffer (thumbnail,
+                                   &buffer,
+                                   &length,
+                                   "png",
+                                   NULL, /* Error */
+                                   NULL))
+    {
+        ret = g_bytes_new_take (buffer, length);
+    }
+
+    g_object_unref (thumbnail);
+
+    return ret;
+}
+
+static GBytes *
+g_paste_image_item_map_thumbnail (const gchar *path)
+{
+    GMappedFile *mapped = g_mapped_file_new (path, FALSE, NULL); /* Error */
+
+    if (!mapped)
+        return NULL;
+
+    return g_bytes_new_with_free_func (g_mapped_file_get_contents (mapped),
+                                       g_mapped_file_get_length (mapped),
+                                       (GDestroyNotify) g_mapped_file_unref,
+                                       mapped);
+}
+
+/**
+ * g_paste_image_item_get_thumbnail:
+ * @self: a #GPasteImageItem instance
+ *
+ * Get a small preview of the image, at most 256 pixels wide or high,
+ * without decoding the full image when the thumbnail already exists
+ *
+ * Returns: (transfer full): the PNG encoded thumbnail, or NULL
+ *          free it with g_bytes_unref
+ */
+G_PASTE_VISIBLE GBytes *
+g_paste_image_item_get_thumbnail (const GPasteImageItem *self)
+{
+    g_return_val_if_fail (G_PASTE_IS_IMAGE_ITEM (self), NULL);
+
+    GPasteImageItemPrivate *priv = self->priv;
+    gchar *path = g_paste_image_item_get_thumbnail_path (self);
+    GBytes *ret = g_paste_image_item_map_thumbnail (path);
+
+    if (!ret)
+    {
+        /* Images from older histories, or still being written: build it now */
+        GdkPixbuf *image;
+
+        /* Don't keep a full size pixbuf around only for that */
+        if (priv->image || !priv->persisted)
+        {
+            image = g_paste_image_item_get_image (self);
+            if (image)
+                g_object_ref (image);
+        }
+        else
+            image = gdk_pixbuf_new_from_file (g_paste_item_get_value (G_PASTE_ITEM (self)), NULL); /* Error */
+
+        if (image)
+        {
+            ret = g_paste_image_item_encode_thumbnail (image);
+
+            /* The worker writes it once the image itself is on disk */
+            if (ret && priv->persisted)
+            {
+                gsize length;
+                const gchar *data = g_bytes_get_data (ret, &length);
+
+                g_file_set_contents (path, data, length, NULL); /* Error */
+            }
+
+            g_object_unref (image);
+        }
+    }
+
+    g_free (path);
+
+    return ret;
+}
+
+static gboolean
+g_paste_image_item_thumbnail_done (gpointer user_data)
+{
+    GPasteImageItemThumbnailJob *job = user_data;
+
+    job->callback (job->self, job->thumbnail, job->user_data);
+
+    if (job->thumbnail)
+        g_bytes_unref (job->thumbnail);
+    g_object_unref (job->self);
+    g_free (job->thumbnail_path);
+    g_free (job->path);
+    g_slice_free (GPasteImageItemThumbnailJob, job);
+
+    return FALSE;
+}
+
+static void
+g_paste_image_item_thumbnail_worker (gpointer data,
+                                     gpointer user_data G_GNUC_UNUSED)
+{
+    GPasteImageItemThumbnailJob *job = data;
+    GdkPixbuf *image = job->image;
+
+    if (!image && job->png)
+        image = g_paste_image_item_decode_png (job->png);
+    if (!image)
+        image = gdk_pixbuf_new_from_file (job->path, NULL); /* Error */
+
+    if (image)
+    {
+        job->thumbnail = g_paste_image_item_encode_thumbnail (image);
+
+        if (job->thumbnail && job->thumbnail_path)
+        {
+            gsize length;
+            const gchar *thumbnail = g_bytes_get_data (job->thumbnail, &length);
+
+            g_file_set_contents (job->thumbnail_path, thumbnail, length, NULL); /* Error */
+        }
+
+        g_object_unref (image);
+    }
+
+    if (job->png)
+        g_bytes_unref (job->png);
+
+    g_idle_add (g_paste_image_item_thumbnail_done, job);
+}
+
+/**
+ * g_paste_image_item_request_thumbnail:
+ * @self: a #GPasteImageItem instance
+ * @callback: (scope async): called from the main loop with the PNG encoded thumbnail, or NULL
+ * @user_data: the data to pass to @callback
+ *
+ * Like g_paste_image_item_get_thumbnail(), but a missing thumbnail gets
+ * built in a thread instead of blocking the caller. @callback is called
+ * right away when the thumbnail already exists
+ *
+ * Returns:
+ */
+G_PASTE_VISIBLE void
+g_paste_image_item_request_thumbnail (const GPasteImageItem       *self,
+                                      GPasteImageItemThumbnailFunc callback,
+                                      gpointer                     user_data)
+{
+    g_return_if_fail (G_PASTE_IS_IMAGE_ITEM (self));
+    g_return_if_fail (callback != NULL);
+
+    GPasteImageItemPrivate *priv = self->priv;
+    gchar *thumbnail_path = g_paste_image_item_get_thumbnail_path (self);
+    GBytes *thumbnail = g_paste_image_item_map_thumbnail (thumbnail_path);
+
+    if (thumbnail)
+    {
+        callback (self, thumbnail, user_data);
+        g_bytes_unref (thumbnail);
+        g_free (thumbnail_path);
+        return;
+    }
+
+    static gsize initialized = 0;
+
+    if (g_once_init_enter (&initialized))
+    {
+        thumbnail_pool = g_thread_pool_new (g_paste_image_item_thumbnail_worker,
+                                            NULL, /* user data */
+                                            1, /* max threads */
+                                            FALSE, /* exclusive */
+                                            NULL); /* error */
+        g_once_init_leave (&initialized, 1);
+    }
+
+    GPasteImageItemThumbnailJob *job = g_slice_new (GPasteImageItemThumbnailJob);
+
+    job->self = g_object_ref ((gpointer) self);
+    job->path = g_strdup (g_paste_item_get_value (G_PASTE_ITEM (self)));
+    /* The worker writes it once the image itself is on disk */
+    job->thumbnail_path = (priv->persisted) ? thumbnail_path : NULL;
+    /* Pixbufs are never modified once built, the thread can read this one */
+    job->image = (priv->image) ? g_object_ref (priv->image) : NULL;
+    job->png = (priv->png) ? g_bytes_ref (priv->png) : NULL;
+    job->thumbnail = NULL;
+    job->callback = callback;
+    job->user_data = user_data;
+
+    if (!priv->persisted)
+        g_free (thumbnail_path);
+
+    g_thread_pool_push (thumbnail_pool, job, NULL); /* error */
 }
 
 /**
@@ -221,40 +1233,149 @@ _g_paste_image_item_new (const gchar *path,
 G_PASTE_VISIBLE GPasteImageItem *
 g_paste_image_item_new (GdkPixbuf *img)
 {
-    g_return_val_if_fail (GDK_IS_PIXBUF (img), NULL);
-
-    guint length;
-    const guchar *data = gdk_pixbuf_get_pixels_with_length (img,
-                                                            &length);
-    gchar *checksum = g_compute_checksum_for_data (G_CHECKSUM_SHA256,
-                                                   data,
-                                                   length);
-    gchar *images_dir_path = g_build_filename (g_get_user_data_dir (), "gpaste", "images", NULL);
-    GFile *images_dir = g_file_new_for_path (images_dir_path);
+    return g_paste_image_item_new_with_checksum (img, NULL, 6); /* compression level */
+}
 
-    if (!g_file_query_exists (images_dir, NULL))
-        mkdir (images_dir_path, (mode_t) 0700);
-    g_object_unref (images_dir);
+/**
+ * g_paste_image_item_new_with_checksum: (skip)
+ * @img: (transfer none): the GdkPixbuf we want to be contained in the #GPasteImageItem
+ * @checksum: (allow-none): the fingerprint of @img if already computed
+ * @compression_level: the zlib compression level of the PNG file
+ *
+ * Create a new instance of #GPasteImageItem without hashing the pixels
+ * again when the caller already did it
+ * The PNG file gets written in the background
+ *
+ * Returns: a newly allocated #GPasteImageItem
+ *          free it with g_object_unref
+ */
+GPasteImageItem *
+g_paste_image_item_new_with_checksum (GdkPixbuf   *img,
+                                      const gchar *checksum,
+                                      guint32      compression_level)
+{
+    g_return_val_if_fail (GDK_IS_PIXBUF (img), NULL);
 
-    gchar *filename = g_strconcat (checksum, ".png", NULL);
-    gchar *path = g_build_filename (images_dir_path, filename, NULL);
+    gchar *_checksum = (checksum) ? g_strdup (checksum) : g_paste_image_item_compute_checksum (img);
+    gchar *path = g_paste_image_item_get_path_for_checksum (_checksum);
     GPasteImageItem *self = _g_paste_image_item_new (path,
                                                      g_date_time_new_now_local (),
                                                      g_object_ref (img),
-                                                     checksum);
-    g_free (images_dir_path);
-    g_free (filename);
+                                                     _checksum);
     g_free (path);
 
-    gdk_pixbuf_save (img,
-                     g_paste_item_get_value (G_PASTE_ITEM (self)),
-                     "png",
-                     NULL, /* Error */
-                     NULL); /* Params */
+    g_paste_image_item_persist (self,
+                                img,
+                                NULL, /* PNG */
+                                compression_level);
 
     return self;
 }
 
+/* Read the dimensions from the IHDR chunk, which always comes first */
+static gboolean
+g_paste_image_item_png_get_size (const guchar *png,
+                                 gsize         length,
+                                 gint         *width,
+                                 gint         *height)
+{
+    static const guchar signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+    if (length < 24 || memcmp (png, signature, 8) != 0 || memcmp (png + 12, "IHDR", 4) != 0)
+        return FALSE;
+
+    *width = (gint) (((guint32) png[16] << 24) | ((guint32) png[17] << 16) | ((guint32) png[18] << 8) | png[19]);
+    *height = (gint) (((guint32) png[20] << 24) | ((guint32) png[21] << 16) | ((guint32) png[22] << 8) | png[23]);
+
+    return TRUE;
+}
+
+/**
+ * g_paste_image_item_new_from_png:
+ * @png: (transfer none): the PNG encoded image
+ * @checksum: (allow-none): the pixel fingerprint of @png if already known
+ *
+ * Create a new instance of #GPasteImageItem, storing @png as-is
+ * The image isn't re-encoded, the file gets written in the background.
+ * It is named after its pixels like any other image, so that the same
+ * picture captured as a pixbuf or as a PNG is only stored once
+ *
+ * Returns: a newly allocated #GPasteImageItem
+ *          free it with g_object_unref
+ */
+G_PASTE_VISIBLE GPasteImageItem *
+g_paste_image_item_new_from_png (GBytes      *png,
+                                 const gchar *checksum)
+{
+    g_return_val_if_fail (png != NULL, NULL);
+
+    gsize length;
+    const guchar *data = g_bytes_get_data (png, &length);
+    gint width, height;
+
+    g_return_val_if_fail (g_paste_image_item_png_get_size (data, length, &width, &height), NULL);
+
+    gchar *_checksum = g_strdup (checksum);
+
+    if (!_checksum)
+    {
+        GdkPixbuf *image = g_paste_image_item_decode_png (png);
+
+        g_return_val_if_fail (image, NULL);
+        _checksum = g_paste_image_item_compute_checksum (image);
+        g_object_unref (image);
+    }
+
+    gchar *path = g_paste_image_item_get_path_for_checksum (_checksum);
+    GPasteImageItem *self = _g_paste_image_item_new (path,
+                                                     g_date_time_new_now_local (),
+                                                     NULL, /* GdkPixbuf */
+                                                     NULL); /* Checksum */
+
+    g_paste_image_item_set_checksum (self, _checksum);
+    g_paste_image_item_set_size (self, width, height);
+    self->priv->file_size = length;
+
+    /* Same checksum, same content: no need to write it again, only to hash its thumbnail */
+    if (!g_file_test (path, G_FILE_TEST_EXISTS))
+        self->priv->png = g_bytes_ref (png);
+    g_paste_image_item_persist (self,
+                                NULL, /* GdkPixbuf */
+                                self->priv->png,
+                                0); /* compression level, already encoded */
+    g_free (path);
+
+    return self;
+}
+
+/* Histories written before the metadata was saved: the IHDR chunk and a stat are enough */
+static void
+g_paste_image_item_read_metadata (GPasteImageItem *self,
+                                  const gchar     *path)
+{
+    GPasteImageItemPrivate *priv = self->priv;
+    FILE *file = g_fopen (path, "rb");
+
+    if (!file)
+        return;
+
+    guchar header[24];
+    gint width, height;
+
+    if (fread (header, 1, sizeof (header), file) == sizeof (header) &&
+        g_paste_image_item_png_get_size (header, sizeof (header), &width, &height))
+    {
+        g_paste_image_item_set_size (self, width, height);
+    }
+
+    GStatBuf st;
+
+    if (fstat (fileno (file), &st) == 0)
+        priv->file_size = (gsize) st.st_size;
+
+    fclose (file);
+}
+
 /**
  * g_paste_image_item_new_from_file:
  * @path: the path to the image we want to be contained in the #GPasteImageItem
@@ -268,13 +1389,56 @@ g_paste_image_item_new (GdkPixbuf *img)
 G_PASTE_VISIBLE GPasteImageItem *
 g_paste_image_item_new_from_file (const gchar *path,
                                   GDateTime   *date)
+{
+    return g_paste_image_item_new_from_file_full (path,
+                                                  date,
+                                                  NULL, /* checksum */
+                                                  0, /* width */
+                                                  0, /* height */
+                                                  0); /* file size */
+}
+
+/**
+ * g_paste_image_item_new_from_file_full: (skip)
+ * @path: the path to the image we want to be contained in the #GPasteImageItem
+ * @date: (transfer none): the date at which the image was created
+ * @checksum: (allow-none): the checksum saved along with the history
+ * @width: the saved width, 0 if unknown
+ * @height: the saved height, 0 if unknown
+ * @file_size: the saved size of the file, 0 if unknown
+ *
+ * Create a new instance of #GPasteImageItem from what the history file
+ * knows about it, the image is only read if something is missing
+ *
+ * Returns: a newly allocated #GPasteImageItem
+ *          free it with g_object_unref
+ */
+GPasteImageItem *
+g_paste_image_item_new_from_file_full (const gchar *path,
+                                       GDateTime   *date,
+                                       const gchar *checksum,
+                                       gint         width,
+                                       gint         height,
+                                       gsize        file_size)
 {
     g_return_val_if_fail (path != NULL, NULL);
     g_return_val_if_fail (g_utf8_validate (path, -1, NULL), NULL);
     g_return_val_if_fail (date != NULL, NULL);
 
-    return _g_paste_image_item_new (path,
-                                    g_date_time_ref (date),
-                                    NULL, /* GdkPixbuf */
-                                    NULL); /* Checksum */
+    GPasteImageItem *self = _g_paste_image_item_new (path,
+                                                     g_date_time_ref (date),
+                                                     NULL, /* GdkPixbuf */
+                                                     NULL); /* Checksum */
+
+    g_paste_image_item_set_checksum (self, (checksum) ? g_strdup (checksum) : g_paste_image_item_checksum_from_path (path));
+
+    if (width > 0 && height > 0 && file_size)
+    {
+        g_paste_image_item_set_size (self, width, height);
+        self->priv->file_size = file_size;
+    }
+    else
+        g_paste_image_item_read_metadata (self, path);
+
+    return self;
 }
@@ -43,18 +43,33 @@ G_BEGIN_DECLS
 typedef struct _GPasteImageItem GPasteImageItem;
 typedef struct _GPasteImageItemClass GPasteImageItemClass;
 
+typedef void (*GPasteImageItemThumbnailFunc) (const GPasteImageItem *self,
+                                              GBytes                *thumbnail,
+                                              gpointer               user_data);
+
 #ifdef G_PASTE_COMPILATION
 G_PASTE_VISIBLE
 #endif
 GType g_paste_image_item_get_type (void);
 
-const gchar     *g_paste_image_item_get_checksum (const GPasteImageItem *self);
-const GDateTime *g_paste_image_item_get_date     (const GPasteImageItem *self);
-GdkPixbuf       *g_paste_image_item_get_image    (const GPasteImageItem *self);
+const gchar     *g_paste_image_item_get_checksum  (const GPasteImageItem *self);
+const GDateTime *g_paste_image_item_get_date      (const GPasteImageItem *self);
+GdkPixbuf       *g_paste_image_item_get_image     (const GPasteImageItem *self);
+gint             g_paste_image_item_get_width     (const GPasteImageItem *self);
+gint             g_paste_image_item_get_height    (const GPasteImageItem *self);
+gsize            g_paste_image_item_get_file_size (const GPasteImageItem *self);
+GBytes          *g_paste_image_item_get_thumbnail (const GPasteImageItem *self);
+gboolean         g_paste_image_item_is_persisted  (const GPasteImageItem *self);
+
+void             g_paste_image_item_request_thumbnail (const GPasteImageItem       *self,
+                                                       GPasteImageItemThumbnailFunc callback,
+                                                       gpointer                     user_data);
 
 GPasteImageItem *g_paste_image_item_new           (GdkPixbuf *img);
 GPasteImageItem *g_paste_image_item_new_from_file (const gchar *path,
                                                    GDateTime   *date);
+GPasteImageItem *g_paste_image_item_new_from_png  (GBytes      *png,
+                                                   const gchar *checksum);
 
 G_END_DECLS
 
@@ -42,6 +42,7 @@ struct _GPasteItemClass
     /*< virtual >*/
     gboolean (*equals) (const GPasteItem *self,
                         const GPasteItem *other);
+    gchar *(*build_display_string) (const GPasteItem *self);
 
     /*< pure virtual >*/
     gboolean (*has_value) (const GPasteItem *self);
@@ -52,9 +53,29 @@ struct _GPasteItemClass
 
 void g_paste_item_set_display_string (GPasteItem  *self,
                                       const gchar *display_string);
+void g_paste_item_get_fingerprint    (const GPasteItem *self,
+                                      gsize            *size,
+                                      guint64          *hash);
+void g_paste_item_set_fingerprint    (GPasteItem *self,
+                                      gsize       size,
+                                      guint64     hash);
 
-GPasteItem *g_paste_item_new (GType        type,
-                              const gchar *value);
+gboolean    g_paste_item_set_delta_base  (GPasteItem *self,
+                                          GPasteItem *base);
+GPasteItem *g_paste_item_get_delta_base  (const GPasteItem *self);
+void        g_paste_item_compress        (GPasteItem *self);
+GBytes     *g_paste_item_get_compressed  (const GPasteItem *self);
+GBytes     *g_paste_item_ref_value_bytes (const GPasteItem *self);
+
+gboolean g_paste_item_validate_text (GBytes *text);
+
+GPasteItem *g_paste_item_new            (GType        type,
+                                         const gchar *value);
+GPasteItem *g_paste_item_new_from_bytes (GType        type,
+                                         GBytes      *value);
+GPasteItem *g_paste_item_new_compressed (GType        type,
+                                         GBytes      *compressed,
+                                         gsize        size);
 
 G_END_DECLS
 
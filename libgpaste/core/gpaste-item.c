@@ -18,17 +18,197 @@
  */
 
 #include "gpaste-item-private.h"
+#include "gpaste-text-kernel.h"
+
+#include <gio/gio.h>
+#include <string.h>
 
 #define G_PASTE_ITEM_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE ((obj), G_PASTE_TYPE_ITEM, GPasteItemPrivate))
 
+/* How many packed values we keep unpacked besides the active one */
+#define G_PASTE_ITEM_UNPACKED_CACHE_SIZE 8
+/* Don't bother with a delta saving less than that */
+#define G_PASTE_ITEM_DELTA_MIN_SAVING 64
+
 G_DEFINE_ABSTRACT_TYPE (GPasteItem, g_paste_item, G_TYPE_OBJECT)
 
 struct _GPasteItemPrivate
 {
-    gchar *value;
-    gchar *display_string;
+    GBytes     *value; /* NULL while the value only exists packed */
+    gchar      *display_string;
+    gboolean    display_string_built; /* NULL then means the value itself */
+
+    /* Fingerprint, computed once */
+    gsize       size;
+    guint64     hash;
+
+    /* Packed as a delta: base[0, prefix) + middle + base[-suffix, end) */
+    GPasteItem *delta_base;
+    GBytes     *delta_middle;
+    gsize       delta_prefix;
+    gsize       delta_suffix;
+
+    /* Packed with raw deflate */
+    GBytes     *compressed;
+
+    gboolean    active;
+    GList      *unpacked_link;
 };
 
+/* Packed items whose value is unpacked, most recently used first */
+static GQueue unpacked_items = G_QUEUE_INIT;
+static guint unpacked_trim_source = 0;
+
+static gboolean
+g_paste_item_is_packed (const GPasteItemPrivate *priv)
+{
+    return priv->delta_base != NULL || priv->compressed != NULL;
+}
+
+static GBytes *
+g_paste_item_convert (GConverter *converter,
+                      GBytes     *input,
+                      gsize       output_size)
+{
+    gsize input_size, input_offset = 0, output_offset = 0;
+    const guchar *input_data = g_bytes_get_data (input, &input_size);
+    guchar *output = g_malloc (output_size);
+    GError *error = NULL;
+
+    for (;;)
+    {
+        gsize bytes_read, bytes_written;
+        GConverterResult result = g_converter_convert (converter,
+                                                       input_data + input_offset,
+                                                       input_size - input_offset,
+                                                       output + output_offset,
+                                                       output_size - output_offset,
+                                                       G_CONVERTER_INPUT_AT_END,
+                                                       &bytes_read,
+                                                       &bytes_written,
+                                                       &error);
+
+        if (result == G_CONVERTER_ERROR)
+        {
+            if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NO_SPACE))
+            {
+                g_error_free (error);
+                g_free (output);
+                return NULL;
+            }
+            g_clear_error (&error);
+            output_size *= 2;
+            output = g_realloc (output, output_size);
+            continue;
+        }
+
+        input_offset += bytes_read;
+        output_offset += bytes_written;
+
+        if (result == G_CONVERTER_FINISHED)
+            break;
+        if (output_offset == output_size)
+        {
+            output_size *= 2;
+            output = g_realloc (output, output_size);
+        }
+    }
+
+    return g_bytes_new_take (g_realloc (output, output_offset), output_offset);
+}
+
+static GBytes *
+g_paste_item_inflate (GBytes *compressed,
+                      gsize   size)
+{
+    GConverter *decompressor = G_CONVERTER (g_zlib_decompressor_new (G_ZLIB_COMPRESSOR_FORMAT_RAW));
+    GBytes *value = g_paste_item_convert (decompressor, compressed, MAX (size, 64));
+
+    g_object_unref (decompressor);
+
+    return value;
+}
+
+/* Only drop values once back in the main loop, so that the pointers we gave stay valid until then */
+static gboolean
+g_paste_item_trim_unpacked (gpointer user_data G_GNUC_UNUSED)
+{
+    while (g_queue_get_length (&unpacked_items) > G_PASTE_ITEM_UNPACKED_CACHE_SIZE)
+    {
+        GPasteItemPrivate *priv = g_queue_pop_tail (&unpacked_items);
+
+        priv->unpacked_link = NULL;
+        g_bytes_unref (priv->value);
+        priv->value = NULL;
+    }
+
+    unpacked_trim_source = 0;
+
+    return FALSE;
+}
+
+static void
+g_paste_item_touch_unpacked (GPasteItemPrivate *priv)
+{
+    if (priv->unpacked_link)
+    {
+        g_queue_unlink (&unpacked_items, priv->unpacked_link);
+        g_queue_push_head_link (&unpacked_items, priv->unpacked_link);
+    }
+    else
+    {
+        g_queue_push_head (&unpacked_items, priv);
+        priv->unpacked_link = unpacked_items.head;
+    }
+
+    if (!unpacked_trim_source && g_queue_get_length (&unpacked_items) > G_PASTE_ITEM_UNPACKED_CACHE_SIZE)
+        unpacked_trim_source = g_idle_add (g_paste_item_trim_unpacked, NULL);
+}
+
+static void
+g_paste_item_forget_unpacked (GPasteItemPrivate *priv)
+{
+    if (priv->unpacked_link)
+    {
+        g_queue_delete_link (&unpacked_items, priv->unpacked_link);
+        priv->unpacked_link = NULL;
+    }
+}
+
+static GBytes *
+g_paste_item_unpack (const GPasteItemPrivate *priv)
+{
+    if (priv->compressed)
+        return g_paste_item_inflate (priv->compressed, priv->size);
+
+    gsize base_size, middle_size;
+    const gchar *base = g_bytes_get_data (g_paste_item_get_value_bytes (priv->delta_base), &base_size);
+    const gchar *middle = g_bytes_get_data (priv->delta_middle, &middle_size);
+    gchar *value = g_malloc (priv->size);
+
+    memcpy (value, base, priv->delta_prefix);
+    memcpy (value + priv->delta_prefix, middle, middle_size);
+    memcpy (value + priv->delta_prefix + middle_size, base + base_size - priv->delta_suffix, priv->delta_suffix);
+
+    return g_bytes_new_take (value, priv->size);
+}
+
+static GBytes *
+g_paste_item_ensure_value (const GPasteItem *self)
+{
+    GPasteItemPrivate *priv = self->priv;
+
+    if (!g_paste_item_is_packed (priv))
+        return priv->value;
+
+    if (!priv->value)
+        priv->value = g_paste_item_unpack (priv);
+    if (!priv->active)
+        g_paste_item_touch_unpacked (priv);
+
+    return priv->value;
+}
+
 /**
  * g_paste_item_get_value:
  * @self: a #GPasteItem instance
@@ -42,7 +222,24 @@ g_paste_item_get_value (const GPasteItem *self)
 {
     g_return_val_if_fail (G_PASTE_IS_ITEM (self), NULL);
 
-    return self->priv->value;
+    return g_bytes_get_data (g_paste_item_ensure_value (self), NULL);
+}
+
+/**
+ * g_paste_item_get_value_bytes:
+ * @self: a #GPasteItem instance
+ *
+ * Get the buffer holding the value of the given item
+ * The buffer is shared and immutable, its size includes the trailing NUL
+ *
+ * Returns: (transfer none): the #GBytes holding the value
+ */
+G_PASTE_VISIBLE GBytes *
+g_paste_item_get_value_bytes (const GPasteItem *self)
+{
+    g_return_val_if_fail (G_PASTE_IS_ITEM (self), NULL);
+
+    return g_paste_item_ensure_value (self);
 }
 
 /**
@@ -59,9 +256,18 @@ g_paste_item_get_display_string (const GPasteItem *self)
     g_return_val_if_fail (G_PASTE_IS_ITEM (self), NULL);
 
     GPasteItemPrivate *priv = self->priv;
+    GPasteItemClass *klass = G_PASTE_ITEM_GET_CLASS (self);
+
+    /* Built the first time it's needed, then kept */
+    if (!priv->display_string && !priv->display_string_built && klass->build_display_string)
+    {
+        priv->display_string = klass->build_display_string (self);
+        priv->display_string_built = TRUE;
+    }
+
     const gchar *display_string = priv->display_string;
 
-    return (display_string) ? display_string : priv->value;
+    return (display_string) ? display_string : g_bytes_get_data (g_paste_item_ensure_value (self), NULL);
 }
 
 /**
@@ -80,6 +286,13 @@ g_paste_item_equals (const GPasteItem *self,
     g_return_val_if_fail (G_PASTE_IS_ITEM (self), FALSE);
     g_return_val_if_fail (G_PASTE_IS_ITEM (other), FALSE);
 
+    GPasteItemPrivate *priv = self->priv;
+    GPasteItemPrivate *other_priv = other->priv;
+
+    /* Items with different fingerprints can't be equal, no need to look at their content */
+    if (priv->size != other_priv->size || priv->hash != other_priv->hash)
+        return FALSE;
+
     return G_PASTE_ITEM_GET_CLASS (self)->equals (self, other);
 }
 
@@ -113,6 +326,42 @@ g_paste_item_set_display_string (GPasteItem  *self,
 
     g_free (priv->display_string);
     priv->display_string = g_strdup (display_string);
+    /* Unsetting it has it built again */
+    priv->display_string_built = FALSE;
+}
+
+/**
+ * g_paste_item_get_fingerprint: (skip)
+ */
+void
+g_paste_item_get_fingerprint (const GPasteItem *self,
+                              gsize            *size,
+                              guint64          *hash)
+{
+    g_return_if_fail (G_PASTE_IS_ITEM (self));
+
+    GPasteItemPrivate *priv = self->priv;
+
+    if (size)
+        *size = priv->size;
+    if (hash)
+        *hash = priv->hash;
+}
+
+/**
+ * g_paste_item_set_fingerprint: (skip)
+ */
+void
+g_paste_item_set_fingerprint (GPasteItem *self,
+                              gsize       size,
+                              guint64     hash)
+{
+    g_return_if_fail (G_PASTE_IS_ITEM (self));
+
+    GPasteItemPrivate *priv = self->priv;
+
+    priv->size = size;
+    priv->hash = hash;
 }
 
 /**
@@ -130,15 +379,140 @@ g_paste_item_set_state (GPasteItem     *self,
 {
     g_return_if_fail (G_PASTE_IS_ITEM (self));
 
+    GPasteItemPrivate *priv = self->priv;
+
+    /* The active item keeps its value unpacked, the others go back to the cache */
+    priv->active = (state == G_PASTE_ITEM_STATE_ACTIVE);
+    if (priv->active)
+        g_paste_item_forget_unpacked (priv);
+    else if (priv->value && g_paste_item_is_packed (priv))
+        g_paste_item_touch_unpacked (priv);
+
     G_PASTE_ITEM_GET_CLASS (self)->set_state (self, state);
 }
 
+/**
+ * g_paste_item_set_delta_base: (skip)
+ */
+gboolean
+g_paste_item_set_delta_base (GPasteItem *self,
+                             GPasteItem *base)
+{
+    g_return_val_if_fail (G_PASTE_IS_ITEM (self), FALSE);
+    g_return_val_if_fail (G_PASTE_IS_ITEM (base), FALSE);
+
+    GPasteItemPrivate *priv = self->priv;
+
+    /* Deltas always apply to a full value, never to another delta */
+    if (base->priv->delta_base)
+        base = base->priv->delta_base;
+    if (base == self || g_paste_item_is_packed (priv))
+        return FALSE;
+
+    gsize base_size, size, prefix, suffix;
+    const gchar *base_value = g_bytes_get_data (g_paste_item_get_value_bytes (base), &base_size);
+    const gchar *value = g_bytes_get_data (priv->value, &size);
+
+    g_paste_text_kernel_common_affixes (base_value, base_size, value, size, &prefix, &suffix);
+
+    if (prefix + suffix < G_PASTE_ITEM_DELTA_MIN_SAVING || (prefix + suffix) * 2 < size)
+        return FALSE;
+
+    priv->delta_base = g_object_ref (base);
+    priv->delta_middle = g_bytes_new (value + prefix, size - prefix - suffix);
+    priv->delta_prefix = prefix;
+    priv->delta_suffix = suffix;
+
+    if (!priv->active)
+        g_paste_item_touch_unpacked (priv);
+
+    return TRUE;
+}
+
+/**
+ * g_paste_item_get_delta_base: (skip)
+ */
+GPasteItem *
+g_paste_item_get_delta_base (const GPasteItem *self)
+{
+    g_return_val_if_fail (G_PASTE_IS_ITEM (self), NULL);
+
+    return self->priv->delta_base;
+}
+
+/**
+ * g_paste_item_compress: (skip)
+ */
+void
+g_paste_item_compress (GPasteItem *self)
+{
+    g_return_if_fail (G_PASTE_IS_ITEM (self));
+
+    GPasteItemPrivate *priv = self->priv;
+
+    if (g_paste_item_is_packed (priv))
+        return;
+
+    /* Favour speed, cold items are mostly logs and code which shrink a lot anyway */
+    GConverter *compressor = G_CONVERTER (g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_RAW, 1));
+    GBytes *compressed = g_paste_item_convert (compressor, priv->value, priv->size / 4 + 64);
+
+    g_object_unref (compressor);
+
+    if (!compressed)
+        return;
+    /* Not worth unpacking on each read */
+    if (g_bytes_get_size (compressed) > priv->size - priv->size / 8)
+    {
+        g_bytes_unref (compressed);
+        return;
+    }
+
+    priv->compressed = compressed;
+    if (!priv->active)
+        g_paste_item_touch_unpacked (priv);
+}
+
+/**
+ * g_paste_item_get_compressed: (skip)
+ */
+GBytes *
+g_paste_item_get_compressed (const GPasteItem *self)
+{
+    g_return_val_if_fail (G_PASTE_IS_ITEM (self), NULL);
+
+    return self->priv->compressed;
+}
+
+/**
+ * g_paste_item_ref_value_bytes: (skip)
+ */
+GBytes *
+g_paste_item_ref_value_bytes (const GPasteItem *self)
+{
+    g_return_val_if_fail (G_PASTE_IS_ITEM (self), NULL);
+
+    GPasteItemPrivate *priv = self->priv;
+
+    /* Unpack without going through the cache, for one-shot walks over the whole history */
+    return (priv->value) ? g_bytes_ref (priv->value) : g_paste_item_unpack (priv);
+}
+
 static void
 g_paste_item_finalize (GObject *object)
 {
     GPasteItemPrivate *priv = G_PASTE_ITEM (object)->priv;
 
-    g_free (priv->value);
+    g_paste_item_forget_unpacked (priv);
+    if (priv->value)
+        g_bytes_unref (priv->value);
+    if (priv->delta_base)
+    {
+        g_object_unref (priv->delta_base);
+        g_bytes_unref (priv->delta_middle);
+    }
+    if (priv->compressed)
+        g_bytes_unref (priv->compressed);
     g_free (priv->display_string);
 
     G_OBJECT_CLASS (g_paste_item_parent_class)->finalize (object);
@@ -148,7 +522,12 @@ static gboolean
 g_paste_item_default_equals (const GPasteItem *self,
                              const GPasteItem *other)
 {
-    return (g_strcmp0 (self->priv->value, other->priv->value) == 0);
+    GBytes *value = g_paste_item_ensure_value (self);
+    GBytes *other_value = g_paste_item_ensure_value (other);
+
+    /* The fingerprints already matched in g_paste_item_equals */
+    return (value == other_value ||
+            g_bytes_equal (value, other_value));
 }
 
 static void
@@ -163,6 +542,7 @@ g_paste_item_class_init (GPasteItemClass *klass)
     g_type_class_add_private (klass, sizeof (GPasteItemPrivate));
 
     klass->equals = g_paste_item_default_equals;
+    klass->build_display_string = NULL;
     klass->get_kind = NULL;
     klass->set_state = g_paste_item_default_set_state;
 
@@ -176,17 +556,81 @@ g_paste_item_init (GPasteItem *self)
 }
 
 /**
- * g_paste_item_new: (skip)
+ * g_paste_item_validate_text: (skip)
+ */
+gboolean
+g_paste_item_validate_text (GBytes *text)
+{
+    g_return_val_if_fail (text != NULL, FALSE);
+
+    gsize size;
+    const gchar *data = g_bytes_get_data (text, &size);
+
+    return (size > 0 &&
+            data[size - 1] == '\0' &&
+            g_paste_text_kernel_validate_utf8 (data, size - 1));
+}
+
+/**
+ * g_paste_item_new_from_bytes: (skip)
  */
 GPasteItem *
-g_paste_item_new (GType        type,
-                  const gchar *value)
+g_paste_item_new_from_bytes (GType   type,
+                             GBytes *value)
 {
     GPasteItem *self = g_object_new (type, NULL);
     GPasteItemPrivate *priv = self->priv;
 
-    priv->value = g_strdup (value);
+    gsize size;
+    gconstpointer data = g_bytes_get_data (value, &size);
+
+    priv->value = g_bytes_ref (value);
     priv->display_string = NULL;
+    priv->size = size;
+    priv->hash = g_paste_text_kernel_hash (data, size);
+
+    return self;
+}
+
+/**
+ * g_paste_item_new_compressed: (skip)
+ */
+GPasteItem *
+g_paste_item_new_compressed (GType   type,
+                             GBytes *compressed,
+                             gsize   size)
+{
+    GBytes *value = g_paste_item_inflate (compressed, size);
+
+    if (!value)
+        return NULL;
+
+    GPasteItem *self = NULL;
+
+    /* Only keep the compressed form of what was checked to be a valid text */
+    if (g_paste_item_validate_text (value))
+    {
+        self = g_paste_item_new_from_bytes (type, value);
+        self->priv->compressed = g_bytes_ref (compressed);
+        g_paste_item_touch_unpacked (self->priv);
+    }
+
+    g_bytes_unref (value);
+
+    return self;
+}
+
+/**
+ * g_paste_item_new: (skip)
+ */
+GPasteItem *
+g_paste_item_new (GType        type,
+                  const gchar *value)
+{
+    GBytes *bytes = g_bytes_new (value, strlen (value) + 1);
+    GPasteItem *self = g_paste_item_new_from_bytes (type, bytes);
+
+    g_bytes_unref (bytes);
 
     return self;
 }
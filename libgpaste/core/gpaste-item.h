@@ -54,6 +54,7 @@ G_PASTE_VISIBLE
 GType g_paste_item_get_type (void);
 
 const gchar *g_paste_item_get_value          (const GPasteItem *self);
+GBytes      *g_paste_item_get_value_bytes    (const GPasteItem *self);
 const gchar *g_paste_item_get_display_string (const GPasteItem *self);
 gboolean     g_paste_item_equals             (const GPasteItem *self,
                                               const GPasteItem *other);
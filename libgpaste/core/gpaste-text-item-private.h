@@ -35,6 +35,10 @@ struct _GPasteTextItemClass
     GPasteItemClass parent_class;
 };
 
+void   g_paste_text_item_set_preview_size (guint32 preview_size);
+gchar *g_paste_text_item_get_preview      (const gchar *text,
+                                           gsize        length);
+
 G_END_DECLS
 
 #endif /*__G_PASTE_TEXT_ITEM_PRIVATE_H__*/
@@ -19,8 +19,80 @@
 
 #include "gpaste-text-item-private.h"
 
+#include <string.h>
+
+/* Used when element-size is 0, listings never get whole big texts */
+#define G_PASTE_TEXT_ITEM_MAX_PREVIEW_SIZE 4096
+
 G_DEFINE_TYPE (GPasteTextItem, g_paste_text_item, G_PASTE_TYPE_ITEM)
 
+/* Follows the element-size setting, in characters */
+static guint32 g_paste_text_item_preview_size = 60;
+
+/**
+ * g_paste_text_item_set_preview_size: (skip)
+ */
+void
+g_paste_text_item_set_preview_size (guint32 preview_size)
+{
+    g_paste_text_item_preview_size = preview_size;
+}
+
+/**
+ * g_paste_text_item_get_preview: (skip)
+ *
+ * Returns: the text on a single line, ellipsized past the preview size,
+ *          or NULL if it's already short and on a single line
+ */
+gchar *
+g_paste_text_item_get_preview (const gchar *text,
+                               gsize        length)
+{
+    guint32 preview_size = (g_paste_text_item_preview_size) ? g_paste_text_item_preview_size : G_PASTE_TEXT_ITEM_MAX_PREVIEW_SIZE;
+    const gchar *end = text + length;
+    const gchar *cut = text;
+    gboolean newlines = FALSE;
+
+    for (guint32 chars = 0; cut < end && chars < preview_size; cut = g_utf8_next_char (cut), ++chars)
+    {
+        if (*cut == '\n')
+            newlines = TRUE;
+    }
+
+    gboolean ellipsized = (cut < end);
+
+    if (!ellipsized && !newlines)
+        return NULL;
+
+    /* Leave room for the ellipsis */
+    if (ellipsized)
+        cut = g_utf8_prev_char (cut);
+
+    gsize preview_length = cut - text;
+    gchar *preview = g_malloc (preview_length + ((ellipsized) ? strlen ("…") : 0) + 1);
+
+    for (gsize i = 0; i < preview_length; ++i)
+        preview[i] = (text[i] == '\n') ? ' ' : text[i];
+    if (ellipsized)
+    {
+        memcpy (preview + preview_length, "…", strlen ("…"));
+        preview_length += strlen ("…");
+    }
+    preview[preview_length] = '\0';
+
+    return preview;
+}
+
+static gchar *
+g_paste_text_item_build_display_string (const GPasteItem *self)
+{
+    gsize size;
+    const gchar *value = g_bytes_get_data (g_paste_item_get_value_bytes (self), &size);
+
+    /* NULL keeps using the value itself */
+    return g_paste_text_item_get_preview (value, size - 1);
+}
+
 static gboolean
 g_paste_text_item_equals (const GPasteItem *self,
                           const GPasteItem *other)
@@ -45,6 +117,7 @@ g_paste_text_item_class_init (GPasteTextItemClass *klass)
     GPasteItemClass *item_class = G_PASTE_ITEM_CLASS (klass);
 
     item_class->equals = g_paste_text_item_equals;
+    item_class->build_display_string = g_paste_text_item_build_display_string;
     item_class->get_kind = g_paste_text_item_get_kind;
 }
 
@@ -70,3 +143,21 @@ g_paste_text_item_new (const gchar *text)
 
     return G_PASTE_TEXT_ITEM (g_paste_item_new (G_PASTE_TYPE_TEXT_ITEM, text));
 }
+
+/**
+ * g_paste_text_item_new_from_bytes:
+ * @text: (transfer none): a NUL-terminated buffer holding the content of the desired #GPasteTextItem
+ *
+ * Create a new instance of #GPasteTextItem sharing the given buffer
+ *
+ * Returns: a newly allocated #GPasteTextItem
+ *          free it with g_object_unref
+ */
+G_PASTE_VISIBLE GPasteTextItem *
+g_paste_text_item_new_from_bytes (GBytes *text)
+{
+    g_return_val_if_fail (text != NULL, NULL);
+    g_return_val_if_fail (g_paste_item_validate_text (text), NULL);
+
+    return G_PASTE_TEXT_ITEM (g_paste_item_new_from_bytes (G_PASTE_TYPE_TEXT_ITEM, text));
+}
@@ -49,7 +49,8 @@ G_PASTE_VISIBLE
 #endif
 GType g_paste_text_item_get_type (void);
 
-GPasteTextItem *g_paste_text_item_new (const gchar *text);
+GPasteTextItem *g_paste_text_item_new            (const gchar *text);
+GPasteTextItem *g_paste_text_item_new_from_bytes (GBytes      *text);
 
 G_END_DECLS
 
@@ -20,6 +20,7 @@
 #include "gpaste-uris-item-private.h"
 
 #include <glib/gi18n-lib.h>
+#include <string.h>
 
 #define G_PASTE_URIS_ITEM_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE ((obj), G_PASTE_TYPE_URIS_ITEM, GPasteUrisItemPrivate))
 
@@ -30,6 +31,26 @@ struct _GPasteUrisItemPrivate
     gchar **uris;
 };
 
+/* Looked up once for the whole process */
+static const gchar *
+g_paste_uris_item_get_home (gsize *length)
+{
+    static volatile gsize home = 0;
+    static gsize home_length = 0;
+
+    if (g_once_init_enter (&home))
+    {
+        const gchar *home_dir = g_get_home_dir ();
+
+        home_length = strlen (home_dir);
+        g_once_init_leave (&home, (gsize) home_dir);
+    }
+
+    *length = home_length;
+
+    return (const gchar *) home;
+}
+
 /**
  * g_paste_uris_item_get_uris:
  * @self: a #GPasteUrisItem instance
@@ -43,7 +64,75 @@ g_paste_uris_item_get_uris (const GPasteUrisItem *self)
 {
     g_return_val_if_fail (G_PASTE_IS_URIS_ITEM (self), FALSE);
 
-    return (const gchar * const *) self->priv->uris;
+    GPasteUrisItemPrivate *priv = self->priv;
+
+    if (priv->uris)
+        return (const gchar * const *) priv->uris;
+
+    gsize size;
+    const gchar *value = g_bytes_get_data (g_paste_item_get_value_bytes (G_PASTE_ITEM (self)), &size);
+    const gchar *end = value + size - 1;
+    guint length = (end > value) ? 1 : 0;
+
+    for (const gchar *path = value; (path = memchr (path, '\n', end - path)); ++path)
+        ++length;
+
+    gchar **uris = g_new (gchar *, length + 1);
+    const gchar *path = value;
+
+    for (guint i = 0; i < length; ++i)
+    {
+        const gchar *eol = memchr (path, '\n', end - path);
+        gsize path_length = ((eol) ? eol : end) - path;
+
+        uris[i] = g_malloc (7 + path_length + 1);
+        memcpy (uris[i], "file://", 7);
+        memcpy (uris[i] + 7, path, path_length);
+        uris[i][7 + path_length] = '\0';
+        path += path_length + 1;
+    }
+    uris[length] = NULL;
+
+    return (const gchar * const *) (priv->uris = uris);
+}
+
+/* Paths under the home dir start with ~, all of them on one line, bounded like texts */
+static gchar *
+g_paste_uris_item_build_display_string (const GPasteItem *self)
+{
+    gsize size, home_length;
+    const gchar *value = g_bytes_get_data (g_paste_item_get_value_bytes (self), &size);
+    const gchar *end = value + size - 1;
+    const gchar *home = g_paste_uris_item_get_home (&home_length);
+    // This is the prefix displayed in history to identify selected files
+    GString *display_string = g_string_sized_new (size + 16);
+
+    g_string_append (display_string, _("[Files] "));
+
+    for (const gchar *c = value; c < end;)
+    {
+        if (home_length && (gsize) (end - c) >= home_length && !memcmp (c, home, home_length))
+        {
+            g_string_append_c (display_string, '~');
+            c += home_length;
+        }
+        else
+        {
+            g_string_append_c (display_string, (*c == '\n') ? ' ' : *c);
+            ++c;
+        }
+    }
+
+    gsize length = display_string->len;
+    gchar *full_display_string = g_string_free (display_string, FALSE);
+    gchar *preview = g_paste_text_item_get_preview (full_display_string, length);
+
+    if (!preview)
+        return full_display_string;
+
+    g_free (full_display_string);
+
+    return preview;
 }
 
 static gboolean
@@ -80,6 +169,7 @@ g_paste_uris_item_class_init (GPasteUrisItemClass *klass)
     GPasteItemClass *item_class = G_PASTE_ITEM_CLASS (klass);
 
     item_class->equals = g_paste_uris_item_equals;
+    item_class->build_display_string = g_paste_uris_item_build_display_string;
     item_class->get_kind = g_paste_uris_item_get_kind;
 
     G_OBJECT_CLASS (klass)->finalize = g_paste_uris_item_finalize;
@@ -91,6 +181,25 @@ g_paste_uris_item_init (GPasteUrisItem *self)
     self->priv = G_PASTE_URIS_ITEM_GET_PRIVATE (self);
 }
 
+/**
+ * g_paste_uris_item_new_from_bytes:
+ * @uris: (transfer none): a NUL-terminated buffer containing the paths separated by "\n"
+ *
+ * Create a new instance of #GPasteUrisItem sharing the given buffer
+ *
+ * Returns: a newly allocated #GPasteUrisItem
+ *          free it with g_object_unref
+ */
+G_PASTE_VISIBLE GPasteUrisItem *
+g_paste_uris_item_new_from_bytes (GBytes *uris)
+{
+    g_return_val_if_fail (uris != NULL, NULL);
+    g_return_val_if_fail (g_paste_item_validate_text (uris), NULL);
+
+    /* The display string and the uris are only built once asked for */
+    return G_PASTE_URIS_ITEM (g_paste_item_new_from_bytes (G_PASTE_TYPE_URIS_ITEM, uris));
+}
+
 /**
  * g_paste_uris_item_new:
  * @uris: a string containing the paths separated by "\n" (as returned by gtk_clipboard_wait_for_uris)
@@ -104,56 +213,12 @@ G_PASTE_VISIBLE GPasteUrisItem *
 g_paste_uris_item_new (const gchar *uris)
 {
     g_return_val_if_fail (uris != NULL, NULL);
-    g_return_val_if_fail (g_utf8_validate (uris, -1, NULL), NULL);
-
-    GPasteItem *g_paste_item = g_paste_item_new (G_PASTE_TYPE_URIS_ITEM, uris);
-    GPasteUrisItem *self = G_PASTE_URIS_ITEM (g_paste_item);
-    GPasteUrisItemPrivate *priv = self->priv;
-
-    gchar *home_escaped = g_regex_escape_string (g_get_home_dir (), -1);
-    GRegex *regex = g_regex_new (home_escaped,
-                                 0, /* Compile options */
-                                 0, /* Match options */
-                                 NULL); /* Error */
-    gchar *display_string_with_newlines = g_regex_replace_literal (regex,
-                                                                   uris,
-                                                                   (gssize) -1,
-                                                                   0, /* Start position */
-                                                                   "~",
-                                                                   0, /* Match options */
-                                                                   NULL); /* Error */
-    g_regex_unref (regex);
-    g_free (home_escaped);
-
-    regex = g_regex_new ("\\n",
-                         0, /* Compile options */
-                         0, /* Match options */
-                         NULL); /* Error */
-    gchar *display_string = g_regex_replace_literal (regex,
-                                                     display_string_with_newlines,
-                                                     (gssize) -1,
-                                                     0, /* Start position */
-                                                     " ",
-                                                     0, /* Match options */
-                                                     NULL); /* Error */
-    g_regex_unref (regex);
-    g_free (display_string_with_newlines);
 
-    // This is the prefix displayed in history to identify selected files
-    gchar *full_display_string = g_strconcat (_("[Files] "), display_string, NULL);
-
-    g_paste_item_set_display_string (g_paste_item, full_display_string);
-    g_free (full_display_string);
-    g_free (display_string);
+    /* Validated once by g_paste_uris_item_new_from_bytes */
+    GBytes *bytes = g_bytes_new (uris, strlen (uris) + 1);
+    GPasteUrisItem *self = g_paste_uris_item_new_from_bytes (bytes);
 
-    gchar **paths = g_strsplit (uris, "\n", 0);
-    guint length = g_strv_length (paths);
-
-    priv->uris = g_new (gchar *, length + 1);
-    for (guint i = 0; i < length; ++i)
-        priv->uris[i] = g_strconcat ("file://", paths[i], NULL);
-    priv->uris[length] = NULL;
-    g_strfreev (paths);
+    g_bytes_unref (bytes);
 
     return self;
 }
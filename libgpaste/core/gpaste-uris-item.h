@@ -49,7 +49,8 @@ GType g_paste_uris_item_get_type (void);
 
 const gchar * const *g_paste_uris_item_get_uris (const GPasteUrisItem *self);
 
-GPasteUrisItem *g_paste_uris_item_new (const gchar *uris);
+GPasteUrisItem *g_paste_uris_item_new            (const gchar *uris);
+GPasteUrisItem *g_paste_uris_item_new_from_bytes (GBytes      *uris);
 
 G_END_DECLS
 
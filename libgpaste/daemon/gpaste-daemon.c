@@ -18,7 +18,10 @@
  */
 
 #include "gpaste-daemon-private.h"
+#include "gpaste-image-item.h"
+#include "gpaste-settings-keys.h"
 #include "gpaste-text-item.h"
+#include "gpaste-text-kernel.h"
 #include "gdbus-defines.h"
 
 #include <glib.h>
@@ -28,6 +31,9 @@
 
 #define DEFAULT_HISTORY "history"
 
+/* Changes happening within that many ms are notified at once */
+#define CHANGED_FRAME 20
+
 G_DEFINE_TYPE (GPasteDaemon, g_paste_daemon, G_TYPE_OBJECT)
 
 #define G_PASTE_SEND_DBUS_SIGNAL_FULL(sig,data,num,error)           \
@@ -43,6 +49,7 @@ G_DEFINE_TYPE (GPasteDaemon, g_paste_daemon, G_TYPE_OBJECT)
 #define G_PASTE_SEND_DBUS_SIGNAL(sig)                  G_PASTE_SEND_DBUS_SIGNAL_FULL(sig, NULL, 0, NULL)
 #define G_PASTE_SEND_DBUS_SIGNAL_WITH_ERROR(sig)       G_PASTE_SEND_DBUS_SIGNAL_FULL(sig, NULL, 0, error)
 #define G_PASTE_SEND_DBUS_SIGNAL_WITH_DATA(sig,data)   G_PASTE_SEND_DBUS_SIGNAL_FULL(sig, &data, 1, NULL)
+#define G_PASTE_SEND_DBUS_SIGNAL_WITH_TUPLE(sig,data)  G_PASTE_SEND_DBUS_SIGNAL_FULL(sig, data, G_N_ELEMENTS (data), NULL)
 
 #define NEW_SIGNAL(name) \
     g_signal_new (name, \
@@ -57,10 +64,14 @@ G_DEFINE_TYPE (GPasteDaemon, g_paste_daemon, G_TYPE_OBJECT)
 
 enum
 {
+    C_ADDED,
     C_CHANGED,
+    C_GARBAGE_COLLECTED,
     C_NAME_LOST,
     C_REEXECUTE_SELF,
     C_TRACK,
+    C_SNAPSHOT_CHANGED,
+    C_SNAPSHOT_SIZE,
 
     C_LAST_SIGNAL
 };
@@ -77,6 +88,18 @@ struct _GPasteDaemonPrivate
     GPasteKeybinder         *keybinder;
     GDBusNodeInfo           *g_paste_daemon_dbus_info;
     GDBusInterfaceVTable     g_paste_daemon_dbus_vtable;
+    GSList                  *gc_invocations;
+    guint64                  generation;
+    guint                    changed_source;
+    GHashTable              *watchers;
+
+    /* Only used when the calls are answered from their own thread */
+    GMainContext            *dbus_context;
+    GMainLoop               *dbus_loop;
+    GThread                 *dbus_thread;
+    GMutex                   snapshot_mutex;
+    GVariant                *history_snapshot;
+    GPtrArray               *values_snapshot;
 
     gulong                   c_signals[C_LAST_SIGNAL];
 };
@@ -110,10 +133,10 @@ g_paste_daemon_send_dbus_reply (GDBusConnection       *connection,
     g_object_unref (reply_message);
 }
 
-static void
-g_paste_daemon_get_history (GPasteDaemon          *self,
-                            GDBusConnection       *connection,
-                            GDBusMethodInvocation *invocation)
+/* Collects the values of the displayed items along the way if @values isn't NULL */
+static GVariant *
+g_paste_daemon_build_history (GPasteDaemon *self,
+                              GPtrArray    *values)
 {
     GPasteDaemonPrivate *priv = self->priv;
     GSList *history = g_paste_history_get_history (priv->history);
@@ -121,13 +144,59 @@ g_paste_daemon_get_history (GPasteDaemon          *self,
     const gchar **displayed_history = g_new (const gchar *, length + 1);
 
     for (guint i = 0; i < length; ++i, history = g_slist_next (history))
+    {
         displayed_history[i] = g_paste_item_get_display_string (history->data);
+        if (values)
+            g_ptr_array_add (values, g_bytes_ref (g_paste_item_get_value_bytes (history->data)));
+    }
     displayed_history[length] = NULL;
 
     GVariant *variant = g_variant_new_strv (displayed_history, -1);
 
     g_free (displayed_history);
-    g_paste_daemon_send_dbus_reply (connection, invocation, g_variant_new_tuple (&variant, 1));
+
+    return g_variant_new_tuple (&variant, 1);
+}
+
+/* Built here, where the items live, for the D-Bus thread to answer from */
+static void
+g_paste_daemon_refresh_snapshot (GPasteDaemon *self,
+                                 gpointer      user_data G_GNUC_UNUSED)
+{
+    GPasteDaemonPrivate *priv = self->priv;
+    GPtrArray *values = g_ptr_array_new_with_free_func ((GDestroyNotify) g_bytes_unref);
+    GVariant *history = g_variant_ref_sink (g_paste_daemon_build_history (self, values));
+
+    g_mutex_lock (&priv->snapshot_mutex);
+    GVariant *old_history = priv->history_snapshot;
+    GPtrArray *old_values = priv->values_snapshot;
+    priv->history_snapshot = history;
+    priv->values_snapshot = values;
+    g_mutex_unlock (&priv->snapshot_mutex);
+
+    if (old_history)
+    {
+        g_variant_unref (old_history);
+        g_ptr_array_unref (old_values);
+    }
+}
+
+static void
+g_paste_daemon_get_history (GPasteDaemon          *self,
+                            GDBusConnection       *connection,
+                            GDBusMethodInvocation *invocation)
+{
+    GPasteDaemonPrivate *priv = self->priv;
+
+    if (priv->dbus_context)
+    {
+        /* The D-Bus thread couldn't answer it, it will next time */
+        if (!priv->history_snapshot)
+            g_paste_daemon_refresh_snapshot (self, NULL);
+        g_paste_daemon_send_dbus_reply (connection, invocation, priv->history_snapshot);
+    }
+    else
+        g_paste_daemon_send_dbus_reply (connection, invocation, g_paste_daemon_build_history (self, NULL));
 }
 
 static gchar *
@@ -227,27 +296,62 @@ g_paste_daemon_list_histories (GDBusConnection       *connection,
     g_paste_daemon_send_dbus_reply (connection, invocation, g_variant_new_tuple (&variant, 1));
 }
 
+static GBytes *
+g_paste_daemon_get_dbus_bytes_parameter (GVariant *parameters)
+{
+    GVariant *variant = g_variant_get_child_value (parameters, 0);
+    gsize length;
+    const gchar *value = g_variant_get_string (variant, &length);
+
+    /* Borrow the serialized string (including its NUL) instead of duplicating it */
+    return g_bytes_new_with_free_func (value,
+                                       length + 1,
+                                       (GDestroyNotify) g_variant_unref,
+                                       variant);
+}
+
 static void
 g_paste_daemon_do_add (GPasteDaemon *self,
-                       gchar        *text,
-                       gsize         length)
+                       GBytes       *text)
 {
     g_return_if_fail (text != NULL);
 
     GPasteDaemonPrivate *priv = self->priv;
     GPasteSettings *settings = priv->settings;
-    gchar *stripped = g_strstrip (g_strdup (text));
+    gsize size;
+    const gchar *data = g_bytes_get_data (text, &size);
+    gsize length = size - 1;
+    gsize start, end;
+
+    g_paste_text_kernel_trim_bounds (data, length, &start, &end);
 
     if (length >= g_paste_settings_get_min_text_item_size (settings) &&
         length <= g_paste_settings_get_max_text_item_size (settings) &&
-        strlen (stripped) != 0)
+        start != end)
     {
-        GPasteTextItem *item = g_paste_text_item_new (g_paste_settings_get_trim_items (settings) ? stripped : text);
-        g_paste_clipboards_manager_select (priv->clipboards_manager, G_PASTE_ITEM (item));
-        g_object_unref (item);
+        GBytes *to_add;
+
+        if (g_paste_settings_get_trim_items (settings) && end - start != length)
+        {
+            gsize stripped_length = end - start;
+            gchar *stripped = g_new (gchar, stripped_length + 1);
+
+            memcpy (stripped, data + start, stripped_length);
+            stripped[stripped_length] = '\0';
+            to_add = g_bytes_new_take (stripped, stripped_length + 1);
+        }
+        else
+            to_add = g_bytes_ref (text);
+
+        GPasteTextItem *item = g_paste_text_item_new_from_bytes (to_add);
+
+        if (item)
+        {
+            g_paste_clipboards_manager_select (priv->clipboards_manager, G_PASTE_ITEM (item));
+            g_object_unref (item);
+        }
+        g_bytes_unref (to_add);
     }
-    g_free (text);
-    g_free (stripped);
 }
 
 static void
@@ -256,10 +360,10 @@ g_paste_daemon_add (GPasteDaemon          *self,
                     GDBusMethodInvocation *invocation,
                     GVariant              *parameters)
 {
-    gsize length;
-    gchar *text = g_paste_daemon_get_dbus_string_parameter (parameters, &length);
+    GBytes *text = g_paste_daemon_get_dbus_bytes_parameter (parameters);
 
-    g_paste_daemon_do_add (self, text, length);
+    g_paste_daemon_do_add (self, text);
+    g_bytes_unref (text);
 
     g_paste_daemon_send_dbus_reply (connection, invocation, NULL);
 }
@@ -282,7 +386,10 @@ g_paste_daemon_add_file (GPasteDaemon          *self,
                              &length,
                              NULL)) /* error */
     {
-        g_paste_daemon_do_add (self, content, length);
+        GBytes *text = g_bytes_new_take (content, length + 1);
+
+        g_paste_daemon_do_add (self, text);
+        g_bytes_unref (text);
     }
     g_free (file);
 
@@ -304,17 +411,123 @@ g_paste_daemon_get_dbus_uint32_parameter (GVariant *parameters)
     return value;
 }
 
+/* Serialize straight from the item's buffer, no copy */
+static GVariant *
+g_paste_daemon_new_string_from_bytes (GBytes *value)
+{
+    if (!value)
+        return g_variant_new_string ("");
+
+    gsize size;
+    gconstpointer data = g_bytes_get_data (value, &size);
+
+    return g_variant_new_from_data (G_VARIANT_TYPE_STRING,
+                                    data,
+                                    size,
+                                    TRUE, /* trusted */
+                                    (GDestroyNotify) g_bytes_unref,
+                                    g_bytes_ref (value));
+}
+
+static GVariant *
+g_paste_daemon_new_element_reply (GBytes *value)
+{
+    GVariant *variant = g_paste_daemon_new_string_from_bytes (value);
+
+    return g_variant_new_tuple (&variant, 1);
+}
+
+/* The whole values of the displayed items, for scripts which would otherwise ask for them one by one */
+static GVariant *
+g_paste_daemon_new_raw_history_reply (GPtrArray *values)
+{
+    GVariantBuilder builder;
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE_STRING_ARRAY);
+    for (guint i = 0; i < values->len; ++i)
+        g_variant_builder_add_value (&builder, g_paste_daemon_new_string_from_bytes (g_ptr_array_index (values, i)));
+
+    return g_variant_new ("(as)", &builder);
+}
+
+static void
+g_paste_daemon_get_raw_history (GPasteDaemon          *self,
+                                GDBusConnection       *connection,
+                                GDBusMethodInvocation *invocation)
+{
+    GPasteDaemonPrivate *priv = self->priv;
+    GSList *history = g_paste_history_get_history (priv->history);
+    guint length = MIN (g_slist_length (history), g_paste_settings_get_max_displayed_history_size (priv->settings));
+    GPtrArray *values = g_ptr_array_new_with_free_func ((GDestroyNotify) g_bytes_unref);
+
+    for (guint i = 0; i < length; ++i, history = g_slist_next (history))
+        g_ptr_array_add (values, g_bytes_ref (g_paste_item_get_value_bytes (history->data)));
+
+    g_paste_daemon_send_dbus_reply (connection, invocation, g_paste_daemon_new_raw_history_reply (values));
+    g_ptr_array_unref (values);
+}
+
 static void
 g_paste_daemon_get_element (GPasteDaemon          *self,
                             GDBusConnection       *connection,
                             GDBusMethodInvocation *invocation,
                             GVariant              *parameters)
 {
-    const gchar *value = g_paste_history_get_value (self->priv->history,
-                                                    g_paste_daemon_get_dbus_uint32_parameter (parameters));
-    GVariant *variant = g_variant_new_string ((value == NULL) ? "" : value);
+    const GPasteItem *item = g_paste_history_get (self->priv->history,
+                                                  g_paste_daemon_get_dbus_uint32_parameter (parameters));
 
-    g_paste_daemon_send_dbus_reply (connection, invocation, g_variant_new_tuple (&variant, 1));
+    g_paste_daemon_send_dbus_reply (connection,
+                                    invocation,
+                                    g_paste_daemon_new_element_reply ((item) ? g_paste_item_get_value_bytes (item) : NULL));
+}
+
+static void
+g_paste_daemon_thumbnail_ready (const GPasteImageItem *image G_GNUC_UNUSED,
+                                GBytes                *thumbnail,
+                                gpointer               user_data)
+{
+    GDBusMethodInvocation *invocation = user_data;
+    GVariant *variant;
+
+    if (thumbnail)
+    {
+        /* Usually a mapped file, sent without any copy */
+        gsize size;
+        gconstpointer data = g_bytes_get_data (thumbnail, &size);
+
+        variant = g_variant_new_from_data (G_VARIANT_TYPE_BYTESTRING,
+                                           data,
+                                           size,
+                                           TRUE, /* trusted */
+                                           (GDestroyNotify) g_bytes_unref,
+                                           g_bytes_ref (thumbnail));
+    }
+    else
+        variant = g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE,
+                                             NULL, /* elements */
+                                             0, /* n_elements */
+                                             sizeof (guchar));
+
+    g_paste_daemon_send_dbus_reply (g_dbus_method_invocation_get_connection (invocation),
+                                    invocation,
+                                    g_variant_new_tuple (&variant, 1));
+    g_object_unref (invocation);
+}
+
+static void
+g_paste_daemon_get_thumbnail (GPasteDaemon          *self,
+                              GDBusConnection       *connection G_GNUC_UNUSED,
+                              GDBusMethodInvocation *invocation,
+                              GVariant              *parameters)
+{
+    const GPasteItem *item = g_paste_history_get (self->priv->history,
+                                                  g_paste_daemon_get_dbus_uint32_parameter (parameters));
+
+    /* A missing thumbnail gets built in a thread, answered once it's there */
+    if (item && G_PASTE_IS_IMAGE_ITEM (item))
+        g_paste_image_item_request_thumbnail (G_PASTE_IMAGE_ITEM (item), g_paste_daemon_thumbnail_ready, g_object_ref (invocation));
+    else
+        g_paste_daemon_thumbnail_ready (NULL, NULL, g_object_ref (invocation)); /* image, thumbnail */
 }
 
 static void
@@ -348,6 +561,35 @@ g_paste_daemon_empty (GPasteDaemon          *self,
     g_paste_daemon_send_dbus_reply (connection, invocation, NULL);
 }
 
+static void
+g_paste_daemon_collect_garbage (GPasteDaemon          *self,
+                                GDBusMethodInvocation *invocation)
+{
+    GPasteDaemonPrivate *priv = self->priv;
+
+    /* Answered once the history is done with it */
+    priv->gc_invocations = g_slist_prepend (priv->gc_invocations, g_object_ref (invocation));
+    g_paste_history_collect_garbage (priv->history);
+}
+
+static void
+g_paste_daemon_garbage_collected (GPasteDaemon *self,
+                                  guint64       reclaimed,
+                                  gpointer      user_data G_GNUC_UNUSED)
+{
+    GPasteDaemonPrivate *priv = self->priv;
+
+    for (GSList *invocation = priv->gc_invocations; invocation; invocation = g_slist_next (invocation))
+    {
+        GVariant *variant = g_variant_new_uint64 (reclaimed);
+
+        g_paste_daemon_send_dbus_reply (priv->connection, invocation->data, g_variant_new_tuple (&variant, 1));
+    }
+
+    g_slist_free_full (priv->gc_invocations, g_object_unref);
+    priv->gc_invocations = NULL;
+}
+
 static void
 g_paste_daemon_tracking (GPasteDaemon *self,
                          gboolean      tracking_state,
@@ -358,11 +600,64 @@ g_paste_daemon_tracking (GPasteDaemon *self,
     G_PASTE_SEND_DBUS_SIGNAL_WITH_DATA (SIG_TRACKING, variant)
 }
 
+static gboolean
+g_paste_daemon_emit_changed (gpointer user_data)
+{
+    GPasteDaemon *self = user_data;
+    GVariant *variant = g_variant_new_uint64 (self->priv->generation);
+
+    self->priv->changed_source = 0;
+
+    G_PASTE_SEND_DBUS_SIGNAL_WITH_DATA (SIG_CHANGED, variant)
+
+    return FALSE;
+}
+
+/* Sent for each item as it gets added, with its kind so that watchers can filter on it.
+ * Values can be huge, only the clients which asked for them get them. */
+static void
+g_paste_daemon_added (GPasteDaemon *self,
+                      GPasteItem   *item,
+                      gpointer      user_data G_GNUC_UNUSED)
+{
+    GPasteDaemonPrivate *priv = self->priv;
+
+    if (!g_hash_table_size (priv->watchers))
+        return;
+
+    GVariant *data[] = {
+        g_variant_new_string (g_paste_item_get_kind (item)),
+        g_paste_daemon_new_string_from_bytes (g_paste_item_get_value_bytes (item))
+    };
+    GVariant *parameters = g_variant_ref_sink (g_variant_new_tuple (data, G_N_ELEMENTS (data)));
+    GHashTableIter iter;
+    gpointer watcher;
+
+    g_hash_table_iter_init (&iter, priv->watchers);
+    while (g_hash_table_iter_next (&iter, &watcher, NULL)) /* value */
+    {
+        g_dbus_connection_emit_signal (priv->connection,
+                                       watcher, /* destination_bus_name */
+                                       priv->object_path,
+                                       G_PASTE_BUS_NAME,
+                                       SIG_ITEM_ADDED,
+                                       parameters,
+                                       NULL); /* error */
+    }
+
+    g_variant_unref (parameters);
+}
+
+/* A single operation can change the history several times, only tell the clients about the outcome */
 static void
 g_paste_daemon_changed (GPasteDaemon *self,
                         gpointer      user_data G_GNUC_UNUSED)
 {
-    G_PASTE_SEND_DBUS_SIGNAL (SIG_CHANGED)
+    GPasteDaemonPrivate *priv = self->priv;
+
+    ++priv->generation;
+    if (!priv->changed_source)
+        priv->changed_source = g_timeout_add (CHANGED_FRAME, g_paste_daemon_emit_changed, self);
 }
 
 static void
@@ -429,6 +724,47 @@ g_paste_daemon_on_extension_state_changed (GPasteDaemon          *self,
         g_paste_daemon_send_dbus_reply (connection, invocation, NULL);
 }
 
+static void
+g_paste_daemon_watcher_vanished (GDBusConnection *connection G_GNUC_UNUSED,
+                                 const gchar     *name,
+                                 gpointer         user_data)
+{
+    GPasteDaemon *self = user_data;
+
+    g_hash_table_remove (self->priv->watchers, name);
+}
+
+static void
+g_paste_daemon_unwatch (gpointer data)
+{
+    g_bus_unwatch_name (GPOINTER_TO_UINT (data));
+}
+
+/* Until it leaves the bus, the caller gets ItemAdded for each new item */
+static void
+g_paste_daemon_watch (GPasteDaemon          *self,
+                      GDBusConnection       *connection,
+                      GDBusMethodInvocation *invocation)
+{
+    GPasteDaemonPrivate *priv = self->priv;
+    const gchar *sender = g_dbus_method_invocation_get_sender (invocation);
+
+    if (sender && !g_hash_table_contains (priv->watchers, sender))
+    {
+        guint id = g_bus_watch_name_on_connection (connection,
+                                                   sender,
+                                                   G_BUS_NAME_WATCHER_FLAGS_NONE,
+                                                   NULL, /* name appeared */
+                                                   g_paste_daemon_watcher_vanished,
+                                                   self,
+                                                   NULL); /* user data free func */
+
+        g_hash_table_insert (priv->watchers, g_strdup (sender), GUINT_TO_POINTER (id));
+    }
+
+    g_paste_daemon_send_dbus_reply (connection, invocation, NULL);
+}
+
 static void
 g_paste_daemon_reexecute (GPasteDaemon          *self,
                           GDBusConnection       *connection,
@@ -441,19 +777,16 @@ g_paste_daemon_reexecute (GPasteDaemon          *self,
 }
 
 static void
-g_paste_daemon_dbus_method_call (GDBusConnection       *connection,
-                                 const gchar           *sender G_GNUC_UNUSED,
-                                 const gchar           *object_path G_GNUC_UNUSED,
-                                 const gchar           *interface_name G_GNUC_UNUSED,
-                                 const gchar           *method_name,
-                                 GVariant              *parameters,
-                                 GDBusMethodInvocation *invocation,
-                                 gpointer               user_data)
+g_paste_daemon_dispatch (GPasteDaemon          *self,
+                         GDBusConnection       *connection,
+                         const gchar           *method_name,
+                         GVariant              *parameters,
+                         GDBusMethodInvocation *invocation)
 {
-    GPasteDaemon *self = G_PASTE_DAEMON (user_data);
-
     if (g_strcmp0 (method_name, GET_HISTORY) == 0)
         g_paste_daemon_get_history (self, connection, invocation);
+    else if (g_strcmp0 (method_name, GET_RAW_HISTORY) == 0)
+        g_paste_daemon_get_raw_history (self, connection, invocation);
     else if (g_strcmp0 (method_name, BACKUP_HISTORY) == 0)
         g_paste_daemon_backup_history (self, connection, invocation, parameters);
     else if (g_strcmp0 (method_name, SWITCH_HISTORY) == 0)
@@ -468,22 +801,143 @@ g_paste_daemon_dbus_method_call (GDBusConnection       *connection,
         g_paste_daemon_add_file (self, connection, invocation, parameters);
     else if (g_strcmp0 (method_name, GET_ELEMENT) == 0)
         g_paste_daemon_get_element (self, connection, invocation, parameters);
+    else if (g_strcmp0 (method_name, GET_THUMBNAIL) == 0)
+        g_paste_daemon_get_thumbnail (self, connection, invocation, parameters);
     else if (g_strcmp0 (method_name, SELECT) == 0)
         g_paste_daemon_select (self, connection, invocation, parameters);
     else if (g_strcmp0 (method_name, DELETE) == 0)
         g_paste_daemon_delete (self, connection, invocation, parameters);
     else if (g_strcmp0 (method_name, EMPTY) == 0)
         g_paste_daemon_empty (self, connection, invocation);
+    else if (g_strcmp0 (method_name, COLLECT_GARBAGE) == 0)
+        g_paste_daemon_collect_garbage (self, invocation);
     else if (g_strcmp0 (method_name, TRACK) == 0)
         g_paste_daemon_track (self, connection, invocation, parameters);
     else if (g_strcmp0 (method_name, ON_EXTENSION_STATE_CHANGED) == 0)
         g_paste_daemon_on_extension_state_changed (self, connection, invocation, parameters);
     else if (g_strcmp0 (method_name, REEXECUTE) == 0)
         g_paste_daemon_reexecute (self, connection, invocation);
+    else if (g_strcmp0 (method_name, WATCH) == 0)
+        g_paste_daemon_watch (self, connection, invocation);
 
     g_object_unref (invocation);
 }
 
+/* Runs on the D-Bus thread, only reads the snapshot */
+static gboolean
+g_paste_daemon_answer_from_snapshot (GPasteDaemon          *self,
+                                     GDBusConnection       *connection,
+                                     const gchar           *method_name,
+                                     GVariant              *parameters,
+                                     GDBusMethodInvocation *invocation)
+{
+    gboolean get_history = (g_strcmp0 (method_name, GET_HISTORY) == 0);
+    gboolean get_raw_history = (g_strcmp0 (method_name, GET_RAW_HISTORY) == 0);
+
+    if (!get_history && !get_raw_history && g_strcmp0 (method_name, GET_ELEMENT) != 0)
+        return FALSE;
+
+    GPasteDaemonPrivate *priv = self->priv;
+
+    g_mutex_lock (&priv->snapshot_mutex);
+    GVariant *history = (priv->history_snapshot) ? g_variant_ref (priv->history_snapshot) : NULL;
+    GPtrArray *values = (priv->values_snapshot) ? g_ptr_array_ref (priv->values_snapshot) : NULL;
+    g_mutex_unlock (&priv->snapshot_mutex);
+
+    if (!history)
+        return FALSE;
+
+    GVariant *reply = NULL;
+
+    if (get_history)
+        reply = history;
+    else if (get_raw_history)
+        reply = g_paste_daemon_new_raw_history_reply (values);
+    else
+    {
+        guint32 index = g_paste_daemon_get_dbus_uint32_parameter (parameters);
+
+        /* Not displayed, only the history knows about it */
+        if (index < values->len)
+            reply = g_paste_daemon_new_element_reply (g_ptr_array_index (values, index));
+    }
+
+    if (reply)
+    {
+        g_paste_daemon_send_dbus_reply (connection, invocation, reply);
+        g_object_unref (invocation);
+    }
+
+    g_ptr_array_unref (values);
+    g_variant_unref (history);
+
+    return (reply != NULL);
+}
+
+typedef struct
+{
+    GPasteDaemon          *self;
+    GDBusConnection       *connection;
+    gchar                 *method_name;
+    GVariant              *parameters;
+    GDBusMethodInvocation *invocation;
+} GPasteDaemonCall;
+
+static gboolean
+g_paste_daemon_dispatch_call (gpointer user_data)
+{
+    GPasteDaemonCall *call = user_data;
+
+    g_paste_daemon_dispatch (call->self, call->connection, call->method_name, call->parameters, call->invocation);
+
+    return FALSE;
+}
+
+static void
+g_paste_daemon_call_free (gpointer user_data)
+{
+    GPasteDaemonCall *call = user_data;
+
+    g_variant_unref (call->parameters);
+    g_free (call->method_name);
+    g_object_unref (call->connection);
+    g_object_unref (call->self);
+    g_slice_free (GPasteDaemonCall, call);
+}
+
+static void
+g_paste_daemon_dbus_method_call (GDBusConnection       *connection,
+                                 const gchar           *sender G_GNUC_UNUSED,
+                                 const gchar           *object_path G_GNUC_UNUSED,
+                                 const gchar           *interface_name G_GNUC_UNUSED,
+                                 const gchar           *method_name,
+                                 GVariant              *parameters,
+                                 GDBusMethodInvocation *invocation,
+                                 gpointer               user_data)
+{
+    GPasteDaemon *self = G_PASTE_DAEMON (user_data);
+
+    if (!self->priv->dbus_context)
+        g_paste_daemon_dispatch (self, connection, method_name, parameters, invocation);
+    else if (!g_paste_daemon_answer_from_snapshot (self, connection, method_name, parameters, invocation))
+    {
+        /* Everything else is done where the history and the clipboards live */
+        GPasteDaemonCall *call = g_slice_new (GPasteDaemonCall);
+
+        call->self = g_object_ref (self);
+        call->connection = g_object_ref (connection);
+        call->method_name = g_strdup (method_name);
+        call->parameters = g_variant_ref (parameters);
+        call->invocation = invocation;
+
+        g_main_context_invoke_full (NULL, /* default context */
+                                    G_PRIORITY_DEFAULT,
+                                    g_paste_daemon_dispatch_call,
+                                    call,
+                                    g_paste_daemon_call_free);
+    }
+}
+
 static GVariant *
 g_paste_daemon_dbus_get_property (GDBusConnection *connection G_GNUC_UNUSED,
                                   const gchar     *sender G_GNUC_UNUSED,
@@ -511,11 +965,36 @@ g_paste_daemon_unregister_object (gpointer user_data)
     g_signal_handler_disconnect (self, c_signals[C_NAME_LOST]);
     g_signal_handler_disconnect (self, c_signals[C_REEXECUTE_SELF]);
     g_signal_handler_disconnect (priv->settings, c_signals[C_TRACK]);
+    g_signal_handler_disconnect (priv->history, c_signals[C_ADDED]);
     g_signal_handler_disconnect (priv->history, c_signals[C_CHANGED]);
+    g_signal_handler_disconnect (priv->history, c_signals[C_GARBAGE_COLLECTED]);
+
+    if (priv->changed_source)
+    {
+        g_source_remove (priv->changed_source);
+        priv->changed_source = 0;
+    }
 
     g_object_unref (self);
 }
 
+static gboolean
+g_paste_daemon_unregister_object_idle (gpointer user_data)
+{
+    g_paste_daemon_unregister_object (user_data);
+
+    return FALSE;
+}
+
+/* Called from the D-Bus thread, but the signal handlers belong to the main one */
+static void
+g_paste_daemon_unregister_object_later (gpointer user_data)
+{
+    g_main_context_invoke (NULL, /* default context */
+                           g_paste_daemon_unregister_object_idle,
+                           user_data);
+}
+
 static guint
 g_paste_daemon_register_object (GPasteDaemon    *self,
                                 GDBusConnection *connection,
@@ -529,13 +1008,21 @@ g_paste_daemon_register_object (GPasteDaemon    *self,
     priv->connection = g_object_ref (connection);
     priv->object_path = g_strdup (path);
 
+    /* The method calls get dispatched to the context the object gets registered from, only them */
+    if (priv->dbus_context)
+        g_main_context_push_thread_default (priv->dbus_context);
+
     guint result = g_dbus_connection_register_object (connection,
                                                       path,
                                                       priv->g_paste_daemon_dbus_info->interfaces[0],
                                                       &priv->g_paste_daemon_dbus_vtable,
                                                       g_object_ref (self),
-                                                      g_paste_daemon_unregister_object,
+                                                      (priv->dbus_context) ? g_paste_daemon_unregister_object_later : g_paste_daemon_unregister_object,
                                                       error);
+
+    if (priv->dbus_context)
+        g_main_context_pop_thread_default (priv->dbus_context);
+
     if (!result)
         return 0;
 
@@ -552,10 +1039,18 @@ g_paste_daemon_register_object (GPasteDaemon    *self,
                                                    "track",
                                                    G_CALLBACK (g_paste_daemon_tracking),
                                                    self);
+    c_signals[C_ADDED] = g_signal_connect_swapped (G_OBJECT (priv->history),
+                                                   "added",
+                                                   G_CALLBACK (g_paste_daemon_added),
+                                                   self);
     c_signals[C_CHANGED] = g_signal_connect_swapped (G_OBJECT (priv->history),
                                                      "changed",
                                                      G_CALLBACK (g_paste_daemon_changed),
                                                      self);
+    c_signals[C_GARBAGE_COLLECTED] = g_signal_connect_swapped (G_OBJECT (priv->history),
+                                                               "garbage-collected",
+                                                               G_CALLBACK (g_paste_daemon_garbage_collected),
+                                                               self);
 
     return result;
 }
@@ -584,6 +1079,14 @@ g_paste_daemon_on_name_lost (GDBusConnection *connection G_GNUC_UNUSED,
 }
 
 
+static gpointer
+g_paste_daemon_dbus_worker (gpointer user_data)
+{
+    g_main_loop_run (user_data);
+
+    return NULL;
+}
+
 /**
  * g_paste_daemon_own_bus_name:
  * @self: (transfer none): the #GPasteDaemon
@@ -603,6 +1106,22 @@ g_paste_daemon_own_bus_name (GPasteDaemon *self,
 
     g_return_val_if_fail (!priv->id_on_bus, FALSE);
 
+    gboolean threaded = g_paste_settings_get_dbus_thread (priv->settings);
+
+    /* The name is owned from here, only the object gets registered for the D-Bus thread */
+    if (threaded)
+    {
+        priv->dbus_context = g_main_context_new ();
+        priv->c_signals[C_SNAPSHOT_CHANGED] = g_signal_connect_swapped (G_OBJECT (priv->history),
+                                                                        "changed",
+                                                                        G_CALLBACK (g_paste_daemon_refresh_snapshot),
+                                                                        self);
+        priv->c_signals[C_SNAPSHOT_SIZE] = g_signal_connect_swapped (G_OBJECT (priv->settings),
+                                                                     "changed::" MAX_DISPLAYED_HISTORY_SIZE_KEY,
+                                                                     G_CALLBACK (g_paste_daemon_refresh_snapshot),
+                                                                     self);
+    }
+
     priv->inner_error = *error;
     priv->id_on_bus = g_bus_own_name (G_BUS_TYPE_SESSION,
                                       G_PASTE_BUS_NAME,
@@ -613,6 +1132,12 @@ g_paste_daemon_own_bus_name (GPasteDaemon *self,
                                       g_object_ref (self),
                                       g_object_unref);
 
+    if (threaded)
+    {
+        priv->dbus_loop = g_main_loop_new (priv->dbus_context, FALSE);
+        priv->dbus_thread = g_thread_new ("gpaste-dbus", g_paste_daemon_dbus_worker, priv->dbus_loop);
+    }
+
     return (!priv->inner_error);
 }
 
@@ -625,13 +1150,37 @@ g_paste_daemon_dispose (GObject *object)
 
     if (settings)
     {
+        if (priv->changed_source)
+        {
+            g_source_remove (priv->changed_source);
+            priv->changed_source = 0;
+        }
         g_bus_unown_name (priv->id_on_bus);
+        if (priv->dbus_context)
+        {
+            g_main_loop_quit (priv->dbus_loop);
+            g_thread_join (priv->dbus_thread);
+            g_main_loop_unref (priv->dbus_loop);
+            g_main_context_unref (priv->dbus_context);
+            g_signal_handler_disconnect (priv->history, priv->c_signals[C_SNAPSHOT_CHANGED]);
+            g_signal_handler_disconnect (settings, priv->c_signals[C_SNAPSHOT_SIZE]);
+            if (priv->history_snapshot)
+            {
+                g_variant_unref (priv->history_snapshot);
+                g_ptr_array_unref (priv->values_snapshot);
+            }
+            priv->dbus_context = NULL;
+        }
         g_object_unref (priv->connection);
         g_object_unref (priv->history);
         g_object_unref (settings);
         g_object_unref (priv->clipboards_manager);
         g_object_unref (priv->keybinder);
         g_dbus_node_info_unref (priv->g_paste_daemon_dbus_info);
+        g_slist_free_full (priv->gc_invocations, g_object_unref);
+        priv->gc_invocations = NULL;
+        g_hash_table_unref (priv->watchers);
+        priv->watchers = NULL;
         priv->settings = NULL;
     }
 
@@ -641,7 +1190,10 @@ g_paste_daemon_dispose (GObject *object)
 static void
 g_paste_daemon_finalize (GObject *object)
 {
-    g_free (G_PASTE_DAEMON (object)->priv->object_path);
+    GPasteDaemonPrivate *priv = G_PASTE_DAEMON (object)->priv;
+
+    g_free (priv->object_path);
+    g_mutex_clear (&priv->snapshot_mutex);
 
     G_OBJECT_CLASS (g_paste_daemon_parent_class)->finalize (object);
 }
@@ -667,6 +1219,11 @@ g_paste_daemon_init (GPasteDaemon *self)
     GDBusInterfaceVTable *vtable = &priv->g_paste_daemon_dbus_vtable;
 
     priv->id_on_bus = 0;
+    priv->watchers = g_hash_table_new_full (g_str_hash,
+                                            g_str_equal,
+                                            g_free,
+                                            g_paste_daemon_unwatch);
+    g_mutex_init (&priv->snapshot_mutex);
     priv->g_paste_daemon_dbus_info = g_dbus_node_info_new_for_xml (G_PASTE_IFACE_INFO,
                                                                    NULL); /* Error */
 
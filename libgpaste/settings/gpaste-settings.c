@@ -30,9 +30,17 @@ struct _GPasteSettingsPrivate
 {
     GSettings *settings;
 
+    guint32    clipboard_store_delay;
+    guint32    compression_threshold;
+    gboolean   dbus_thread;
+    gboolean   delta_storage;
     guint32    element_size;
     gboolean   fifo;
     gchar     *history_name;
+    guint32    images_cache_size;
+    guint32    images_compression_level;
+    guint32    images_disk_quota;
+    guint32    images_similarity;
     gboolean   images_support;
     guint32    max_displayed_history_size;
     guint32    max_history_size;
@@ -112,6 +120,82 @@ static guint signals[LAST_SIGNAL] = { 0 };
 #define NEW_SIGNAL(name, arg) NEW_SIGNAL_FULL (name, G_SIGNAL_RUN_LAST, arg)
 #define NEW_SIGNAL_DETAILED(name, arg) NEW_SIGNAL_FULL (name, G_SIGNAL_RUN_LAST | G_SIGNAL_DETAILED, arg)
 
+/**
+ * g_paste_settings_get_clipboard_store_delay:
+ * @self: a #GPasteSettings instance
+ *
+ * Get the CLIPBOARD_STORE_DELAY_KEY setting
+ *
+ * Returns: the value of the CLIPBOARD_STORE_DELAY_KEY setting
+ */
+/**
+ * g_paste_settings_set_clipboard_store_delay:
+ * @self: a #GPasteSettings instance
+ * @value: delay before handing the clipboard over to the session clipboard manager (ms)
+ *
+ * Change the CLIPBOARD_STORE_DELAY_KEY setting
+ *
+ * Returns:
+ */
+UNSIGNED_SETTING (clipboard_store_delay, CLIPBOARD_STORE_DELAY_KEY)
+
+/**
+ * g_paste_settings_get_compression_threshold:
+ * @self: a #GPasteSettings instance
+ *
+ * Get the COMPRESSION_THRESHOLD_KEY setting
+ *
+ * Returns: the value of the COMPRESSION_THRESHOLD_KEY setting
+ */
+/**
+ * g_paste_settings_set_compression_threshold:
+ * @self: a #GPasteSettings instance
+ * @value: size from which texts get compressed, in bytes
+ *
+ * Change the COMPRESSION_THRESHOLD_KEY setting
+ *
+ * Returns:
+ */
+UNSIGNED_SETTING (compression_threshold, COMPRESSION_THRESHOLD_KEY)
+
+/**
+ * g_paste_settings_get_dbus_thread:
+ * @self: a #GPasteSettings instance
+ *
+ * Get the DBUS_THREAD_KEY setting
+ *
+ * Returns: the value of the DBUS_THREAD_KEY setting
+ */
+/**
+ * g_paste_settings_set_dbus_thread:
+ * @self: a #GPasteSettings instance
+ * @value: answer the D-Bus calls from a dedicated thread
+ *
+ * Change the DBUS_THREAD_KEY setting
+ *
+ * Returns:
+ */
+BOOLEAN_SETTING (dbus_thread, DBUS_THREAD_KEY)
+
+/**
+ * g_paste_settings_get_delta_storage:
+ * @self: a #GPasteSettings instance
+ *
+ * Get the DELTA_STORAGE_KEY setting
+ *
+ * Returns: the value of the DELTA_STORAGE_KEY setting
+ */
+/**
+ * g_paste_settings_set_delta_storage:
+ * @self: a #GPasteSettings instance
+ * @value: store similar successive texts as deltas
+ *
+ * Change the DELTA_STORAGE_KEY setting
+ *
+ * Returns:
+ */
+BOOLEAN_SETTING (delta_storage, DELTA_STORAGE_KEY)
+
 /**
  * g_paste_settings_get_element_size:
  * @self: a #GPasteSettings instance
@@ -169,6 +253,82 @@ BOOLEAN_SETTING (fifo, FIFO_KEY)
  */
 STRING_SETTING (history_name, HISTORY_NAME_KEY)
 
+/**
+ * g_paste_settings_get_images_cache_size:
+ * @self: a #GPasteSettings instance
+ *
+ * Get the IMAGES_CACHE_SIZE_KEY setting
+ *
+ * Returns: the value of the IMAGES_CACHE_SIZE_KEY setting
+ */
+/**
+ * g_paste_settings_set_images_cache_size:
+ * @self: a #GPasteSettings instance
+ * @value: memory budget for decoded images, in MiB
+ *
+ * Change the IMAGES_CACHE_SIZE_KEY setting
+ *
+ * Returns:
+ */
+UNSIGNED_SETTING (images_cache_size, IMAGES_CACHE_SIZE_KEY)
+
+/**
+ * g_paste_settings_get_images_compression_level:
+ * @self: a #GPasteSettings instance
+ *
+ * Get the IMAGES_COMPRESSION_LEVEL_KEY setting
+ *
+ * Returns: the value of the IMAGES_COMPRESSION_LEVEL_KEY setting
+ */
+/**
+ * g_paste_settings_set_images_compression_level:
+ * @self: a #GPasteSettings instance
+ * @value: the zlib compression level used when saving images
+ *
+ * Change the IMAGES_COMPRESSION_LEVEL_KEY setting
+ *
+ * Returns:
+ */
+UNSIGNED_SETTING (images_compression_level, IMAGES_COMPRESSION_LEVEL_KEY)
+
+/**
+ * g_paste_settings_get_images_disk_quota:
+ * @self: a #GPasteSettings instance
+ *
+ * Get the IMAGES_DISK_QUOTA_KEY setting
+ *
+ * Returns: the value of the IMAGES_DISK_QUOTA_KEY setting
+ */
+/**
+ * g_paste_settings_set_images_disk_quota:
+ * @self: a #GPasteSettings instance
+ * @value: disk space for stored images, in MiB
+ *
+ * Change the IMAGES_DISK_QUOTA_KEY setting
+ *
+ * Returns:
+ */
+UNSIGNED_SETTING (images_disk_quota, IMAGES_DISK_QUOTA_KEY)
+
+/**
+ * g_paste_settings_get_images_similarity:
+ * @self: a #GPasteSettings instance
+ *
+ * Get the IMAGES_SIMILARITY_KEY setting
+ *
+ * Returns: the value of the IMAGES_SIMILARITY_KEY setting
+ */
+/**
+ * g_paste_settings_set_images_similarity:
+ * @self: a #GPasteSettings instance
+ * @value: the perceptual hash distance under which images get replaced
+ *
+ * Change the IMAGES_SIMILARITY_KEY setting
+ *
+ * Returns:
+ */
+UNSIGNED_SETTING (images_similarity, IMAGES_SIMILARITY_KEY)
+
 /**
  * g_paste_settings_get_images_support:
  * @self: a #GPasteSettings instance
@@ -424,12 +584,28 @@ g_paste_settings_settings_changed (GSettings   *settings G_GNUC_UNUSED,
     GPasteSettings *self = G_PASTE_SETTINGS (user_data);
     GPasteSettingsPrivate *priv = self->priv;
 
-    if (g_strcmp0 (key, ELEMENT_SIZE_KEY) == 0)
+    if (g_strcmp0 (key, CLIPBOARD_STORE_DELAY_KEY) == 0)
+        g_paste_settings_set_clipboard_store_delay_from_dconf (self);
+    else if (g_strcmp0 (key, COMPRESSION_THRESHOLD_KEY) == 0)
+        g_paste_settings_set_compression_threshold_from_dconf (self);
+    else if (g_strcmp0 (key, DBUS_THREAD_KEY) == 0)
+        g_paste_settings_set_dbus_thread_from_dconf (self);
+    else if (g_strcmp0 (key, DELTA_STORAGE_KEY) == 0)
+        g_paste_settings_set_delta_storage_from_dconf (self);
+    else if (g_strcmp0 (key, ELEMENT_SIZE_KEY) == 0)
         g_paste_settings_set_element_size_from_dconf (self);
     else if (g_strcmp0 (key, FIFO_KEY) == 0)
         g_paste_settings_set_fifo_from_dconf (self);
     else if (g_strcmp0 (key, HISTORY_NAME_KEY) == 0)
         g_paste_settings_set_history_name_from_dconf (self);
+    else if (g_strcmp0 (key, IMAGES_CACHE_SIZE_KEY) == 0)
+        g_paste_settings_set_images_cache_size_from_dconf (self);
+    else if (g_strcmp0 (key, IMAGES_COMPRESSION_LEVEL_KEY) == 0)
+        g_paste_settings_set_images_compression_level_from_dconf (self);
+    else if (g_strcmp0 (key, IMAGES_DISK_QUOTA_KEY) == 0)
+        g_paste_settings_set_images_disk_quota_from_dconf (self);
+    else if (g_strcmp0 (key, IMAGES_SIMILARITY_KEY) == 0)
+        g_paste_settings_set_images_similarity_from_dconf (self);
     else if (g_strcmp0 (key, IMAGES_SUPPORT_KEY) == 0)
         g_paste_settings_set_images_support_from_dconf (self);
     else if (g_strcmp0 (key, MAX_DISPLAYED_HISTORY_SIZE_KEY) == 0)
@@ -533,9 +709,17 @@ g_paste_settings_init (GPasteSettings *self)
     priv->paste_and_pop = NULL;
     priv->show_history = NULL;
 
+    g_paste_settings_set_clipboard_store_delay_from_dconf (self);
+    g_paste_settings_set_compression_threshold_from_dconf (self);
+    g_paste_settings_set_dbus_thread_from_dconf (self);
+    g_paste_settings_set_delta_storage_from_dconf (self);
     g_paste_settings_set_element_size_from_dconf (self);
     g_paste_settings_set_fifo_from_dconf (self);
     g_paste_settings_set_history_name_from_dconf (self);
+    g_paste_settings_set_images_cache_size_from_dconf (self);
+    g_paste_settings_set_images_compression_level_from_dconf (self);
+    g_paste_settings_set_images_disk_quota_from_dconf (self);
+    g_paste_settings_set_images_similarity_from_dconf (self);
     g_paste_settings_set_images_support_from_dconf (self);
     g_paste_settings_set_max_displayed_history_size_from_dconf (self);
     g_paste_settings_set_max_history_size_from_dconf (self);
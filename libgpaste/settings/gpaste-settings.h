@@ -43,9 +43,17 @@ G_PASTE_VISIBLE
 #endif
 GType g_paste_settings_get_type (void);
 
+guint32      g_paste_settings_get_clipboard_store_delay      (GPasteSettings *self);
+guint32      g_paste_settings_get_compression_threshold      (GPasteSettings *self);
+gboolean     g_paste_settings_get_dbus_thread                (GPasteSettings *self);
+gboolean     g_paste_settings_get_delta_storage              (GPasteSettings *self);
 guint32      g_paste_settings_get_element_size               (GPasteSettings *self);
 gboolean     g_paste_settings_get_fifo                       (GPasteSettings *self);
 const gchar *g_paste_settings_get_history_name               (GPasteSettings *self);
+guint32      g_paste_settings_get_images_cache_size          (GPasteSettings *self);
+guint32      g_paste_settings_get_images_compression_level   (GPasteSettings *self);
+guint32      g_paste_settings_get_images_disk_quota          (GPasteSettings *self);
+guint32      g_paste_settings_get_images_similarity          (GPasteSettings *self);
 gboolean     g_paste_settings_get_images_support             (GPasteSettings *self);
 guint32      g_paste_settings_get_max_displayed_history_size (GPasteSettings *self);
 guint32      g_paste_settings_get_max_history_size           (GPasteSettings *self);
@@ -60,12 +68,28 @@ gboolean     g_paste_settings_get_track_changes              (GPasteSettings *se
 gboolean     g_paste_settings_get_track_extension_state      (GPasteSettings *self);
 gboolean     g_paste_settings_get_trim_items                 (GPasteSettings *self);
 
+void g_paste_settings_set_clipboard_store_delay      (GPasteSettings *self,
+                                                      guint32         value);
+void g_paste_settings_set_compression_threshold      (GPasteSettings *self,
+                                                      guint32         value);
+void g_paste_settings_set_dbus_thread                (GPasteSettings *self,
+                                                      gboolean        value);
+void g_paste_settings_set_delta_storage              (GPasteSettings *self,
+                                                      gboolean        value);
 void g_paste_settings_set_element_size               (GPasteSettings *self,
                                                       guint32         value);
 void g_paste_settings_set_fifo                       (GPasteSettings *self,
                                                       gboolean        value);
 void g_paste_settings_set_history_name               (GPasteSettings *self,
                                                       const gchar    *value);
+void g_paste_settings_set_images_cache_size          (GPasteSettings *self,
+                                                      guint32         value);
+void g_paste_settings_set_images_compression_level   (GPasteSettings *self,
+                                                      guint32         value);
+void g_paste_settings_set_images_disk_quota          (GPasteSettings *self,
+                                                      guint32         value);
+void g_paste_settings_set_images_similarity          (GPasteSettings *self,
+                                                      guint32         value);
 void g_paste_settings_set_images_support             (GPasteSettings *self,
                                                       gboolean        value);
 void g_paste_settings_set_max_displayed_history_size (GPasteSettings *self,
@@ -42,11 +42,19 @@ struct _GPasteSettingsUiNotebookPrivate
     GtkCheckButton  *track_changes_button;
     GtkCheckButton  *track_extension_state_button;
     GtkCheckButton  *trim_items_button;
+    GtkCheckButton  *delta_storage_button;
+    GtkCheckButton  *dbus_thread_button;
     GtkSpinButton   *element_size_button;
     GtkSpinButton   *max_displayed_history_size_button;
     GtkSpinButton   *max_history_size_button;
     GtkSpinButton   *max_text_item_size_button;
     GtkSpinButton   *min_text_item_size_button;
+    GtkSpinButton   *clipboard_store_delay_button;
+    GtkSpinButton   *images_compression_level_button;
+    GtkSpinButton   *images_cache_size_button;
+    GtkSpinButton   *images_similarity_button;
+    GtkSpinButton   *images_disk_quota_button;
+    GtkSpinButton   *compression_threshold_button;
     GtkEntry        *backup_entry;
     GtkEntry        *paste_and_pop_entry;
     GtkEntry        *show_history_entry;
@@ -102,6 +110,9 @@ BOOLEAN_CALLBACK (images_support)
 BOOLEAN_CALLBACK (trim_items)
 BOOLEAN_CALLBACK (save_history)
 BOOLEAN_CALLBACK (fifo)
+BOOLEAN_CALLBACK (delta_storage)
+UINT_CALLBACK (clipboard_store_delay)
+BOOLEAN_CALLBACK (dbus_thread)
 
 static GPasteSettingsUiPanel *
 g_paste_settings_ui_notebook_make_behaviour_panel (GPasteSettingsUiNotebook *self)
@@ -155,6 +166,21 @@ g_paste_settings_ui_notebook_make_behaviour_panel (GPasteSettingsUiNotebook *sel
                                                                        g_paste_settings_get_fifo (settings),
                                                                        fifo_callback,
                                                                        settings);
+    priv->delta_storage_button = g_paste_settings_ui_panel_add_boolean_setting (panel,
+                                                                                _("Store similar texts as _deltas"),
+                                                                                g_paste_settings_get_delta_storage (settings),
+                                                                                delta_storage_callback,
+                                                                                settings);
+    priv->clipboard_store_delay_button = g_paste_settings_ui_panel_add_range_setting (panel,
+                                                                                      _("Delay before storing to the clipboard manager (ms): "),
+                                                                                      (gdouble) g_paste_settings_get_clipboard_store_delay (settings),
+                                                                                      0, 60000, 100,
+                                                                                      clipboard_store_delay_callback, settings);
+    priv->dbus_thread_button = g_paste_settings_ui_panel_add_boolean_setting (panel,
+                                                                              _("Answer requests from a dedicated thread (needs restart)"),
+                                                                              g_paste_settings_get_dbus_thread (settings),
+                                                                              dbus_thread_callback,
+                                                                              settings);
 
     return panel;
 }
@@ -164,6 +190,11 @@ UINT_CALLBACK (max_displayed_history_size)
 UINT_CALLBACK (max_history_size)
 UINT_CALLBACK (max_text_item_size)
 UINT_CALLBACK (min_text_item_size)
+UINT_CALLBACK (images_compression_level)
+UINT_CALLBACK (images_cache_size)
+UINT_CALLBACK (images_similarity)
+UINT_CALLBACK (images_disk_quota)
+UINT_CALLBACK (compression_threshold)
 
 static GPasteSettingsUiPanel *
 g_paste_settings_ui_notebook_make_history_settings_panel (GPasteSettingsUiNotebook *self)
@@ -185,7 +216,7 @@ g_paste_settings_ui_notebook_make_history_settings_panel (GPasteSettingsUiNotebo
     priv->max_history_size_button = g_paste_settings_ui_panel_add_range_setting (panel,
                                                                                  _("Max history size: "),
                                                                                  (gdouble) g_paste_settings_get_max_history_size (settings),
-                                                                                 5, 255, 5,
+                                                                                 5, 1048576, 5,
                                                                                  max_history_size_callback, settings);
     priv->max_text_item_size_button = g_paste_settings_ui_panel_add_range_setting (panel,
                                                                                    _("Max text item length: "),
@@ -197,6 +228,31 @@ g_paste_settings_ui_notebook_make_history_settings_panel (GPasteSettingsUiNotebo
                                                                                    (gdouble) g_paste_settings_get_min_text_item_size (settings),
                                                                                    1, G_MAXUINT, 1,
                                                                                    min_text_item_size_callback, settings);
+    priv->images_compression_level_button = g_paste_settings_ui_panel_add_range_setting (panel,
+                                                                                         _("PNG compression level for images: "),
+                                                                                         (gdouble) g_paste_settings_get_images_compression_level (settings),
+                                                                                         0, 9, 1,
+                                                                                         images_compression_level_callback, settings);
+    priv->images_cache_size_button = g_paste_settings_ui_panel_add_range_setting (panel,
+                                                                                  _("Memory for decoded images (MiB): "),
+                                                                                  (gdouble) g_paste_settings_get_images_cache_size (settings),
+                                                                                  0, 4096, 8,
+                                                                                  images_cache_size_callback, settings);
+    priv->images_similarity_button = g_paste_settings_ui_panel_add_range_setting (panel,
+                                                                                  _("Replace similar images (0 = off, 64 = all): "),
+                                                                                  (gdouble) g_paste_settings_get_images_similarity (settings),
+                                                                                  0, 64, 1,
+                                                                                  images_similarity_callback, settings);
+    priv->images_disk_quota_button = g_paste_settings_ui_panel_add_range_setting (panel,
+                                                                                  _("Disk space for images (MiB, 0 = no limit): "),
+                                                                                  (gdouble) g_paste_settings_get_images_disk_quota (settings),
+                                                                                  0, 1048576, 64,
+                                                                                  images_disk_quota_callback, settings);
+    priv->compression_threshold_button = g_paste_settings_ui_panel_add_range_setting (panel,
+                                                                                      _("Compress hidden texts bigger than (bytes, 0 = never): "),
+                                                                                      (gdouble) g_paste_settings_get_compression_threshold (settings),
+                                                                                      0, 16777216, 1024,
+                                                                                      compression_threshold_callback, settings);
 
     return panel;
 }
@@ -357,7 +413,15 @@ g_paste_settings_ui_notebook_settings_changed (GSettings   *gsettings G_GNUC_UNU
     GPasteSettingsUiNotebookPrivate *priv = G_PASTE_SETTINGS_UI_NOTEBOOK (user_data)->priv;
     GPasteSettings *settings = priv->settings;
 
-    if (g_strcmp0 (key, ELEMENT_SIZE_KEY) == 0)
+    if (g_strcmp0 (key, CLIPBOARD_STORE_DELAY_KEY) == 0)
+        gtk_spin_button_set_value (priv->clipboard_store_delay_button, g_paste_settings_get_clipboard_store_delay (settings));
+    else if (g_strcmp0 (key, COMPRESSION_THRESHOLD_KEY) == 0)
+        gtk_spin_button_set_value (priv->compression_threshold_button, g_paste_settings_get_compression_threshold (settings));
+    else if (g_strcmp0 (key, DBUS_THREAD_KEY) == 0)
+        gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (priv->dbus_thread_button), g_paste_settings_get_dbus_thread (settings));
+    else if (g_strcmp0 (key, DELTA_STORAGE_KEY) == 0)
+        gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (priv->delta_storage_button), g_paste_settings_get_delta_storage (settings));
+    else if (g_strcmp0 (key, ELEMENT_SIZE_KEY) == 0)
         gtk_spin_button_set_value (priv->element_size_button, g_paste_settings_get_element_size (settings));
     else if (g_strcmp0 (key, FIFO_KEY) == 0)
         gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (priv->fifo_button), g_paste_settings_get_fifo (settings));
@@ -367,6 +431,14 @@ g_paste_settings_ui_notebook_settings_changed (GSettings   *gsettings G_GNUC_UNU
         gtk_entry_set_text (priv->backup_entry, text);
         g_free (text);
     }
+    else if (g_strcmp0 (key, IMAGES_CACHE_SIZE_KEY) == 0)
+        gtk_spin_button_set_value (priv->images_cache_size_button, g_paste_settings_get_images_cache_size (settings));
+    else if (g_strcmp0 (key, IMAGES_COMPRESSION_LEVEL_KEY) == 0)
+        gtk_spin_button_set_value (priv->images_compression_level_button, g_paste_settings_get_images_compression_level (settings));
+    else if (g_strcmp0 (key, IMAGES_DISK_QUOTA_KEY) == 0)
+        gtk_spin_button_set_value (priv->images_disk_quota_button, g_paste_settings_get_images_disk_quota (settings));
+    else if (g_strcmp0 (key, IMAGES_SIMILARITY_KEY) == 0)
+        gtk_spin_button_set_value (priv->images_similarity_button, g_paste_settings_get_images_similarity (settings));
     else if (g_strcmp0 (key, IMAGES_SUPPORT_KEY) == 0)
         gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON (priv->images_support_button), g_paste_settings_get_images_support (settings));
     else if (g_strcmp0 (key, MAX_DISPLAYED_HISTORY_SIZE_KEY) == 0)
@@ -135,9 +135,9 @@ const GPasteIndicator = new Lang.Class({
     },
 
     _updateHistoryItem: function(index, element) {
-        let displayStr = element.replace(/\n/g, ' ');
-        let altDisplayStr = _("delete: %s").format(displayStr);
-        this._history[index].updateText(displayStr, altDisplayStr);
+        // The daemon already sends a single line preview
+        let altDisplayStr = _("delete: %s").format(element);
+        this._history[index].updateText(element, altDisplayStr);
         this._history[index].actor.show();
     },
 
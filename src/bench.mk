@@ -0,0 +1,134 @@
+# This file is part of GPaste.
+#
+# Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+#
+# GPaste is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# GPaste is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with GPaste.  If not, see <http://www.gnu.org/licenses/>.
+
+
+# Not built nor installed by default, "make bench" builds and runs them
+
+bench_programs = \
+	src/bench/gpaste-bench-client \
+	src/bench/gpaste-bench-compression \
+	src/bench/gpaste-bench-delta-storage \
+	src/bench/gpaste-bench-image-hash \
+	src/bench/gpaste-bench-image-png \
+	src/bench/gpaste-bench-text-kernel \
+	$(NULL)
+
+# These ones drive the running daemon and replace the content of the clipboard,
+# only "make bench-live" runs them
+live_bench_programs = \
+	src/bench/gpaste-bench-dbus-latency \
+	$(NULL)
+
+EXTRA_PROGRAMS += \
+	$(bench_programs) \
+	$(live_bench_programs) \
+	$(NULL)
+
+src_bench_gpaste_bench_text_kernel_SOURCES = \
+	src/bench/gpaste-bench.h \
+	src/bench/gpaste-bench-text-kernel.c \
+	$(NULL)
+
+src_bench_gpaste_bench_text_kernel_LDADD = \
+	$(libgpaste_common_la_file) \
+	$(GLIB_LIBS) \
+	$(NULL)
+
+src_bench_gpaste_bench_client_SOURCES = \
+	src/bench/gpaste-bench.h \
+	src/bench/gpaste-bench-client.c \
+	$(NULL)
+
+src_bench_gpaste_bench_client_LDADD = \
+	$(libgpaste_client_la_file) \
+	$(GLIB_LIBS) \
+	$(NULL)
+
+src_bench_gpaste_bench_compression_SOURCES = \
+	src/bench/gpaste-bench.h \
+	src/bench/gpaste-bench-compression.c \
+	$(NULL)
+
+src_bench_gpaste_bench_compression_CFLAGS = \
+	-DG_PASTE_BENCH_SRCDIR=\"$(abs_top_srcdir)\" \
+	$(AM_CFLAGS) \
+	$(NULL)
+
+src_bench_gpaste_bench_compression_LDADD = \
+	$(GLIB_LIBS) \
+	$(NULL)
+
+src_bench_gpaste_bench_delta_storage_SOURCES = \
+	src/bench/gpaste-bench.h \
+	src/bench/gpaste-bench-delta-storage.c \
+	$(NULL)
+
+src_bench_gpaste_bench_delta_storage_LDADD = \
+	$(libgpaste_common_la_file) \
+	$(GLIB_LIBS) \
+	$(NULL)
+
+src_bench_gpaste_bench_dbus_latency_SOURCES = \
+	src/bench/gpaste-bench.h \
+	src/bench/gpaste-bench-dbus-latency.c \
+	$(NULL)
+
+src_bench_gpaste_bench_dbus_latency_LDADD = \
+	$(GLIB_LIBS) \
+	$(NULL)
+
+src_bench_gpaste_bench_image_hash_SOURCES = \
+	src/bench/gpaste-bench.h \
+	src/bench/gpaste-bench-image-hash.c \
+	$(NULL)
+
+src_bench_gpaste_bench_image_hash_LDADD = \
+	$(libgpaste_common_la_file) \
+	$(GLIB_LIBS) \
+	$(NULL)
+
+src_bench_gpaste_bench_image_png_SOURCES = \
+	src/bench/gpaste-bench.h \
+	src/bench/gpaste-bench-image-png.c \
+	$(NULL)
+
+src_bench_gpaste_bench_image_png_CFLAGS = \
+	$(GDK_PIXBUF_CFLAGS) \
+	$(AM_CFLAGS) \
+	$(NULL)
+
+src_bench_gpaste_bench_image_png_LDADD = \
+	$(GDK_PIXBUF_LIBS) \
+	$(GLIB_LIBS) \
+	$(NULL)
+
+bench: $(bench_programs)
+	@ for bench in $(bench_programs); do \
+	    $(builddir)/$$bench || exit 1; \
+	done
+
+bench-live: $(live_bench_programs)
+	@ for bench in $(live_bench_programs); do \
+	    $(builddir)/$$bench || exit 1; \
+	done
+
+CLEANFILES += \
+	$(bench_programs) \
+	$(live_bench_programs) \
+	$(NULL)
+
+.PHONY: bench bench-live
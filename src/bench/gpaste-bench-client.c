@@ -0,0 +1,107 @@
+/*
+ *      This file is part of GPaste.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      GPaste is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      GPaste is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with GPaste.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gpaste-bench.h"
+
+#include <gdbus-defines.h>
+#include <gpaste-client.h>
+#include <gio/gio.h>
+
+#define ITERATIONS 500
+
+typedef GPasteClient *(*ClientNew) (void);
+
+/* What a run of the gpaste tool does, minus connecting to the bus which both share */
+static void
+measure (const gchar *name,
+         ClientNew    client_new)
+{
+    gint64 *samples = g_new (gint64, ITERATIONS);
+
+    for (guint i = 0; i < ITERATIONS; ++i)
+    {
+        gint64 start = g_get_monotonic_time ();
+        GPasteClient *client = client_new ();
+        GError *error = NULL;
+        gchar **history = g_paste_client_get_history (client, &error);
+
+        if (error)
+        {
+            fprintf (stderr, "%s: %s\n", GET_HISTORY, error->message);
+            exit (EXIT_FAILURE);
+        }
+
+        g_strfreev (history);
+        g_object_unref (client);
+        samples[i] = g_get_monotonic_time () - start;
+    }
+
+    g_paste_bench_report_latencies (name, samples, ITERATIONS);
+    g_free (samples);
+}
+
+int
+main (void)
+{
+    g_type_init ();
+
+    GError *error = NULL;
+    GDBusConnection *connection = g_bus_get_sync (G_BUS_TYPE_SESSION,
+                                                  NULL, /* cancellable */
+                                                  &error);
+
+    if (!connection)
+    {
+        printf ("Client construction: no session bus (%s), skipped\n", error->message);
+        g_error_free (error);
+        return EXIT_SUCCESS;
+    }
+
+    GVariant *owner = g_dbus_connection_call_sync (connection,
+                                                   "org.freedesktop.DBus",
+                                                   "/org/freedesktop/DBus",
+                                                   "org.freedesktop.DBus",
+                                                   "NameHasOwner",
+                                                   g_variant_new ("(s)", G_PASTE_BUS_NAME),
+                                                   G_VARIANT_TYPE ("(b)"),
+                                                   G_DBUS_CALL_FLAGS_NONE,
+                                                   -1, /* timeout */
+                                                   NULL, /* cancellable */
+                                                   NULL); /* error */
+    gboolean running = FALSE;
+
+    if (owner)
+    {
+        g_variant_get (owner, "(b)", &running);
+        g_variant_unref (owner);
+    }
+
+    /* Don't get it activated for the sake of a benchmark */
+    if (!running)
+        printf ("Client construction: gpasted isn't running, skipped\n");
+    else
+    {
+        measure ("client + GetHistory, full", g_paste_client_new);
+        measure ("client + GetHistory, light", g_paste_client_new_light);
+    }
+
+    g_object_unref (connection);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,200 @@
+/*
+ *      This file is part of GPaste.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      GPaste is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      GPaste is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with GPaste.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gpaste-bench.h"
+
+#include <gio/gio.h>
+
+/* Same settings as the cold items of the history: raw deflate, level 1 */
+#define SAMPLE_SIZE       (64 * 1024)
+#define COLD_ITEMS        200
+#define COMPRESSION_LEVEL 1
+
+typedef struct
+{
+    GBytes *value;
+    GBytes *compressed;
+} Sample;
+
+/* One shot, @output_size has to be enough */
+static GBytes *
+convert (GConverter *converter,
+         GBytes     *input,
+         gsize       output_size)
+{
+    gsize input_size, bytes_read, bytes_written;
+    gconstpointer input_data = g_bytes_get_data (input, &input_size);
+    gchar *output = g_malloc (output_size);
+    GConverterResult result = g_converter_convert (converter,
+                                                   input_data,
+                                                   input_size,
+                                                   output,
+                                                   output_size,
+                                                   G_CONVERTER_INPUT_AT_END,
+                                                   &bytes_read,
+                                                   &bytes_written,
+                                                   NULL); /* error */
+
+    if (result != G_CONVERTER_FINISHED)
+    {
+        g_free (output);
+        return NULL;
+    }
+
+    return g_bytes_new_take (output, bytes_written);
+}
+
+static GBytes *
+sample_deflate (GBytes *value)
+{
+    GConverter *compressor = G_CONVERTER (g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_RAW, COMPRESSION_LEVEL));
+    GBytes *compressed = convert (compressor, value, g_bytes_get_size (value) * 2 + 64);
+
+    g_object_unref (compressor);
+
+    return compressed;
+}
+
+static GBytes *
+sample_inflate (GBytes *compressed,
+                gsize   size)
+{
+    GConverter *decompressor = G_CONVERTER (g_zlib_decompressor_new (G_ZLIB_COMPRESSOR_FORMAT_RAW));
+    GBytes *value = convert (decompressor, compressed, size + 64);
+
+    g_object_unref (decompressor);
+
+    return value;
+}
+
+/* What reading a cold item costs, the decompressor included */
+static void
+bench_inflate (gconstpointer data)
+{
+    const Sample *sample = data;
+    GBytes *value = sample_inflate (sample->compressed, g_bytes_get_size (sample->value));
+
+    g_paste_bench_sink += g_bytes_get_size (value);
+    g_bytes_unref (value);
+}
+
+/* Our own sources, the closest thing to what developers copy */
+static GBytes *
+sample_source (void)
+{
+    gchar *contents;
+    gsize length;
+
+    if (!g_file_get_contents (G_PASTE_BENCH_SRCDIR "/libgpaste/core/gpaste-history.c", &contents, &length, NULL)) /* error */
+        return NULL;
+
+    return g_bytes_new_take (contents, MIN (length, SAMPLE_SIZE));
+}
+
+static GBytes *
+sample_log (void)
+{
+    static const gchar *levels[] = { "DEBUG", "INFO", "INFO", "INFO", "WARNING", "ERROR" };
+    static const gchar *sources[] = { "net.http", "db.pool", "auth", "cache", "scheduler" };
+    GString *log = g_string_sized_new (SAMPLE_SIZE + 256);
+    guint32 seed = 42;
+
+    for (guint line = 0; log->len < SAMPLE_SIZE; ++line)
+    {
+        seed = seed * 1103515245 + 12345;
+        g_string_append_printf (log, "2013-10-19 17:%02u:%02u.%03u %-7s [%s] request %08x handled in %u ms\n",
+                                (line / 600) % 60, (line / 10) % 60, (seed >> 8) % 1000,
+                                levels[(seed >> 16) % G_N_ELEMENTS (levels)],
+                                sources[(seed >> 20) % G_N_ELEMENTS (sources)],
+                                seed, (seed >> 4) % 2000);
+    }
+    g_string_truncate (log, SAMPLE_SIZE);
+
+    return g_bytes_new_take (g_string_free (log, FALSE), SAMPLE_SIZE);
+}
+
+static GBytes *
+sample_json (void)
+{
+    static const gchar *names[] = { "alpha", "bravo", "charlie", "delta", "echo", "foxtrot" };
+    GString *json = g_string_sized_new (SAMPLE_SIZE + 256);
+    guint32 seed = 7;
+
+    g_string_append (json, "[\n");
+    for (guint id = 0; json->len < SAMPLE_SIZE; ++id)
+    {
+        seed = seed * 1103515245 + 12345;
+        g_string_append_printf (json, "  { \"id\": %u, \"name\": \"%s\", \"enabled\": %s, \"score\": %u.%02u, \"tags\": [\"%s\", \"%s\"] },\n",
+                                id, names[(seed >> 16) % G_N_ELEMENTS (names)], (seed & 0x100) ? "true" : "false",
+                                (seed >> 8) % 100, seed % 100,
+                                names[(seed >> 20) % G_N_ELEMENTS (names)], names[(seed >> 24) % G_N_ELEMENTS (names)]);
+    }
+    g_string_truncate (json, SAMPLE_SIZE);
+
+    return g_bytes_new_take (g_string_free (json, FALSE), SAMPLE_SIZE);
+}
+
+static void
+bench_sample (const gchar *name,
+              GBytes      *value)
+{
+    if (!value)
+    {
+        printf ("%-48s skipped, no sample\n", name);
+        return;
+    }
+
+    Sample sample = { value, sample_deflate (value) };
+
+    if (!sample.compressed)
+    {
+        printf ("%-48s skipped, could not deflate it\n", name);
+        g_bytes_unref (value);
+        return;
+    }
+
+    gsize size = g_bytes_get_size (value);
+    gsize compressed_size = g_bytes_get_size (sample.compressed);
+    gchar *label = g_strdup_printf ("%s, inflate %" G_GSIZE_FORMAT " KiB", name, size / 1024);
+
+    g_paste_bench_report_time (label, g_paste_bench_run (bench_inflate, &sample));
+    /* What the history keeps resident for that many cold items of this kind */
+    printf ("%-48s %10.2fx   %u items: %.1f MB -> %.1f MB\n",
+            name,
+            (gdouble) size / compressed_size,
+            COLD_ITEMS,
+            (gdouble) size * COLD_ITEMS / 1e6,
+            (gdouble) compressed_size * COLD_ITEMS / 1e6);
+
+    g_free (label);
+    g_bytes_unref (sample.compressed);
+    g_bytes_unref (value);
+}
+
+int
+main (void)
+{
+    g_type_init ();
+
+    bench_sample ("C source", sample_source ());
+    bench_sample ("log", sample_log ());
+    bench_sample ("JSON", sample_json ());
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,217 @@
+/*
+ *      This file is part of GPaste.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      GPaste is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      GPaste is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with GPaste.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gpaste-bench.h"
+
+#include <gdbus-defines.h>
+#include <gpaste-settings-keys.h>
+#include <gio/gio.h>
+
+/* Talks to the running daemon, in a history of its own, but every item it adds
+ * replaces the content of the clipboard: only run by "make bench-live" */
+#define BENCH_HISTORY  "gpaste-bench"
+#define PHASE_DURATION (3 * G_USEC_PER_SEC)
+#define MAX_SAMPLES    100000
+
+typedef struct
+{
+    GDBusConnection *connection;
+    volatile gint    running;
+    guint64          added;
+} Storm;
+
+/* Never exits, the history of the user has to be switched back whatever happens */
+static gboolean
+call (GDBusConnection *connection,
+      const gchar     *method,
+      GVariant        *parameters)
+{
+    GError *error = NULL;
+    GVariant *result = g_dbus_connection_call_sync (connection,
+                                                    G_PASTE_BUS_NAME,
+                                                    G_PASTE_OBJECT_PATH,
+                                                    G_PASTE_INTERFACE_NAME,
+                                                    method,
+                                                    parameters,
+                                                    NULL, /* reply type */
+                                                    G_DBUS_CALL_FLAGS_NO_AUTO_START,
+                                                    -1, /* timeout */
+                                                    NULL, /* cancellable */
+                                                    &error);
+
+    if (error)
+    {
+        fprintf (stderr, "%s: %s\n", method, error->message);
+        g_error_free (error);
+        return FALSE;
+    }
+
+    g_variant_unref (result);
+
+    return TRUE;
+}
+
+/* Like a fast copying user: a new clipboard content as soon as the previous one got in */
+static gpointer
+storm_worker (gpointer user_data)
+{
+    Storm *storm = user_data;
+
+    while (g_atomic_int_get (&storm->running))
+    {
+        gchar *text = g_strdup_printf ("gpaste-bench storm item %" G_GUINT64_FORMAT, storm->added++);
+        gboolean added = call (storm->connection, ADD, g_variant_new ("(s)", text));
+
+        g_free (text);
+        if (!added)
+            break;
+    }
+
+    return NULL;
+}
+
+static gboolean
+measure (GDBusConnection *connection,
+         const gchar     *name,
+         const gchar     *method,
+         GVariant        *parameters)
+{
+    gint64 *samples = g_new (gint64, MAX_SAMPLES);
+    guint n_samples = 0;
+    gint64 end = g_get_monotonic_time () + PHASE_DURATION;
+    gint64 start;
+    gboolean ok = TRUE;
+
+    g_variant_ref_sink (parameters);
+    while (ok && (start = g_get_monotonic_time ()) < end && n_samples < MAX_SAMPLES)
+    {
+        ok = call (connection, method, parameters);
+        samples[n_samples++] = g_get_monotonic_time () - start;
+        /* Leave the daemon some breathing room, like a shell extension would */
+        g_usleep (1000);
+    }
+    g_variant_unref (parameters);
+
+    if (ok)
+        g_paste_bench_report_latencies (name, samples, n_samples);
+    g_free (samples);
+
+    return ok;
+}
+
+static gboolean
+measure_all (GDBusConnection *connection,
+             const gchar     *phase)
+{
+    gchar *name = g_strdup_printf ("%s, %s", GET_HISTORY, phase);
+    gboolean ok = measure (connection, name, GET_HISTORY, g_variant_new ("()"));
+
+    g_free (name);
+
+    if (ok)
+    {
+        name = g_strdup_printf ("%s, %s", GET_ELEMENT, phase);
+        ok = measure (connection, name, GET_ELEMENT, g_variant_new ("(u)", 0));
+        g_free (name);
+    }
+
+    return ok;
+}
+
+int
+main (void)
+{
+    g_type_init ();
+
+    GError *error = NULL;
+    GDBusConnection *connection = g_bus_get_sync (G_BUS_TYPE_SESSION,
+                                                  NULL, /* cancellable */
+                                                  &error);
+
+    if (!connection)
+    {
+        printf ("D-Bus latency: no session bus (%s), skipped\n", error->message);
+        g_error_free (error);
+        return EXIT_SUCCESS;
+    }
+
+    GVariant *owner = g_dbus_connection_call_sync (connection,
+                                                   "org.freedesktop.DBus",
+                                                   "/org/freedesktop/DBus",
+                                                   "org.freedesktop.DBus",
+                                                   "NameHasOwner",
+                                                   g_variant_new ("(s)", G_PASTE_BUS_NAME),
+                                                   G_VARIANT_TYPE ("(b)"),
+                                                   G_DBUS_CALL_FLAGS_NONE,
+                                                   -1, /* timeout */
+                                                   NULL, /* cancellable */
+                                                   NULL); /* error */
+    gboolean running = FALSE;
+
+    if (owner)
+    {
+        g_variant_get (owner, "(b)", &running);
+        g_variant_unref (owner);
+    }
+
+    if (!running)
+    {
+        printf ("D-Bus latency: gpasted isn't running, skipped\n");
+        g_object_unref (connection);
+        return EXIT_SUCCESS;
+    }
+
+    GSettings *settings = g_settings_new ("org.gnome.GPaste");
+    gchar *history_name = g_settings_get_string (settings, HISTORY_NAME_KEY);
+
+    printf ("D-Bus latency, %s: %s\n", DBUS_THREAD_KEY, (g_settings_get_boolean (settings, DBUS_THREAD_KEY)) ? "true" : "false");
+
+    /* Don't flood the history of the user */
+    gboolean ok = (call (connection, SWITCH_HISTORY, g_variant_new ("(s)", BENCH_HISTORY)) &&
+                   call (connection, ADD, g_variant_new ("(s)", "gpaste-bench")) &&
+                   measure_all (connection, "idle"));
+
+    if (ok)
+    {
+        Storm storm = { connection, 1, 0 };
+        GThread *storm_thread = g_thread_new ("gpaste-bench-storm", storm_worker, &storm);
+
+        ok = measure_all (connection, "clipboard storm");
+
+        g_atomic_int_set (&storm.running, 0);
+        g_thread_join (storm_thread);
+        if (ok)
+            printf ("%-32s %" G_GUINT64_FORMAT " items added\n", "clipboard storm", storm.added);
+    }
+
+    /* Even after a failure, which may have happened before switching */
+    if (!call (connection, SWITCH_HISTORY, g_variant_new ("(s)", history_name)))
+    {
+        fprintf (stderr, "Could not switch back to the \"%s\" history, run \"gpaste switch-history %s\"\n", history_name, history_name);
+        ok = FALSE;
+    }
+    else
+        call (connection, DELETE_HISTORY, g_variant_new ("(s)", BENCH_HISTORY));
+
+    g_free (history_name);
+    g_object_unref (settings);
+    g_object_unref (connection);
+
+    return (ok) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
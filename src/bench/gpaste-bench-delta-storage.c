@@ -0,0 +1,199 @@
+/*
+ *      This file is part of GPaste.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      GPaste is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      GPaste is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with GPaste.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gpaste-bench.h"
+
+#include <gpaste-text-kernel.h>
+#include <string.h>
+
+/* Same thresholds as the items and the history file */
+#define ITEM_DELTA_MIN_SAVING    64
+#define HISTORY_DELTA_MIN_SAVING 64
+
+#define PARAGRAPHS      6
+#define PARAGRAPH_WORDS 250
+#define EDITS           12
+#define LOG_LINES       60
+#define LOG_TAIL        40
+
+static const gchar *words[] = {
+    "the", "of", "and", "to", "in", "is", "for", "that", "on", "with", "as",
+    "by", "this", "be", "are", "from", "at", "it", "an", "or", "was", "which"
+};
+
+static gchar *
+words_new (GRand *rand,
+           guint  count)
+{
+    GString *text = g_string_new (NULL);
+
+    for (guint i = 0; i < count; ++i)
+        g_string_append_printf (text, "%s%s", (i) ? " " : "", words[g_rand_int_range (rand, 0, G_N_ELEMENTS (words))]);
+
+    return g_string_free (text, FALSE);
+}
+
+/* Oldest copy first: a paragraph copied after each edit with a few
+ * unrelated snippets in between, then a log tail copied as it grows */
+static GPtrArray *
+trace_new (void)
+{
+    GPtrArray *trace = g_ptr_array_new_with_free_func (g_free);
+    GRand *rand = g_rand_new_with_seed (7);
+
+    for (guint p = 0; p < PARAGRAPHS; ++p)
+    {
+        gchar *words_text = words_new (rand, PARAGRAPH_WORDS);
+        GString *paragraph = g_string_new (words_text);
+
+        g_free (words_text);
+        for (guint e = 0; e < EDITS; ++e)
+        {
+            guint at = g_rand_int_range (rand, 0, paragraph->len);
+            guint cut = g_rand_int_range (rand, 1, 8);
+            gchar *edit = words_new (rand, 2);
+
+            g_string_erase (paragraph, at, MIN (cut, paragraph->len - at));
+            g_string_insert (paragraph, at, edit);
+            g_ptr_array_add (trace, g_strdup (paragraph->str));
+            g_free (edit);
+        }
+        g_ptr_array_add (trace, words_new (rand, 8));
+        g_ptr_array_add (trace, words_new (rand, 40));
+        g_string_free (paragraph, TRUE);
+    }
+
+    GPtrArray *log = g_ptr_array_new_with_free_func (g_free);
+
+    for (guint i = 0; i < LOG_LINES; ++i)
+    {
+        gchar *message = words_new (rand, 12);
+
+        g_ptr_array_add (log, g_strdup_printf ("2013-10-%02u 12:%02u:%02u host app[%u]: %s", i % 9 + 1, i % 60, i * 7 % 60, 1000 + i, message));
+        g_free (message);
+
+        if (i % 2)
+        {
+            guint first = (log->len > LOG_TAIL) ? log->len - LOG_TAIL : 0;
+            GString *tail = g_string_new (NULL);
+
+            for (guint l = first; l < log->len; ++l)
+                g_string_append_printf (tail, "%s%s", (l > first) ? "\n" : "", (const gchar *) g_ptr_array_index (log, l));
+            g_ptr_array_add (trace, g_string_free (tail, FALSE));
+        }
+    }
+
+    g_ptr_array_unref (log);
+    g_rand_free (rand);
+
+    return trace;
+}
+
+#define NEWEST(trace, i) ((const gchar *) g_ptr_array_index ((trace), (trace)->len - 1 - (i)))
+
+/* Bytes of values held once the history is packed, as g_paste_history_pack does:
+ * each item against the full base of the newer one */
+static gsize
+packed_size (const GPtrArray *trace)
+{
+    const gchar *base = NULL;
+    gsize held = 0;
+
+    for (guint i = 0; i < trace->len; ++i)
+    {
+        const gchar *value = NEWEST (trace, i);
+        gsize size = strlen (value) + 1;
+        gsize prefix = 0, suffix = 0;
+
+        if (base)
+            g_paste_text_kernel_common_affixes (base, strlen (base) + 1, value, size, &prefix, &suffix);
+
+        if (base && prefix + suffix >= ITEM_DELTA_MIN_SAVING && (prefix + suffix) * 2 >= size)
+            held += size - prefix - suffix;
+        else
+        {
+            held += size;
+            base = value;
+        }
+    }
+
+    return held;
+}
+
+/* Bytes of values in the history file, as g_paste_history_write_file writes
+ * them: each item against the one written just before */
+static gsize
+written_size (const GPtrArray *trace)
+{
+    const gchar *previous = NULL;
+    gsize written = 0;
+
+    for (guint i = 0; i < trace->len; ++i)
+    {
+        const gchar *value = NEWEST (trace, i);
+        gsize length = strlen (value);
+        gsize prefix = 0, suffix = 0;
+
+        if (previous)
+            g_paste_text_kernel_common_affixes (previous, strlen (previous), value, length, &prefix, &suffix);
+        if (prefix + suffix < HISTORY_DELTA_MIN_SAVING)
+            prefix = suffix = 0;
+
+        written += length - prefix - suffix;
+        previous = value;
+    }
+
+    return written;
+}
+
+static void
+bench_pack (gconstpointer data)
+{
+    g_paste_bench_sink += packed_size (data);
+}
+
+int
+main (void)
+{
+    GPtrArray *trace = trace_new ();
+    gsize full = 0, length = 0;
+
+    for (guint i = 0; i < trace->len; ++i)
+    {
+        gsize size = strlen (g_ptr_array_index (trace, i));
+
+        full += size + 1;
+        length += size;
+    }
+
+    gsize held = packed_size (trace);
+    gsize written = written_size (trace);
+    gchar *label = g_strdup_printf ("pack %u items", trace->len);
+
+    g_paste_bench_report_time (label, g_paste_bench_run (bench_pack, trace));
+    printf ("%-48s %7.1f kB -> %7.1f kB (-%.0f%%)\n", "values in memory",
+            full / 1e3, held / 1e3, 100. - 100. * held / full);
+    printf ("%-48s %7.1f kB -> %7.1f kB (-%.0f%%)\n", "values in the history file",
+            length / 1e3, written / 1e3, 100. - 100. * written / length);
+
+    g_free (label);
+    g_ptr_array_unref (trace);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,101 @@
+/*
+ *      This file is part of GPaste.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      GPaste is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      GPaste is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with GPaste.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gpaste-bench.h"
+
+#include <gpaste-text-kernel.h>
+
+typedef struct
+{
+    guchar *pixels;
+    gsize   row_length;
+    guint   rows;
+    gsize   rowstride;
+} Pixels;
+
+/* RGBA rows as GdkPixbuf lays them out */
+static Pixels *
+pixels_new (guint width,
+            guint height)
+{
+    Pixels *pixels = g_new (Pixels, 1);
+    guint32 seed = 42;
+
+    pixels->row_length = width * 4;
+    pixels->rows = height;
+    pixels->rowstride = (pixels->row_length + 3) & ~(gsize) 3;
+    pixels->pixels = g_malloc (pixels->rowstride * height);
+    for (gsize i = 0; i < pixels->rowstride * height; ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        pixels->pixels[i] = (guchar) (seed >> 16);
+    }
+
+    return pixels;
+}
+
+static void
+pixels_free (Pixels *pixels)
+{
+    g_free (pixels->pixels);
+    g_free (pixels);
+}
+
+static void
+bench_kernel_hash_pixels (gconstpointer data)
+{
+    const Pixels *pixels = data;
+
+    g_paste_bench_sink += g_paste_text_kernel_hash_pixels (pixels->pixels, pixels->row_length, pixels->rows, pixels->rowstride);
+}
+
+/* What fingerprinting a captured image used to cost */
+static void
+bench_sha256 (gconstpointer data)
+{
+    const Pixels *pixels = data;
+    gchar *checksum = g_compute_checksum_for_data (G_CHECKSUM_SHA256, pixels->pixels, pixels->rowstride * pixels->rows);
+
+    g_paste_bench_sink += checksum[0];
+    g_free (checksum);
+}
+
+static void
+bench_image (const gchar *name,
+             guint        width,
+             guint        height)
+{
+    Pixels *pixels = pixels_new (width, height);
+
+    printf ("%s, %ux%u RGBA, %.1f MiB\n", name, width, height, pixels->rowstride * height / 1048576.);
+    g_paste_bench_report_time ("  fingerprint (kernel)", g_paste_bench_run (bench_kernel_hash_pixels, pixels));
+    g_paste_bench_report_time ("  fingerprint (SHA-256)", g_paste_bench_run (bench_sha256, pixels));
+
+    pixels_free (pixels);
+}
+
+int
+main (void)
+{
+    bench_image ("1080p", 1920, 1080);
+    bench_image ("4K", 3840, 2160);
+    bench_image ("8K", 7680, 4320);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,129 @@
+/*
+ *      This file is part of GPaste.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      GPaste is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      GPaste is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with GPaste.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gpaste-bench.h"
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+typedef struct
+{
+    GdkPixbuf *image;
+    gchar     *path;
+    gsize      length;
+} Image;
+
+/* A gradient with some noise, compresses about like a screenshot */
+static Image *
+image_new (gint width,
+           gint height)
+{
+    Image *image = g_new (Image, 1);
+    GdkPixbuf *pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8, width, height);
+    guchar *pixels = gdk_pixbuf_get_pixels (pixbuf);
+    gint rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+    guint32 seed = 42;
+
+    for (gint y = 0; y < height; ++y)
+    {
+        guchar *row = pixels + y * rowstride;
+
+        for (gint x = 0; x < width; ++x)
+        {
+            seed = seed * 1103515245 + 12345;
+            row[4 * x] = (guchar) (x * 255 / width);
+            row[4 * x + 1] = (guchar) (y * 255 / height);
+            row[4 * x + 2] = (guchar) ((seed >> 16) & 0x0F);
+            row[4 * x + 3] = 0xFF;
+        }
+    }
+
+    gchar *buffer;
+
+    image->image = pixbuf;
+    image->path = g_build_filename (g_get_tmp_dir (), "gpaste-bench-image.png", NULL);
+    gdk_pixbuf_save_to_buffer (pixbuf, &buffer, &image->length, "png", NULL, NULL); /* Error, Params */
+    g_file_set_contents (image->path, buffer, image->length, NULL); /* Error */
+    g_free (buffer);
+
+    return image;
+}
+
+static void
+image_free (Image *image)
+{
+    g_unlink (image->path);
+    g_free (image->path);
+    g_object_unref (image->image);
+    g_free (image);
+}
+
+/* What each image/png request used to cost */
+static void
+bench_encode (gconstpointer data)
+{
+    const Image *image = data;
+    gchar *buffer;
+    gsize length;
+
+    gdk_pixbuf_save_to_buffer (image->image, &buffer, &length, "png", NULL, NULL); /* Error, Params */
+    g_paste_bench_sink += length;
+    g_free (buffer);
+}
+
+/* Mapping the stored file, plus the copy GTK makes into the selection */
+static void
+bench_map (gconstpointer data)
+{
+    const Image *image = data;
+    GMappedFile *mapped = g_mapped_file_new (image->path, FALSE, NULL); /* Error */
+    gsize length = g_mapped_file_get_length (mapped);
+    gchar *copy = g_malloc (length);
+
+    memcpy (copy, g_mapped_file_get_contents (mapped), length);
+    g_paste_bench_sink += copy[length - 1];
+    g_free (copy);
+    g_mapped_file_unref (mapped);
+}
+
+static void
+bench_image (const gchar *name,
+             gint         width,
+             gint         height)
+{
+    Image *image = image_new (width, height);
+
+    printf ("%s, %dx%d, %.1f MiB as PNG\n", name, width, height, image->length / 1048576.);
+    g_paste_bench_report_time ("  image/png, encoded", g_paste_bench_run (bench_encode, image));
+    g_paste_bench_report_time ("  image/png, mapped", g_paste_bench_run (bench_map, image));
+
+    image_free (image);
+}
+
+int
+main (void)
+{
+    g_type_init ();
+
+    bench_image ("1080p", 1920, 1080);
+    bench_image ("4K", 3840, 2160);
+
+    return EXIT_SUCCESS;
+}
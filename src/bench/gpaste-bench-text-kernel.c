@@ -0,0 +1,180 @@
+/*
+ *      This file is part of GPaste.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      GPaste is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      GPaste is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with GPaste.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gpaste-bench.h"
+
+#include <gpaste-text-kernel.h>
+#include <string.h>
+
+#define TEXT_SIZE (16 * 1024 * 1024)
+
+typedef struct
+{
+    gchar *text;
+    gsize  length;
+    gchar *copy;
+    gchar *escaped;
+    gsize  escaped_length;
+} Text;
+
+static Text *
+text_new (const gchar *pattern)
+{
+    Text *text = g_new (Text, 1);
+    gsize pattern_length = strlen (pattern);
+
+    text->text = g_malloc (TEXT_SIZE + 1);
+    for (gsize i = 0; i < TEXT_SIZE; i += pattern_length)
+        memcpy (text->text + i, pattern, MIN (pattern_length, TEXT_SIZE - i));
+    /* Don't cut a character in two */
+    text->length = TEXT_SIZE - (TEXT_SIZE % pattern_length);
+    text->text[text->length] = '\0';
+    text->copy = g_strdup (text->text);
+    text->escaped = g_paste_text_kernel_escape (text->text, text->length, &text->escaped_length);
+
+    return text;
+}
+
+static void
+text_free (Text *text)
+{
+    g_free (text->escaped);
+    g_free (text->copy);
+    g_free (text->text);
+    g_free (text);
+}
+
+static void
+bench_kernel_validate (gconstpointer data)
+{
+    const Text *text = data;
+
+    g_paste_bench_sink += g_paste_text_kernel_validate_utf8 (text->text, text->length);
+}
+
+static void
+bench_glib_validate (gconstpointer data)
+{
+    const Text *text = data;
+
+    g_paste_bench_sink += g_utf8_validate (text->text, text->length, NULL);
+}
+
+static void
+bench_kernel_hash (gconstpointer data)
+{
+    const Text *text = data;
+
+    g_paste_bench_sink += g_paste_text_kernel_hash (text->text, text->length);
+}
+
+/* What comparing two items used to cost */
+static void
+bench_strcmp (gconstpointer data)
+{
+    const Text *text = data;
+
+    g_paste_bench_sink += strcmp (text->text, text->copy);
+}
+
+static void
+bench_kernel_escape (gconstpointer data)
+{
+    const Text *text = data;
+    gchar *escaped = g_paste_text_kernel_escape (text->text, text->length, NULL);
+
+    g_paste_bench_sink += escaped[0];
+    g_free (escaped);
+}
+
+static void
+bench_kernel_unescape (gconstpointer data)
+{
+    const Text *text = data;
+    gchar *unescaped = g_paste_text_kernel_unescape (text->escaped, text->escaped_length, NULL);
+
+    g_paste_bench_sink += unescaped[0];
+    g_free (unescaped);
+}
+
+static gchar *
+regex_replace (const gchar *text,
+               const gchar *pattern,
+               const gchar *replacement)
+{
+    GRegex *regex = g_regex_new (pattern, 0, 0, NULL);
+    gchar *result = g_regex_replace_literal (regex, text, -1, 0, replacement, 0, NULL);
+
+    g_regex_unref (regex);
+
+    return result;
+}
+
+/* The way the history file used to be escaped */
+static void
+bench_regex_escape (gconstpointer data)
+{
+    const Text *text = data;
+    gchar *amp = regex_replace (text->text, "&", "&amp;");
+    gchar *escaped = regex_replace (amp, ">", "&gt;");
+
+    g_paste_bench_sink += escaped[0];
+    g_free (escaped);
+    g_free (amp);
+}
+
+static void
+bench_regex_unescape (gconstpointer data)
+{
+    const Text *text = data;
+    gchar *gt = regex_replace (text->escaped, "&gt;", ">");
+    gchar *unescaped = regex_replace (gt, "&amp;", "&");
+
+    g_paste_bench_sink += unescaped[0];
+    g_free (unescaped);
+    g_free (gt);
+}
+
+static void
+bench_text (const gchar *name,
+            const gchar *pattern)
+{
+    Text *text = text_new (pattern);
+
+    printf ("%s, %.1f MiB\n", name, text->length / 1048576.);
+    g_paste_bench_report_throughput ("  validate utf8 (kernel)", text->length, g_paste_bench_run (bench_kernel_validate, text));
+    g_paste_bench_report_throughput ("  validate utf8 (g_utf8_validate)", text->length, g_paste_bench_run (bench_glib_validate, text));
+    g_paste_bench_report_throughput ("  hash (kernel)", text->length, g_paste_bench_run (bench_kernel_hash, text));
+    g_paste_bench_report_throughput ("  compare (strcmp)", text->length, g_paste_bench_run (bench_strcmp, text));
+    g_paste_bench_report_throughput ("  escape (kernel)", text->length, g_paste_bench_run (bench_kernel_escape, text));
+    g_paste_bench_report_throughput ("  escape (GRegex)", text->length, g_paste_bench_run (bench_regex_escape, text));
+    g_paste_bench_report_throughput ("  unescape (kernel)", text->escaped_length, g_paste_bench_run (bench_kernel_unescape, text));
+    g_paste_bench_report_throughput ("  unescape (GRegex)", text->escaped_length, g_paste_bench_run (bench_regex_unescape, text));
+
+    text_free (text);
+}
+
+int
+main (void)
+{
+    bench_text ("ASCII text", "The quick brown fox jumps over the lazy dog & the cat > the mouse.\n");
+    bench_text ("UTF-8 text", "Ça coûte 5 € — 日本語のテキスト & ελληνικά > русский.\n");
+
+    return EXIT_SUCCESS;
+}
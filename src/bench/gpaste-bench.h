@@ -0,0 +1,93 @@
+/*
+ *      This file is part of GPaste.
+ *
+ *      Copyright 2013 Marc-Antoine Perennou <Marc-Antoine@Perennou.com>
+ *
+ *      GPaste is free software: you can redistribute it and/or modify
+ *      it under the terms of the GNU General Public License as published by
+ *      the Free Software Foundation, either version 3 of the License, or
+ *      (at your option) any later version.
+ *
+ *      GPaste is distributed in the hope that it will be useful,
+ *      but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *      MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *      GNU General Public License for more details.
+ *
+ *      You should have received a copy of the GNU General Public License
+ *      along with GPaste.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __G_PASTE_BENCH_H__
+#define __G_PASTE_BENCH_H__
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Keeps the compiler from dropping the work being measured */
+static volatile guint64 g_paste_bench_sink;
+
+typedef void (*GPasteBenchFunc) (gconstpointer data);
+
+/* Runs @func over and over for half a second, returns the mean time of a run in µs */
+static inline gdouble
+g_paste_bench_run (GPasteBenchFunc func,
+                   gconstpointer   data)
+{
+    guint64 runs = 0;
+    gint64 start = g_get_monotonic_time ();
+    gint64 now;
+
+    do
+    {
+        func (data);
+        ++runs;
+    } while ((now = g_get_monotonic_time ()) - start < 500000);
+
+    return (gdouble) (now - start) / runs;
+}
+
+static inline void
+g_paste_bench_report_throughput (const gchar *name,
+                                 gsize        size,
+                                 gdouble      usecs)
+{
+    printf ("%-48s %10.2f GB/s\n", name, size / usecs / 1000.);
+}
+
+static inline void
+g_paste_bench_report_time (const gchar *name,
+                           gdouble      usecs)
+{
+    printf ("%-48s %10.3f ms\n", name, usecs / 1000.);
+}
+
+static int
+g_paste_bench_compare_samples (gconstpointer a,
+                               gconstpointer b)
+{
+    gint64 sa = *(const gint64 *) a;
+    gint64 sb = *(const gint64 *) b;
+
+    return (sa > sb) - (sa < sb);
+}
+
+/* Sorts @samples (in µs) */
+static inline void
+g_paste_bench_report_latencies (const gchar *name,
+                                gint64      *samples,
+                                guint        n_samples)
+{
+    if (!n_samples)
+        return;
+
+    qsort (samples, n_samples, sizeof (gint64), g_paste_bench_compare_samples);
+    printf ("%-32s p50 %8.3f ms   p99 %8.3f ms   max %8.3f ms   (%u calls)\n",
+            name,
+            samples[n_samples / 2] / 1000.,
+            samples[(n_samples * 99) / 100] / 1000.,
+            samples[n_samples - 1] / 1000.,
+            n_samples);
+}
+
+#endif /*__G_PASTE_BENCH_H__*/
@@ -24,6 +24,9 @@
 #include <gpaste-client.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#define KIND_OPTION "--kind="
 
 static void
 show_help (const gchar *caller)
@@ -36,6 +39,7 @@ show_help (const gchar *caller)
     printf (_("%s list-histories: list available histories\n"), caller);
     printf (_("%s raw-history: print the history without indexes\n"), caller);
     printf (_("%s zero-history: print the history with NUL as separator\n"), caller);
+    printf (_("%s watch [--zero] [--kind=text|uris|image]: print the new items as they get copied\n"), caller);
     printf (_("%s add <text>: set text to clipboard\n"), caller);
     printf (_("%s get <number>: get the <number>th item from the history\n"), caller);
     printf (_("%s select <number>: set the <number>th item from the history to the clipboard\n"), caller);
@@ -43,6 +47,7 @@ show_help (const gchar *caller)
     printf (_("%s file <path>: put the content of the file at <path> into the clipboard\n"), caller);
     printf (_("whatever | %s: set the output of whatever to clipboard\n"), caller);
     printf (_("%s empty: empty the history\n"), caller);
+    printf (_("%s gc: delete the stored images no history uses anymore\n"), caller);
     printf (_("%s start: start tracking clipboard changes\n"), caller);
     printf (_("%s stop: stop tracking clipboard changes\n"), caller);
     printf (_("%s quit: alias for stop\n"), caller);
@@ -67,16 +72,19 @@ show_history (GPasteClient *client,
               gboolean      zero,
               GError      **error)
 {
-    gchar **history = g_paste_client_get_history (client, error);
+    /* The history only holds previews, scripts want the whole texts, all from the same history */
+    gchar **history = (raw || zero) ?
+        g_paste_client_get_raw_history (client, error) :
+        g_paste_client_get_history (client, error);
 
     if (!*error)
     {
         unsigned int i = 0;
 
-        for (gchar **h = history; *h; ++h)
+        for (gchar **h = history; *h; ++h, ++i)
         {
             if (!raw)
-                printf ("%d: ", i++);
+                printf ("%d: ", i);
             printf ("%s%c", *h, (zero) ? '\0' : '\n');
         }
 
@@ -84,6 +92,97 @@ show_history (GPasteClient *client,
     }
 }
 
+typedef struct
+{
+    GMainLoop    *loop;
+    gboolean      zero;
+    const gchar  *kind;
+} Watch;
+
+/* Once asked to, the daemon sends us each item it adds along with its kind, none gets lost nor fetched twice */
+static void
+watch_item_added (GPasteClient *client G_GNUC_UNUSED,
+                  const gchar  *kind,
+                  const gchar  *value,
+                  gpointer      user_data)
+{
+    Watch *watch = user_data;
+
+    if (!*value || (watch->kind && g_ascii_strcasecmp (kind, watch->kind) != 0))
+        return;
+
+    printf ("%s%c", value, (watch->zero) ? '\0' : '\n');
+    fflush (stdout);
+}
+
+static void
+watch_name_lost (GPasteClient *client G_GNUC_UNUSED,
+                 gpointer      user_data)
+{
+    g_main_loop_quit (((Watch *) user_data)->loop);
+}
+
+static gboolean
+is_kind (const gchar *kind)
+{
+    return (g_strcmp0 (kind, "text") == 0 ||
+            g_strcmp0 (kind, "uris") == 0 ||
+            g_strcmp0 (kind, "image") == 0);
+}
+
+/* Returns FALSE if the options don't make sense */
+static gboolean
+watch_history (GPasteClient *client,
+               int           argc,
+               char         *argv[],
+               GError      **error)
+{
+    Watch watch = { NULL, FALSE, NULL };
+
+    for (int i = 0; i < argc; ++i)
+    {
+        if (g_strcmp0 (argv[i], "--zero") == 0 ||
+            g_strcmp0 (argv[i], "-z") == 0)
+        {
+            watch.zero = TRUE;
+        }
+        else if (g_str_has_prefix (argv[i], KIND_OPTION) && is_kind (argv[i] + strlen (KIND_OPTION)))
+            watch.kind = argv[i] + strlen (KIND_OPTION);
+        else
+            return FALSE;
+    }
+
+    g_paste_client_watch (client, error);
+    if (*error)
+        return TRUE;
+
+    watch.loop = g_main_loop_new (NULL, FALSE);
+
+    gulong item_added_signal = g_signal_connect (G_OBJECT (client),
+                                                 "item-added",
+                                                 G_CALLBACK (watch_item_added),
+                                                 &watch);
+    gulong name_lost_signal = g_signal_connect (G_OBJECT (client),
+                                                "name-lost",
+                                                G_CALLBACK (watch_name_lost),
+                                                &watch);
+
+    g_main_loop_run (watch.loop);
+
+    g_signal_handler_disconnect (client, name_lost_signal);
+    g_signal_handler_disconnect (client, item_added_signal);
+    g_main_loop_unref (watch.loop);
+
+    return TRUE;
+}
+
+static gboolean
+is_watch (const gchar *option)
+{
+    return (g_strcmp0 (option, "w") == 0 ||
+            g_strcmp0 (option, "watch") == 0);
+}
+
 static gboolean
 is_help (const gchar *option)
 {
@@ -130,14 +229,24 @@ main (int argc, char *argv[])
 
     g_type_init ();
 
-    GPasteClient *client = g_paste_client_new ();
+    /* Only watching needs the signals */
+    gboolean watching = (argc > 1 && is_watch (argv[1]));
+    GPasteClient *client = (watching) ? g_paste_client_new () : g_paste_client_new_light ();
     GError *error = NULL;
     const gchar *arg1, *arg2;
 
     if (!client)
         failure_exit ();
 
-    if (!isatty (fileno (stdin)))
+    if (watching)
+    {
+        if (!watch_history (client, argc - 2, argv + 2, &error))
+        {
+            show_help (argv[0]);
+            status = EXIT_FAILURE;
+        }
+    }
+    else if (!isatty (fileno (stdin)))
     {
         /* We are being piped */
         GString *data = g_string_new ("");
@@ -178,6 +287,16 @@ main (int argc, char *argv[])
             {
                 g_paste_client_empty (client, &error);
             }
+            else if (g_strcmp0 (arg1, "gc") == 0)
+            {
+                guint64 reclaimed = g_paste_client_collect_garbage (client, &error);
+                if (!error)
+                {
+                    gchar *size = g_format_size (reclaimed);
+                    printf (_("Reclaimed %s\n"), size);
+                    g_free (size);
+                }
+            }
 #ifdef ENABLE_APPLET
             else if (g_strcmp0 (arg1, "applet") == 0)
             {
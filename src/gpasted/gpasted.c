@@ -23,12 +23,36 @@
 #include <gpaste.h>
 #include <gpaste-daemon.h>
 #include <glib/gi18n-lib.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 #define ELEMENTSOF(foo) sizeof(foo)/sizeof(foo[0])
 
+/* Tells the reexecuted daemon where to find the state of the previous one */
+#define STATE_FD_ENV "GPASTE_STATE_FD"
+
+#ifdef __NR_memfd_create
+#  ifndef MFD_ALLOW_SEALING
+#    define MFD_ALLOW_SEALING 0x0002U
+#  endif
+#  ifndef F_ADD_SEALS
+#    define F_ADD_SEALS   1033
+#    define F_GET_SEALS   1034
+#    define F_SEAL_SEAL   0x0001
+#    define F_SEAL_SHRINK 0x0002
+#    define F_SEAL_GROW   0x0004
+#    define F_SEAL_WRITE  0x0008
+#  endif
+#  define STATE_SEALS (F_SEAL_SEAL | F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE)
+#endif
+
 static GMainLoop *main_loop;
 
 enum
@@ -55,14 +79,188 @@ on_name_lost (GPasteDaemon *g_paste_daemon G_GNUC_UNUSED,
     exit (EXIT_FAILURE);
 }
 
+#ifdef __NR_memfd_create
+/* Hand the history over to the next process in a sealed memfd, inherited through exec */
 static void
-reexec (GPasteDaemon *g_paste_daemon G_GNUC_UNUSED,
-        gpointer      user_data G_GNUC_UNUSED)
+save_state (GVariant *state)
+{
+    const gchar *data = g_variant_get_data (state);
+    gsize size = g_variant_get_size (state);
+    gint fd = (gint) syscall (__NR_memfd_create, "gpaste-state", MFD_ALLOW_SEALING);
+    gboolean written = (fd >= 0);
+
+    for (gsize done = 0; written && done < size;)
+    {
+        ssize_t ret = write (fd, data + done, size - done);
+
+        if (ret >= 0)
+            done += (gsize) ret;
+        else if (errno != EINTR)
+            written = FALSE;
+    }
+
+    if (written && fcntl (fd, F_ADD_SEALS, STATE_SEALS) == 0)
+    {
+        gchar *value = g_strdup_printf ("%d", fd);
+
+        g_setenv (STATE_FD_ENV, value, TRUE);
+        g_free (value);
+    }
+    else if (fd >= 0)
+        close (fd);
+}
+#endif
+
+static gboolean
+adopt_state (GPasteHistory *history)
+{
+    const gchar *value = g_getenv (STATE_FD_ENV);
+    gboolean adopted = FALSE;
+
+    if (!value)
+        return FALSE;
+
+    gint fd = (gint) g_ascii_strtoll (value, NULL, 10);
+
+    /* Don't hand it over to our own children */
+    g_unsetenv (STATE_FD_ENV);
+
+#ifdef __NR_memfd_create
+    struct stat st;
+
+    /* Only trust what can't change under our feet anymore */
+    if (fd > 2 && fcntl (fd, F_GET_SEALS) == STATE_SEALS && fstat (fd, &st) == 0 && st.st_size > 0)
+    {
+        gpointer data = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (data != MAP_FAILED)
+        {
+            GVariant *state = g_variant_ref_sink (g_variant_new_from_data (G_VARIANT_TYPE (G_PASTE_HISTORY_STATE_TYPE),
+                                                                           data,
+                                                                           st.st_size,
+                                                                           FALSE, /* trusted */
+                                                                           NULL, /* notify */
+                                                                           NULL)); /* user data */
+
+            adopted = g_paste_history_adopt_state (history, state);
+            g_variant_unref (state);
+            munmap (data, st.st_size);
+        }
+    }
+#endif
+
+    if (fd > 2)
+        close (fd);
+
+    return adopted;
+}
+
+/* The history got saved along with its state, the next process reads it otherwise */
+static void
+state_ready (GPasteHistory *history G_GNUC_UNUSED,
+             GVariant      *state G_GNUC_UNUSED,
+             gpointer       user_data G_GNUC_UNUSED)
 {
     g_main_loop_quit (main_loop);
+#ifdef __NR_memfd_create
+    save_state (state);
+#endif
     execl (PKGLIBEXECDIR "/gpasted", "gpasted", NULL);
 }
 
+/* Asking again while waiting for pending writes changes nothing */
+static void
+reexec (GPasteDaemon *g_paste_daemon G_GNUC_UNUSED,
+        gpointer      user_data)
+{
+    g_paste_history_request_state (user_data, state_ready, NULL); /* user data */
+}
+
+typedef struct
+{
+    GPasteHistory           *history;
+    GPasteClipboardsManager *clipboards_manager;
+    GPasteKeybinder         *keybinder;
+    GPasteClipboard         *clipboards[2];
+    GPasteKeybinding        *keybindings[2];
+    gulong                   loaded_signal;
+    gint64                   start;
+} Startup;
+
+/* Run with G_MESSAGES_DEBUG=all to see where startup time goes */
+static void
+trace_startup (const Startup *startup,
+               const gchar   *phase)
+{
+    g_debug ("startup: %s after %" G_GINT64_FORMAT "us", phase, g_get_monotonic_time () - startup->start);
+}
+
+static gboolean
+start_clipboards (gpointer user_data)
+{
+    Startup *startup = user_data;
+
+    /* Their content gets probed asynchronously, a hung owner won't block us */
+    for (guint c = 0; c < ELEMENTSOF (startup->clipboards); ++c)
+        g_paste_clipboards_manager_add_clipboard (startup->clipboards_manager, startup->clipboards[c]);
+    g_paste_clipboards_manager_activate (startup->clipboards_manager);
+    trace_startup (startup, "clipboards tracked");
+
+    return FALSE;
+}
+
+static gboolean
+start_keybindings (gpointer user_data)
+{
+    Startup *startup = user_data;
+
+    for (guint k = 0; k < ELEMENTSOF (startup->keybindings); ++k)
+        g_paste_keybinder_add_keybinding (startup->keybinder, startup->keybindings[k]);
+    g_paste_keybinder_activate_all (startup->keybinder);
+    trace_startup (startup, "keys grabbed");
+
+    return FALSE;
+}
+
+/* An empty clipboard gets the head of the history, wait for it */
+static void
+history_loaded (GPasteHistory *history,
+                gpointer       user_data)
+{
+    Startup *startup = user_data;
+
+    g_signal_handler_disconnect (history, startup->loaded_signal);
+    trace_startup (startup, "history loaded");
+
+    g_idle_add_full (G_PRIORITY_LOW, start_clipboards, startup, NULL); /* notify */
+}
+
+/* Runs before any method call gets dispatched, those get answered from what's loaded so far */
+static gboolean
+start_history (gpointer user_data)
+{
+    Startup *startup = user_data;
+
+    /* Reexecuted, the previous process already did the loading */
+    if (adopt_state (startup->history))
+    {
+        trace_startup (startup, "history adopted");
+        g_idle_add_full (G_PRIORITY_LOW, start_clipboards, startup, NULL); /* notify */
+    }
+    else
+    {
+        startup->loaded_signal = g_signal_connect (G_OBJECT (startup->history),
+                                                   "loaded",
+                                                   G_CALLBACK (history_loaded),
+                                                   startup);
+        g_paste_history_load_in_background (startup->history);
+    }
+
+    g_idle_add (start_keybindings, startup);
+
+    return FALSE;
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -73,20 +271,19 @@ main (int argc, char *argv[])
     g_type_init ();
     gtk_init (&argc, &argv);
 
+    Startup startup = { .start = g_get_monotonic_time () };
     GPasteSettings *settings = g_paste_settings_new ();
-    GPasteHistory *history = g_paste_history_new (settings);
-    GPasteClipboardsManager *clipboards_manager = g_paste_clipboards_manager_new (history, settings);
-    GPasteKeybinder *keybinder = g_paste_keybinder_new ();
+    GPasteHistory *history = startup.history = g_paste_history_new (settings);
+    GPasteClipboardsManager *clipboards_manager = startup.clipboards_manager = g_paste_clipboards_manager_new (history, settings);
+    GPasteKeybinder *keybinder = startup.keybinder = g_paste_keybinder_new ();
     GPasteDaemon *g_paste_daemon = g_paste_daemon_new (history, settings, clipboards_manager, keybinder);
-    GPasteClipboard *clipboard = g_paste_clipboard_new (GDK_SELECTION_CLIPBOARD, settings);
-    GPasteClipboard *primary = g_paste_clipboard_new (GDK_SELECTION_PRIMARY, settings);
-
-    GPasteKeybinding *keybindings[] = {
-        G_PASTE_KEYBINDING (g_paste_paste_and_pop_keybinding_new (settings,
-                                                                  history)),
-        G_PASTE_KEYBINDING (g_paste_show_history_keybinding_new (settings,
-                                                                 g_paste_daemon))
-    };
+
+    startup.clipboards[0] = g_paste_clipboard_new (GDK_SELECTION_CLIPBOARD, settings);
+    startup.clipboards[1] = g_paste_clipboard_new (GDK_SELECTION_PRIMARY, settings);
+    startup.keybindings[0] = G_PASTE_KEYBINDING (g_paste_paste_and_pop_keybinding_new (settings,
+                                                                                       history));
+    startup.keybindings[1] = G_PASTE_KEYBINDING (g_paste_show_history_keybinding_new (settings,
+                                                                                      g_paste_daemon));
 
     gulong c_signals[C_LAST_SIGNAL] = {
         [C_NAME_LOST] = g_signal_connect (G_OBJECT (g_paste_daemon),
@@ -96,27 +293,9 @@ main (int argc, char *argv[])
         [C_REEXECUTE_SELF] = g_signal_connect (G_OBJECT (g_paste_daemon),
                                                "reexecute-self",
                                                G_CALLBACK (reexec),
-                                               NULL) /* user_data */
+                                               history) /* user_data */
     };
 
-    for (guint k = 0; k < ELEMENTSOF (keybindings); ++k)
-        g_paste_keybinder_add_keybinding (keybinder, keybindings[k]);
-
-    g_paste_history_load (history);
-    g_paste_keybinder_activate_all (keybinder);
-    g_paste_clipboards_manager_add_clipboard (clipboards_manager, clipboard);
-    g_paste_clipboards_manager_add_clipboard (clipboards_manager, primary);
-    g_paste_clipboards_manager_activate (clipboards_manager);
-
-    g_object_unref (history);
-    g_object_unref (clipboards_manager);
-    g_object_unref (keybinder);
-    g_object_unref (clipboard);
-    g_object_unref (primary);
-
-    for (guint k = 0; k < ELEMENTSOF (keybindings); ++k)
-        g_object_unref (keybindings[k]);
-
     signal (SIGTERM, &signal_handler);
     signal (SIGINT, &signal_handler);
 
@@ -124,8 +303,12 @@ main (int argc, char *argv[])
 
     gint exit_status = EXIT_SUCCESS;
     GError *error = NULL;
+
+    /* Clients waiting for us to be activated shouldn't wait for anything else */
     if (g_paste_daemon_own_bus_name (g_paste_daemon, &error))
     {
+        trace_startup (&startup, "bus name requested");
+        g_idle_add_full (G_PRIORITY_HIGH, start_history, &startup, NULL); /* notify */
         g_main_loop_run (main_loop);
     }
     else
@@ -137,6 +320,15 @@ main (int argc, char *argv[])
 
     g_signal_handler_disconnect (g_paste_daemon, c_signals[C_NAME_LOST]);
     g_signal_handler_disconnect (g_paste_daemon, c_signals[C_REEXECUTE_SELF]);
+
+    for (guint k = 0; k < ELEMENTSOF (startup.keybindings); ++k)
+        g_object_unref (startup.keybindings[k]);
+    for (guint c = 0; c < ELEMENTSOF (startup.clipboards); ++c)
+        g_object_unref (startup.clipboards[c]);
+
+    g_object_unref (history);
+    g_object_unref (clipboards_manager);
+    g_object_unref (keybinder);
     g_object_unref (settings);
     g_object_unref (g_paste_daemon);
     g_main_loop_unref (main_loop);